@@ -0,0 +1,15 @@
+#!/bin/sh
+# Times bench/concat.lox at 1/8, 1/4, 1/2 and the full 10 MB. With ropes the
+# time doubles with the size; with flat strings it quadruples.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+WORK=${WORK:-/tmp/concat_bench}
+mkdir -p "$WORK"
+
+for pieces in 125000 250000 500000 1000000; do
+    sed "s/^var pieces = .*/var pieces = $pieces;/" "$ROOT/bench/concat.lox" > "$WORK/concat.lox"
+    start=$(date +%s%N)
+    "$LOX" "$WORK/concat.lox" > /dev/null
+    end=$(date +%s%N)
+    echo "$((pieces * 10 / 1000)) KB: $(( (end - start) / 1000000 )) ms"
+done
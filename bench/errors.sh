@@ -0,0 +1,21 @@
+#!/bin/sh
+# Feeds the REPL 20000 lines that each raise a runtime error, cycling through
+# every kind the tree-walker reports, and times them. Then prints the size of
+# the binary, since how errors are represented shows up in the code of every
+# node that can raise one.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+LINES=${LINES:-20000}
+
+awk -v n="$LINES" 'BEGIN {
+    print "class A {}"
+    print "var a = A();"
+    split("1 - nil;|nil + 1;|undefined_name;|nil();|clock(1);|nil.x;|nil.x = 1;|a.x;", errors, "|")
+    for (i = 0; i < n; i++) print errors[i % 8 + 1]
+}' > /tmp/errors_bench.lox
+
+start=$(date +%s%N)
+"$LOX" < /tmp/errors_bench.lox > /dev/null
+end=$(date +%s%N)
+echo "$LINES errors: $(( (end - start) / 1000000 )) ms"
+size "$LOX"
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Compares the pointer tree and the flat AST cores of the tree engine.
+# Builds both configurations and reports cache behaviour with `perf stat`.
+# Besides bench/*.lox it runs a generated script whose one function has a
+# 20000-statement body, so the AST no longer fits in the caches. Then it
+# reports the peak RSS of each on the generated 50 MB script of parse_rss.sh.
+set -e
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/_bench_build}
+WORK=${WORK:-/tmp/flat_ast_bench}
+mkdir -p "$WORK"
+
+cmake -S "$ROOT" -B "$BUILD/pointer" -DCMAKE_BUILD_TYPE=Release -DLOX_FLAT_AST=OFF > /dev/null
+cmake -S "$ROOT" -B "$BUILD/flat" -DCMAKE_BUILD_TYPE=Release -DLOX_FLAT_AST=ON > /dev/null
+cmake --build "$BUILD/pointer" -j > /dev/null
+cmake --build "$BUILD/flat" -j > /dev/null
+
+awk 'BEGIN {
+    print "fun body(n) {\n  var a = 0;\n  var b = 1;"
+    for (i = 0; i < 20000; i++) {
+        printf "  if (a < n) { a = a + %d; } else { b = b - 1; }\n", i % 7
+    }
+    print "  return a + b;\n}\nvar t = 0;"
+    print "for (var i = 0; i < 50; i = i + 1) { t = t + body(i); }\nprint t;"
+}' > "$WORK/wide.lox"
+
+for script in "$ROOT"/bench/*.lox "$WORK/wide.lox"; do
+    for core in pointer flat; do
+        echo "== $(basename "$script") ($core)"
+        perf stat -e cycles,instructions,cache-references,cache-misses,L1-dcache-load-misses \
+            "$BUILD/$core/lox" "$script" > /dev/null
+    done
+done
+
+for core in pointer flat; do
+    echo "== 50 MB script ($core)"
+    LOX="$BUILD/$core/lox" "$ROOT/bench/parse_rss.sh"
+done
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Generates a script of functions that are never called, so running it is
+# almost all scanning, parsing and resolving, and reports the throughput in
+# MB/s. The function bodies hold blocks, calls, string and number literals.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+WORK=${WORK:-/tmp/parse_bench}
+MB=${MB:-50}
+mkdir -p "$WORK"
+
+awk -v bytes=$((MB * 1024 * 1024)) 'BEGIN {
+    for (i = 0; size < bytes; i++) {
+        block = sprintf("fun f%d(a, b, c) {\n", i) \
+            "    var x = a + b - (c - 4);\n" \
+            "    if (x > 10) { print \"big\"; } else { x = x + 1; }\n" \
+            "    for (var i = 0; i < 3; i = i + 1) { x = clock() + x; }\n" \
+            "    return x;\n" \
+            "}\n"
+        printf "%s", block
+        size += length(block)
+    }
+}' > "$WORK/parse.lox"
+
+bytes=$(wc -c < "$WORK/parse.lox")
+start=$(date +%s%N)
+"$LOX" "$WORK/parse.lox" > /dev/null
+end=$(date +%s%N)
+ms=$(( (end - start) / 1000000 ))
+awk -v bytes="$bytes" -v ms="$ms" 'BEGIN {
+    mb = bytes / 1024 / 1024
+    printf "%.0f MB in %d ms: %.1f MB/s\n", mb, ms, mb * 1000 / (ms > 0 ? ms : 1)
+}'
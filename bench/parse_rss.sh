@@ -0,0 +1,23 @@
+#!/bin/sh
+# Generates a 50 MB script of global declarations, functions and statements
+# and reports the peak RSS of running it, which is dominated by the source,
+# the tokens and the AST. Needs GNU time.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+WORK=${WORK:-/tmp/parse_rss_bench}
+MB=${MB:-50}
+mkdir -p "$WORK"
+
+awk -v bytes=$((MB * 1024 * 1024)) 'BEGIN {
+    for (i = 0; size < bytes; i++) {
+        block = sprintf("var v%d = %d + 4 + 5 - (6 - 2);\n", i, i) \
+            sprintf("if (v%d > 10) { v%d = v%d - 1; } else { print \"small\"; }\n", i, i, i) \
+            sprintf("fun f%d(a, b) { return a + b + 2; }\n", i) \
+            sprintf("v%d = f%d(v%d, 3);\n", i, i, i)
+        printf "%s", block
+        size += length(block)
+    }
+}' > "$WORK/large.lox"
+
+echo "script: $(( $(wc -c < "$WORK/large.lox") / 1024 / 1024 )) MB"
+/usr/bin/time -f "peak RSS: %M KB, %e s" "$LOX" "$WORK/large.lox" > /dev/null
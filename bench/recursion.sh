@@ -0,0 +1,12 @@
+#!/bin/sh
+# Runs bench/recursion.lox (fib(30)) on each engine and reports the time and
+# the number of heap objects the calls allocated.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+
+for engine in tree closure vm; do
+    start=$(date +%s%N)
+    objects=$("$LOX" --engine=$engine --gc-stats "$ROOT/bench/recursion.lox" 2>&1 >/dev/null | sed -n 's/^objects allocated: *//p')
+    end=$(date +%s%N)
+    echo "$engine: $(( (end - start) / 1000000 )) ms, $objects objects allocated"
+done
@@ -0,0 +1,112 @@
+// Compares the NaN-boxed Value with the std::variant it replaced on the
+// operations the interpreter does most: loading a variable out of an
+// environment slot, storing one back, and number arithmetic.
+//
+//   cmake --build build --target value_bench && build/value_bench
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+#include "value.hpp"
+
+namespace {
+
+namespace old {
+    struct Callable;
+    struct Instance;
+    using Object = std::variant<None, Number, std::shared_ptr<std::string>, bool, std::shared_ptr<Callable>, std::shared_ptr<Instance>>;
+
+    Object string(const std::string& text) { return std::make_shared<std::string>(text); }
+    bool is_number(const Object& v) { return std::holds_alternative<Number>(v); }
+    Number as_number(const Object& v) { return std::get<Number>(v); }
+}
+
+namespace boxed {
+    using Object = Value;
+
+    Object string(const std::string& text) { return make_string(LoxString::Text(text)); }
+    bool is_number(const Object& v) { return v.is_number(); }
+    Number as_number(const Object& v) { return v.as_number(); }
+}
+
+constexpr size_t SLOTS = 64;
+constexpr size_t ROUNDS = 2'000'000;
+
+// Keeps results alive so the loops aren't optimized away
+volatile double sink;
+
+template<typename F>
+double time_ns(F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// A slot array like Environment::values, a quarter of it strings
+template<typename Object, typename Make>
+std::vector<Object> slots(Make string) {
+    std::vector<Object> values;
+    for (size_t i = 0; i < SLOTS; i++) {
+        values.push_back(i % 4 == 0 ? string("s" + std::to_string(i)) : Object(double(i)));
+    }
+    return values;
+}
+
+template<typename Object, typename Make, typename IsNumber, typename AsNumber>
+void run(const char* name, Make string, IsNumber is_number, AsNumber as_number) {
+    std::vector<Object> values = slots<Object>(string);
+    const double ops = double(ROUNDS) * SLOTS;
+
+    // Environment::get returns a copy of the slot
+    double load = time_ns([&] {
+        double total = 0;
+        for (size_t r = 0; r < ROUNDS; r++) {
+            for (size_t i = 0; i < SLOTS; i++) {
+                Object v = values[(i * 7 + r) % SLOTS];
+                total += is_number(v);
+            }
+        }
+        sink = total;
+    });
+
+    // Environment::assign copies a value into a slot
+    double store = time_ns([&] {
+        for (size_t r = 0; r < ROUNDS; r++) {
+            for (size_t i = 0; i < SLOTS; i++) {
+                values[i] = values[(i + r) % SLOTS];
+            }
+        }
+        sink = values.size();
+    });
+
+    // `x = x + y` on numbers: two loads, a type check each, and a store
+    std::vector<Object> numbers(SLOTS, Object(1.0));
+    double arithmetic = time_ns([&] {
+        for (size_t r = 0; r < ROUNDS; r++) {
+            for (size_t i = 0; i < SLOTS; i++) {
+                Object x = numbers[i];
+                Object y = numbers[(i + 1) % SLOTS];
+                if (is_number(x) && is_number(y)) {
+                    numbers[i] = Object(as_number(x) + as_number(y) * 0.5 - as_number(x) * 0.5);
+                }
+            }
+        }
+        sink = as_number(numbers[0]);
+    });
+
+    std::printf("%-8s %3zu bytes/value %7.2f ns/load %7.2f ns/store %7.2f ns/add\n",
+        name, sizeof(Object), load / ops, store / ops, arithmetic / ops);
+}
+
+}
+
+
+int main() {
+    run<old::Object>("variant", old::string, old::is_number, old::as_number);
+    run<boxed::Object>("nan-box", boxed::string, boxed::is_number, boxed::as_number);
+    return 0;
+}
@@ -1,12 +1,14 @@
 #include "allocator.hpp"
 #include <cassert>
 #include <cstdint>
-#include <cstdlib>
 #include <algorithm>
+#include <new>
+#include "memory.hpp"
 
 
 ASTAllocator::ASTAllocator(std::size_t blockSize)
 : blockSize_(blockSize),
+nextBlockSize_(blockSize),
 currentBlock_(nullptr),
 currentPtr_(nullptr),
 blockEnd_(nullptr) {}
@@ -15,31 +17,30 @@ blockEnd_(nullptr) {}
 
 ASTAllocator::ASTAllocator(ASTAllocator&& v) noexcept
 : blockSize_{v.blockSize_},
+nextBlockSize_{v.nextBlockSize_},
 blocks_{std::move(v.blocks_)},
-destructors_{std::move(v.destructors_)},
 currentBlock_(v.currentBlock_),
 currentPtr_(v.currentPtr_),
 blockEnd_(v.blockEnd_) {}
 
 
 ASTAllocator::~ASTAllocator() {
-    destroyAll();
-    for (void* block : blocks_) {
-        std::free(block);
+    for (Block block : blocks_) {
+        memory.unmap(block.memory, block.size);
     }
 }
 
 
 void ASTAllocator::reset() {
-    destroyAll();
-    destructors_.clear();
-    for (void* block : blocks_) {
-        std::free(block);
+    if (blocks_.empty()) return;
+    for (std::size_t i = 1; i < blocks_.size(); i++) {
+        memory.unmap(blocks_[i].memory, blocks_[i].size);
     }
-    blocks_.clear();
-    currentBlock_ = nullptr;
-    currentPtr_ = nullptr;
-    blockEnd_ = nullptr;
+    blocks_.resize(1);
+    nextBlockSize_ = blockSize_;
+    currentBlock_ = static_cast<char*>(blocks_[0].memory);
+    currentPtr_ = currentBlock_;
+    blockEnd_ = currentBlock_ + blocks_[0].size;
 }
 
  
@@ -51,7 +52,8 @@ void* ASTAllocator::allocate(std::size_t size, std::size_t alignment) {
     std::uintptr_t aligned = (curr + alignment - 1) & ~(alignment - 1);
 
     if (std::size_t padding = aligned - curr; padding + size > space) {
-        allocateBlock(std::max(blockSize_, size + alignment));
+        allocateBlock(std::max(nextBlockSize_, Memory::pages(size + alignment)));
+        nextBlockSize_ = std::min(nextBlockSize_ * 2, MAX_BLOCK);
         return allocate(size, alignment);
     }
 
@@ -62,17 +64,13 @@ void* ASTAllocator::allocate(std::size_t size, std::size_t alignment) {
 
 
 void ASTAllocator::allocateBlock(std::size_t size) {
-    void* block = std::malloc(size);
-    assert(block && "ASTAllocator block allocation failed");
-    blocks_.push_back(block);
+    void* block = memory.map(size);
+    // A parse has no runtime error to raise
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    blocks_.push_back({block, size});
     currentBlock_ = static_cast<char*>(block);
     currentPtr_ = currentBlock_;
     blockEnd_ = currentBlock_ + size;
 }
-
-
-void ASTAllocator::destroyAll() {
-    for (auto& dtor : destructors_) {
-        dtor();
-    }
-}
@@ -1,12 +1,22 @@
 #pragma once
 
 #include <cstddef>
-#include <functional>
+#include <cstring>
+#include <span>
 #include <type_traits>
 #include <vector>
 
+// Bump allocator the AST lives in. Nothing allocated in it is destroyed: it
+// only holds trivially destructible nodes, and child lists are spans over
+// arrays in the arena, so releasing it frees its blocks and nothing else.
+// Blocks come from the memory backend and double in size up to MAX_BLOCK, so
+// a large script takes a few huge-page blocks rather than thousands of small
+// ones.
+
 class ASTAllocator {
 public:
+    static constexpr std::size_t MAX_BLOCK = 2 << 20;
+
     explicit ASTAllocator(std::size_t blockSize = 4096);
     ~ASTAllocator();
 
@@ -20,13 +30,28 @@ public:
     template <typename T, typename... Args>
     T* create(Args&&... args);
 
+    // Copy of `items` in the arena
+    template <typename T>
+    std::span<T> copy(std::type_identity_t<std::span<const T>> items);
+
+    // `count` value-initialized objects in the arena
+    template <typename T>
+    std::span<T> array(std::size_t count);
+
+    // Frees everything allocated so far. The first block is kept and reused,
+    // so resetting after every statement doesn't map a new block each time.
     void reset();
 
     
 private:
+    struct Block {
+        void* memory;
+        std::size_t size;
+    };
+
     const std::size_t blockSize_;
-    std::vector<void*> blocks_;
-    std::vector<std::function<void()>> destructors_;
+    std::size_t nextBlockSize_;
+    std::vector<Block> blocks_;
 
     char* currentBlock_;
     char* currentPtr_;
@@ -34,21 +59,35 @@ private:
 
     void* allocate(std::size_t size, std::size_t alignment);
     void allocateBlock(std::size_t size);
-    void destroyAll();
 };
 
 
 // Inline template for create()
 template <typename T, typename... Args>
 T* ASTAllocator::create(Args&&... args) {
+    static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
     void* mem = allocate(sizeof(T), alignof(T));
-    T* obj = new (mem) T(std::forward<Args>(args)...);
+    return new (mem) T(std::forward<Args>(args)...);
+}
 
-    if constexpr (!std::is_trivially_destructible_v<T>) {
-        destructors_.emplace_back([obj]() {
-            obj->~T();
-        });
-    }
 
-    return obj;
+template <typename T>
+std::span<T> ASTAllocator::copy(std::type_identity_t<std::span<const T>> items) {
+    static_assert(std::is_trivially_copyable_v<T>, "the arena never runs destructors");
+    if (items.empty()) return {};
+    void* mem = allocate(items.size_bytes(), alignof(T));
+    std::memcpy(mem, items.data(), items.size_bytes());
+    return std::span<T>(static_cast<T*>(mem), items.size());
+}
+
+
+template <typename T>
+std::span<T> ASTAllocator::array(std::size_t count) {
+    static_assert(std::is_trivially_destructible_v<T>, "the arena never runs destructors");
+    if (count == 0) return {};
+    T* items = static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    for (std::size_t i = 0; i < count; i++) {
+        new (items + i) T();
+    }
+    return std::span<T>(items, count);
 }
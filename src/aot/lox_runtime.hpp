@@ -0,0 +1,417 @@
+#pragma once
+
+// Runtime for C++ translation units produced by `lox --emit-cpp`. Mirrors the
+// tree-walker's values, environments, classes and error reporting so compiled
+// scripts behave exactly like interpreted ones. Header-only and independent
+// of the interpreter sources.
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace lox {
+
+struct None {
+    constexpr auto operator<=>(const None&) const = default;
+};
+
+struct Callable;
+struct Instance;
+
+// The text of a string value. `a + b` appends b to a's buffer in place when a
+// still ends where the buffer does, and shares the buffer, so building a
+// string piece by piece copies each piece once instead of the whole prefix on
+// every `+`. A Text only ever reads the first `length` bytes of its buffer.
+struct Text {
+    std::shared_ptr<std::string> buffer;
+    size_t length;
+
+    std::string_view view() const { return {this->buffer->data(), this->length}; }
+};
+
+using Number = double;
+using String = std::shared_ptr<const Text>;
+using Value = std::variant<None, Number, String, bool, std::shared_ptr<Callable>, std::shared_ptr<Instance>>;
+
+inline String string(std::string text) {
+    size_t length = text.size();
+    return std::make_shared<const Text>(std::make_shared<std::string>(std::move(text)), length);
+}
+
+inline String concatenate(const Text& left, const Text& right) {
+    std::shared_ptr<std::string> buffer = left.buffer;
+    if (buffer->size() != left.length || buffer == right.buffer) {
+        buffer = std::make_shared<std::string>(left.view());
+    }
+    buffer->append(right.view());
+    return std::make_shared<const Text>(std::move(buffer), left.length + right.length);
+}
+
+// Dropping the last reference to a long chain of objects, like a linked list
+// of instances, would destroy it recursively with a native frame per link.
+// Objects hand their references here from their destructors instead, and the
+// outermost destructor releases them one at a time. Never destroyed, so
+// globals can still be released after main returns.
+struct Graveyard {
+    std::vector<std::shared_ptr<void>> pending;
+    bool draining = false;
+
+    static Graveyard& get() {
+        static Graveyard* graveyard = new Graveyard;
+        return *graveyard;
+    }
+
+    void bury(std::shared_ptr<void> object) {
+        if (object) this->pending.push_back(std::move(object));
+    }
+
+    void bury(Value& value) {
+        if (auto callable = std::get_if<std::shared_ptr<Callable>>(&value)) {
+            this->bury(std::move(*callable));
+        } else if (auto instance = std::get_if<std::shared_ptr<Instance>>(&value)) {
+            this->bury(std::move(*instance));
+        }
+    }
+
+    void drain() {
+        if (this->draining) return;
+        this->draining = true;
+        while (!this->pending.empty()) {
+            std::shared_ptr<void> object = std::move(this->pending.back());
+            this->pending.pop_back();
+        }
+        this->draining = false;
+    }
+};
+
+struct RuntimeError {
+    std::string msg;
+    uint32_t line;
+};
+
+struct Env {
+    std::shared_ptr<Env> enclosing;
+    std::vector<Value> values;
+
+    explicit Env(std::shared_ptr<Env> enclosing): enclosing{std::move(enclosing)} {}
+
+    ~Env() {
+        Graveyard& graveyard = Graveyard::get();
+        graveyard.bury(std::move(this->enclosing));
+        for (Value& value : this->values) {
+            graveyard.bury(value);
+        }
+        graveyard.drain();
+    }
+};
+
+using Body = Value (*)(const std::shared_ptr<Env>&);
+
+struct Callable {
+    virtual size_t arity() = 0;
+    virtual Value call(std::vector<Value>&) = 0;
+    virtual std::string to_string() = 0;
+    virtual ~Callable() = default;
+};
+
+// Calls nest at most as deep as in the interpreter (Interpreter::MAX_DEPTH)
+inline constexpr size_t MAX_DEPTH = 1 << 11;
+inline size_t depth = 0;
+
+struct Nested {
+    Nested() { depth++; }
+    ~Nested() { depth--; }
+};
+
+struct Function: Callable {
+    std::string_view name;
+    // Of the name, where a stack overflow is reported
+    uint32_t line;
+    size_t params;
+    Body body;
+    std::shared_ptr<Env> closure;
+    bool is_initializer;
+
+    Function(std::string_view name, uint32_t line, size_t params, Body body, std::shared_ptr<Env> closure, bool is_initializer):
+        name{name}, line{line}, params{params}, body{body}, closure{std::move(closure)}, is_initializer{is_initializer} {}
+
+    ~Function() override {
+        Graveyard::get().bury(std::move(this->closure));
+        Graveyard::get().drain();
+    }
+
+    size_t arity() override { return this->params; }
+
+    Value call(std::vector<Value>& arguments) override {
+        if (depth == MAX_DEPTH) {
+            throw RuntimeError{"Stack overflow.", this->line};
+        }
+        Nested nested;
+        auto env = std::make_shared<Env>(this->closure);
+        env->values = std::move(arguments);
+        Value result = this->body(env);
+        if (this->is_initializer) {
+            return this->closure->values[0];
+        }
+        return result;
+    }
+
+    std::string to_string() override { return "<fn " + std::string(this->name) + ">"; }
+
+    std::shared_ptr<Function> bind(std::shared_ptr<Instance> instance) {
+        auto env = std::make_shared<Env>(this->closure);
+        env->values.emplace_back(std::move(instance));
+        return std::make_shared<Function>(this->name, this->line, this->params, this->body, env, this->is_initializer);
+    }
+};
+
+struct Class: Callable, std::enable_shared_from_this<Class> {
+    std::string_view name;
+    std::unordered_map<std::string_view, std::shared_ptr<Function>> methods;
+
+    Class(std::string_view name, std::unordered_map<std::string_view, std::shared_ptr<Function>> methods):
+        name{name}, methods{std::move(methods)} {}
+
+    std::shared_ptr<Function> find_method(std::string_view method) {
+        auto found = this->methods.find(method);
+        return found == this->methods.end() ? nullptr : found->second;
+    }
+
+    size_t arity() override {
+        auto init = this->find_method("init");
+        return init ? init->arity() : 0;
+    }
+
+    Value call(std::vector<Value>& arguments) override;
+
+    std::string to_string() override { return std::string(this->name); }
+};
+
+struct Instance: std::enable_shared_from_this<Instance> {
+    std::shared_ptr<Class> class_;
+    std::unordered_map<std::string_view, Value> fields;
+
+    explicit Instance(std::shared_ptr<Class> class_): class_{std::move(class_)} {}
+
+    ~Instance() {
+        Graveyard& graveyard = Graveyard::get();
+        for (auto& [name, value] : this->fields) {
+            graveyard.bury(value);
+        }
+        graveyard.drain();
+    }
+
+    std::string to_string() { return this->class_->to_string() + " instance"; }
+
+    Value get(std::string_view name, uint32_t line) {
+        if (auto field = this->fields.find(name); field != this->fields.end()) {
+            return field->second;
+        }
+        if (auto method = this->class_->find_method(name)) {
+            return std::shared_ptr<Callable>(method->bind(this->shared_from_this()));
+        }
+        throw RuntimeError{"Undefined property '" + std::string(name) + "'.", line};
+    }
+};
+
+inline Value Class::call(std::vector<Value>& arguments) {
+    auto instance = std::make_shared<Instance>(this->shared_from_this());
+    if (auto init = this->find_method("init")) {
+        return init->bind(instance)->call(arguments);
+    }
+    return instance;
+}
+
+struct Clock: Callable {
+    size_t arity() override { return 0; }
+    Value call(std::vector<Value>&) override {
+        auto t = std::chrono::system_clock::now();
+        return std::chrono::duration_cast<std::chrono::duration<double>>(t.time_since_epoch()).count();
+    }
+    std::string to_string() override { return "<native fn>"; }
+};
+
+// A top-level variable. Globals are looked up by name in the tree-walker, so
+// using one before its declaration has run is a runtime error.
+struct Global {
+    std::string_view name;
+    Value value {};
+    bool defined = false;
+
+    void define(Value v) {
+        this->value = std::move(v);
+        this->defined = true;
+    }
+
+    const Value& get(uint32_t line) const {
+        if (!this->defined) {
+            throw RuntimeError{"Undefined variable '" + std::string(this->name) + "'.", line};
+        }
+        return this->value;
+    }
+
+    Value assign(Value v, uint32_t line) {
+        if (!this->defined) {
+            throw RuntimeError{"Undefined variable '" + std::string(this->name) + "'.", line};
+        }
+        this->value = v;
+        return v;
+    }
+};
+
+inline std::string stringify(const Value& v) {
+    return std::visit([](const auto& vs) -> std::string {
+        using T = std::decay_t<decltype(vs)>;
+        if constexpr (std::is_same_v<T, None>) {
+            return "nil";
+        } else if constexpr (std::is_same_v<T, Number>) {
+            std::string text = std::to_string(vs);
+            if (text.ends_with(".0")) {
+                text = text.substr(0, text.length() - 2);
+            }
+            return text;
+        } else if constexpr (std::is_same_v<T, bool>) {
+            return vs ? "true" : "false";
+        } else if constexpr (std::is_same_v<T, String>) {
+            return std::string(vs->view());
+        } else {
+            return vs->to_string();
+        }
+    }, v);
+}
+
+inline bool truthy(const Value& v) {
+    if (std::holds_alternative<None>(v)) return false;
+    if (auto b = std::get_if<bool>(&v)) return *b;
+    if (auto n = std::get_if<Number>(&v)) return bool(*n);
+    return true;
+}
+
+inline bool equal(const Value& a, const Value& b) {
+    return std::visit([](const auto& lhs, const auto& rhs) -> bool {
+        if constexpr (std::is_same_v<std::decay_t<decltype(lhs)>, std::decay_t<decltype(rhs)>>) {
+            return lhs == rhs;
+        } else {
+            return false;
+        }
+    }, a, b);
+}
+
+// Braced initialization evaluates left to right, function arguments don't
+struct Operands {
+    Value left;
+    Value right;
+};
+
+inline void check_numbers(const Operands& o, uint32_t line) {
+    if (!std::holds_alternative<Number>(o.left) || !std::holds_alternative<Number>(o.right)) {
+        throw RuntimeError{"Operands must be numbers.", line};
+    }
+}
+
+inline Value add(const Operands& o, uint32_t line) {
+    if (std::holds_alternative<Number>(o.left) && std::holds_alternative<Number>(o.right)) {
+        return std::get<Number>(o.left) + std::get<Number>(o.right);
+    }
+    if (std::holds_alternative<String>(o.left) && std::holds_alternative<String>(o.right)) {
+        return concatenate(*std::get<String>(o.left), *std::get<String>(o.right));
+    }
+    throw RuntimeError{"Binary operator values not compatible", line};
+}
+
+inline Value subtract(const Operands& o, uint32_t line) { check_numbers(o, line); return std::get<Number>(o.left) - std::get<Number>(o.right); }
+inline Value multiply(const Operands& o, uint32_t line) { check_numbers(o, line); return std::get<Number>(o.left) * std::get<Number>(o.right); }
+inline Value divide(const Operands& o, uint32_t line) { check_numbers(o, line); return std::get<Number>(o.left) / std::get<Number>(o.right); }
+inline Value greater(const Operands& o, uint32_t line) { check_numbers(o, line); return std::get<Number>(o.left) > std::get<Number>(o.right); }
+inline Value greater_equal(const Operands& o, uint32_t line) { check_numbers(o, line); return std::get<Number>(o.left) >= std::get<Number>(o.right); }
+inline Value less(const Operands& o, uint32_t line) { check_numbers(o, line); return std::get<Number>(o.left) < std::get<Number>(o.right); }
+inline Value less_equal(const Operands& o, uint32_t line) { check_numbers(o, line); return std::get<Number>(o.left) <= std::get<Number>(o.right); }
+inline Value equal(const Operands& o) { return equal(o.left, o.right); }
+inline Value not_equal(const Operands& o) { return !equal(o.left, o.right); }
+
+// The tree-walker negates with an unchecked std::get
+inline Value negate(const Value& v) { return -std::get<Number>(v); }
+
+struct CallSite {
+    Value callee;
+    std::vector<Value> arguments;
+};
+
+inline Value call(CallSite site, uint32_t line) {
+    auto function = std::get_if<std::shared_ptr<Callable>>(&site.callee);
+    if (!function) {
+        throw RuntimeError{"Can only call functions and classes", line};
+    }
+    if (site.arguments.size() != (*function)->arity()) {
+        throw RuntimeError{"Expected " + std::to_string((*function)->arity()) + " arguments but got " + std::to_string(site.arguments.size()) + ".", line};
+    }
+    return (*function)->call(site.arguments);
+}
+
+inline Value get(const Value& object, std::string_view name, uint32_t line) {
+    auto instance = std::get_if<std::shared_ptr<Instance>>(&object);
+    if (!instance) {
+        throw RuntimeError{"Only instances have properties", line};
+    }
+    return (*instance)->get(name, line);
+}
+
+// The object is checked before the value is evaluated
+inline std::shared_ptr<Instance> settable(const Value& object, uint32_t line) {
+    auto instance = std::get_if<std::shared_ptr<Instance>>(&object);
+    if (!instance) {
+        throw RuntimeError{"Only instances have fields", line};
+    }
+    return *instance;
+}
+
+inline Value set(const std::shared_ptr<Instance>& instance, std::string_view name, Value value) {
+    instance->fields[name] = value;
+    return value;
+}
+
+inline Value function(std::string_view name, uint32_t line, size_t params, Body body, std::shared_ptr<Env> closure) {
+    return std::shared_ptr<Callable>(std::make_shared<Function>(name, line, params, body, std::move(closure), false));
+}
+
+struct Method {
+    std::string_view name;
+    uint32_t line;
+    size_t params;
+    Body body;
+};
+
+inline Value make_class(std::string_view name, std::vector<Method> methods, const std::shared_ptr<Env>& closure) {
+    std::unordered_map<std::string_view, std::shared_ptr<Function>> table;
+    for (const auto& method : methods) {
+        table[method.name] = std::make_shared<Function>(method.name, method.line, method.params, method.body, closure, method.name == "init");
+    }
+    return std::shared_ptr<Callable>(std::make_shared<Class>(name, std::move(table)));
+}
+
+using Statement = void (*)();
+
+// Runs top-level statements like Interpreter::interpret: a runtime error is
+// reported and execution continues with the next statement.
+inline int run(std::initializer_list<Statement> statements) {
+    bool had_runtime_error = false;
+    for (Statement statement : statements) {
+        try {
+            statement();
+        } catch (const RuntimeError& error) {
+            had_runtime_error = true;
+            std::cout << error.msg << "\n[line " << error.line << "]\n";
+        }
+    }
+    return had_runtime_error ? 70 : 0;
+}
+
+}
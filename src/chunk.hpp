@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "token.hpp"
+#include "node.hpp"
+
+// Instructions are one byte followed by zero or more 16 bit little endian operands.
+enum class OpCode : uint8_t {
+    CONSTANT,       // constant
+    NIL,
+    TRUE,
+    FALSE,
+    POP,
+
+    GET_LOCAL,      // slot
+    SET_LOCAL,      // slot
+    GET_CELL,       // slot
+    SET_CELL,       // slot
+    GET_UPVALUE,    // upvalue
+    SET_UPVALUE,    // upvalue
+    GET_GLOBAL,     // global, token
+    SET_GLOBAL,     // global, token
+    DEFINE,         // global
+    DEFINE_LOCAL,   // slot
+    DEFINE_CELL,    // slot
+
+    EQUAL,
+    NOT_EQUAL,
+    GREATER,        // token
+    GREATER_EQUAL,  // token
+    LESS,           // token
+    LESS_EQUAL,     // token
+    ADD,            // token
+    SUBTRACT,       // token
+    MULTIPLY,       // token
+    DIVIDE,         // token
+    NOT,
+    NEGATE,
+
+    PRINT,
+    JUMP,           // offset
+    JUMP_IF_FALSE,  // offset
+    LOOP,           // offset, token
+
+    CALL,           // argument count, token
+    CHECK_INSTANCE, // token
+    GET_PROPERTY,   // token
+    SET_PROPERTY,   // token
+
+    FUNCTION,       // function
+    CLASS,          // class
+    RETURN,
+};
+
+
+struct Chunk {
+    std::vector<uint8_t> code;
+    std::vector<Object> constants;
+    std::vector<const Token*> tokens;
+    std::vector<const FunctionDeclarationNode*> functions;
+    std::vector<const ClassDeclarationNode*> classes;
+
+    void write(OpCode op) { this->code.push_back(std::to_underlying(op)); }
+    void write_u16(uint16_t v) {
+        this->code.push_back(static_cast<uint8_t>(v & 0xff));
+        this->code.push_back(static_cast<uint8_t>(v >> 8));
+    }
+};
+
+
+inline uint16_t read_u16(const uint8_t* ip) {
+    return static_cast<uint16_t>(ip[0] | (ip[1] << 8));
+}
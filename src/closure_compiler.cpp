@@ -0,0 +1,571 @@
+#include <format>
+#include <iostream>
+#include "closure_compiler.hpp"
+#include "lox_callable.hpp"
+#include "lox_class.hpp"
+#include "lox_instance.hpp"
+#include "lox.hpp"
+
+
+std::expected<Object, InterpreterSignal> lift(std::expected<Object, InterpreterError>&& res) {
+    if (!res.has_value()) {
+        return std::unexpected(std::move(res.error()));
+    }
+    return std::move(res.value());
+}
+
+
+template<typename Op>
+ExprFn number_op(ExprFn left, ExprFn right, const Token* oper) {
+    return [left = std::move(left), right = std::move(right), oper](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+        auto l = left(in);
+        if (!l.has_value()) return l;
+        auto r = right(in);
+        if (!r.has_value()) return r;
+        if (!l.value().is_number() || !r.value().is_number()) {
+            return std::unexpected(InterpreterError(InterpreterErrorType::MustBeNumbers, *oper));
+        }
+        return Op{}(l.value().as_number(), r.value().as_number());
+    };
+}
+
+
+// Right operand is a number literal, e.g. `i < 10` or `n - 1`
+template<typename Op>
+ExprFn number_op_constant(ExprFn left, Number right, const Token* oper) {
+    return [left = std::move(left), right, oper](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+        auto l = left(in);
+        if (!l.has_value()) return l;
+        if (!l.value().is_number()) {
+            return std::unexpected(InterpreterError(InterpreterErrorType::MustBeNumbers, *oper));
+        }
+        return Op{}(l.value().as_number(), right);
+    };
+}
+
+
+template<typename Op>
+ExprFn number_binary(ExprFn left, const ExpressionNode& right_node, ExprFn right, const Token* oper) {
+    if (right_node.get_type() == ExpressionType::LITERAL) {
+        if (const Object& n = *right_node.get_literal_node()->value; n.is_number()) {
+            return number_op_constant<Op>(std::move(left), n.as_number(), oper);
+        }
+    }
+    return number_op<Op>(std::move(left), std::move(right), oper);
+}
+
+
+std::optional<InterpreterSignal> run_statements(Interpreter& in, const std::vector<StmtFn>& stmts) {
+    for (const auto& stmt : stmts) {
+        if (auto res = stmt(in); res.has_value()) {
+            return res;
+        }
+    }
+    return std::nullopt;
+}
+
+
+ClosureCompiler::ClosureCompiler(Interpreter& interpreter): interpreter{interpreter} {}
+
+
+void ClosureCompiler::interpret(const std::span<StatementNode*>& stmts) {
+    for (const auto& stmt : stmts) {
+        StmtFn fn;
+        if (this->interpreter.repl_mode && stmt->get_type() == StatementType::EXPRESSION) {
+            ExprFn expr = this->compile(*stmt->get_expression_statement_node()->expr);
+            fn = [expr = std::move(expr)](Interpreter& in) -> std::optional<InterpreterSignal> {
+                auto res = expr(in);
+                if (!res.has_value()) {
+                    return res.error();
+                }
+                std::cout << stringify(res.value()) << '\n';
+                return std::nullopt;
+            };
+        } else {
+            fn = this->compile(*stmt);
+        }
+
+        if (auto res = fn(this->interpreter); res.has_value()) {
+            if (auto err = std::get_if<InterpreterError>(&res.value())) {
+                Lox::runtime_error(*err);
+            }
+        }
+    }
+}
+
+
+std::vector<StmtFn> ClosureCompiler::compile(std::span<StatementNode* const> stmts) {
+    std::vector<StmtFn> res;
+    res.reserve(stmts.size());
+    for (const auto& stmt : stmts) {
+        res.push_back(this->compile(*stmt));
+    }
+    return res;
+}
+
+
+void ClosureCompiler::compile_function(const FunctionDeclarationNode& func) {
+    this->functions[&func] = this->compile(func.body->stmts);
+}
+
+
+StmtFn ClosureCompiler::compile(const StatementNode& stmt) {
+    using enum StatementType;
+    switch (stmt.get_type()) {
+        case PRINT: {
+            ExprFn expr = this->compile(*stmt.get_print_statement_node()->expr);
+            return [expr = std::move(expr)](Interpreter& in) -> std::optional<InterpreterSignal> {
+                auto res = expr(in);
+                if (!res.has_value()) {
+                    return res.error();
+                }
+                std::cout << stringify(res.value()) << '\n';
+                return std::nullopt;
+            };
+        }
+        case EXPRESSION: {
+            ExprFn expr = this->compile(*stmt.get_expression_statement_node()->expr);
+            return [expr = std::move(expr)](Interpreter& in) -> std::optional<InterpreterSignal> {
+                if (auto res = expr(in); !res.has_value()) {
+                    return res.error();
+                }
+                return std::nullopt;
+            };
+        }
+        case VARIABLE: {
+            const VariableDeclarationNode& var_dec = *stmt.get_variable_statement_node();
+            if (!var_dec.initializer) {
+                return [&var_dec](Interpreter& in) -> std::optional<InterpreterSignal> {
+                    in.define(var_dec.variable, None());
+                    return std::nullopt;
+                };
+            }
+            ExprFn init = this->compile(*var_dec.initializer);
+            if (var_dec.variable.kind == VariableKind::SLOT) {
+                return [slot = var_dec.variable.index, init = std::move(init)](Interpreter& in) -> std::optional<InterpreterSignal> {
+                    auto res = init(in);
+                    if (!res.has_value()) {
+                        return res.error();
+                    }
+                    in.frame.slots[slot] = std::move(res.value());
+                    return std::nullopt;
+                };
+            }
+            return [&var_dec, init = std::move(init)](Interpreter& in) -> std::optional<InterpreterSignal> {
+                auto res = init(in);
+                if (!res.has_value()) {
+                    return res.error();
+                }
+                in.define(var_dec.variable, std::move(res.value()));
+                return std::nullopt;
+            };
+        }
+        case BLOCK: return this->compile_block(*stmt.get_block_statement_node());
+        case IF: return this->compile_if(*stmt.get_if_statement_node());
+        case WHILE: return this->compile_while(*stmt.get_while_statement_node());
+        case BREAK: return [](Interpreter&) -> std::optional<InterpreterSignal> { return BreakSignal{}; };
+        case RETURN: return this->compile_return(*stmt.get_return_statement_node());
+        case FUNCTION: {
+            const FunctionDeclarationNode& func = *stmt.get_function_declaration_node();
+            this->compile_function(func);
+            return [&func](Interpreter& in) -> std::optional<InterpreterSignal> {
+                in.define_recursive(func.variable, [&] {
+                    return in.make_function(func, false);
+                });
+                return std::nullopt;
+            };
+        }
+        case CLASS: return this->compile_class(*stmt.get_class_declaration_node());
+    }
+    return [](Interpreter&) -> std::optional<InterpreterSignal> {
+        return InterpreterError(InterpreterErrorType::UnimplementedStatement);
+    };
+}
+
+
+StmtFn ClosureCompiler::compile_block(const BlockStatementNode& block) {
+    return [stmts = this->compile(block.stmts)](Interpreter& in) -> std::optional<InterpreterSignal> {
+        return run_statements(in, stmts);
+    };
+}
+
+
+StmtFn ClosureCompiler::compile_if(const IfStatementNode& stmt) {
+    ExprFn condition = this->compile(*stmt.condition);
+    StmtFn then_branch = this->compile(*stmt.then_branch);
+    if (!stmt.else_branch) {
+        return [condition = std::move(condition), then_branch = std::move(then_branch)](Interpreter& in) -> std::optional<InterpreterSignal> {
+            auto res = condition(in);
+            if (!res.has_value()) {
+                return res.error();
+            }
+            if (in.is_truthy(res.value())) {
+                return then_branch(in);
+            }
+            return std::nullopt;
+        };
+    }
+    StmtFn else_branch = this->compile(*stmt.else_branch);
+    return [condition = std::move(condition), then_branch = std::move(then_branch), else_branch = std::move(else_branch)](Interpreter& in) -> std::optional<InterpreterSignal> {
+        auto res = condition(in);
+        if (!res.has_value()) {
+            return res.error();
+        }
+        if (in.is_truthy(res.value())) {
+            return then_branch(in);
+        }
+        return else_branch(in);
+    };
+}
+
+
+StmtFn ClosureCompiler::compile_while(const WhileStatementNode& stmt) {
+    ExprFn condition = this->compile(*stmt.condition);
+    StmtFn body = this->compile(*stmt.body);
+    return [&stmt, condition = std::move(condition), body = std::move(body)](Interpreter& in) -> std::optional<InterpreterSignal> {
+        while (true) {
+            {
+                auto res = condition(in);
+                if (!res.has_value()) {
+                    return res.error();
+                }
+                if (!in.is_truthy(res.value())) {
+                    return std::nullopt;
+                }
+            }
+            if (auto res = body(in); res.has_value()) {
+                if (std::holds_alternative<BreakSignal>(res.value())) {
+                    return std::nullopt;
+                }
+                return res;
+            }
+            if (heap.out_of_memory()) [[unlikely]] {
+                return InterpreterError(InterpreterErrorType::OutOfMemory, stmt.tk);
+            }
+        }
+    };
+}
+
+
+StmtFn ClosureCompiler::compile_return(const ReturnStatementNode& stmt) {
+    if (!stmt.expr) {
+        return [](Interpreter&) -> std::optional<InterpreterSignal> { return ReturnSignal{None()}; };
+    }
+    return [expr = this->compile(*stmt.expr)](Interpreter& in) -> std::optional<InterpreterSignal> {
+        auto res = expr(in);
+        if (!res.has_value()) {
+            return res.error();
+        }
+        return ReturnSignal{std::move(res.value())};
+    };
+}
+
+
+StmtFn ClosureCompiler::compile_class(const ClassDeclarationNode& class_) {
+    for (const auto& method : class_.methods) {
+        this->compile_function(*method);
+    }
+    return [&class_](Interpreter& in) -> std::optional<InterpreterSignal> {
+        in.define_recursive(class_.variable, [&] {
+            MethodTable methods;
+            for (auto& method : class_.methods) {
+                methods[method->name.symbol] = in.make_function(*method, method->name.symbol == names::INIT);
+            }
+            return make_ref<LoxClass>(symbols.name(class_.name.symbol), std::move(methods));
+        });
+        return std::nullopt;
+    };
+}
+
+
+ExprFn ClosureCompiler::compile(const ExpressionNode& expr) {
+    using enum ExpressionType;
+    switch (expr.get_type()) {
+        case LITERAL: {
+            return [value = *expr.get_literal_node()->value](Interpreter&) -> std::expected<Object, InterpreterSignal> {
+                return value;
+            };
+        }
+        case BINARYOP: return this->compile_binary(*expr.get_binary_node());
+        case UNARYOP: return this->compile_unary(*expr.get_unary_node());
+        case VARIABLE: return this->compile_variable(expr, expr.get_variable_node()->name);
+        case ASSIGNMENT: return this->compile_assignment(expr);
+        case LOGICAL: return this->compile_logical(*expr.get_logical_node());
+        case CALL: return this->compile_call(*expr.get_call_node());
+        case GET: return this->compile_get(*expr.get_get_node());
+        case SET: return this->compile_set(*expr.get_set_node());
+        case THIS: return this->compile_variable(expr, expr.get_this_node()->tk);
+        case LOCAL_LESS_CONST:
+        case INCREMENT_LOCAL:
+        case THIS_GET:
+        case CALL_GLOBAL: return this->compile(*expr.get_original());
+    }
+    return [](Interpreter&) -> std::expected<Object, InterpreterSignal> {
+        return std::unexpected(InterpreterError(InterpreterErrorType::UnimplementedExpression));
+    };
+}
+
+
+ExprFn ClosureCompiler::compile_binary(const BinaryNode& expr) {
+    ExprFn left = this->compile(*expr.left);
+    ExprFn right = this->compile(*expr.right);
+    const Token* oper = &expr.oper;
+
+    switch (oper->type) {
+        case TokenType::MINUS: return number_binary<std::minus<>>(std::move(left), *expr.right, std::move(right), oper);
+        case TokenType::SLASH: return number_binary<std::divides<>>(std::move(left), *expr.right, std::move(right), oper);
+        case TokenType::STAR: return number_binary<std::multiplies<>>(std::move(left), *expr.right, std::move(right), oper);
+        case TokenType::GREATER: return number_binary<std::greater<>>(std::move(left), *expr.right, std::move(right), oper);
+        case TokenType::GREATER_EQUAL: return number_binary<std::greater_equal<>>(std::move(left), *expr.right, std::move(right), oper);
+        case TokenType::LESS: return number_binary<std::less<>>(std::move(left), *expr.right, std::move(right), oper);
+        case TokenType::LESS_EQUAL: return number_binary<std::less_equal<>>(std::move(left), *expr.right, std::move(right), oper);
+
+        case TokenType::PLUS: {
+            return [left = std::move(left), right = std::move(right), oper](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                auto l = left(in);
+                if (!l.has_value()) return l;
+                auto r = right(in);
+                if (!r.has_value()) return r;
+                if (l.value().is_number() && r.value().is_number()) {
+                    return l.value().as_number() + r.value().as_number();
+                }
+                if (l.value().is_string() && r.value().is_string()) {
+                    Object v = concat_strings(l.value(), r.value());
+                    if (heap.out_of_memory()) [[unlikely]] {
+                        return std::unexpected(InterpreterError(InterpreterErrorType::OutOfMemory, *oper));
+                    }
+                    return v;
+                }
+                return std::unexpected(InterpreterError(InterpreterErrorType::BinOpValuesNotCompatible, *oper));
+            };
+        }
+
+        case TokenType::BANG_EQUAL:
+        case TokenType::EQUAL_EQUAL: {
+            bool negate = oper->type == TokenType::BANG_EQUAL;
+            return [left = std::move(left), right = std::move(right), negate](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                auto l = left(in);
+                if (!l.has_value()) return l;
+                auto r = right(in);
+                if (!r.has_value()) return r;
+                return in.is_equal(l.value(), r.value()) != negate;
+            };
+        }
+
+        default:
+            break;
+    }
+
+    return [oper](Interpreter&) -> std::expected<Object, InterpreterSignal> {
+        return std::unexpected(InterpreterError(InterpreterErrorType::UnimplementedOperator, *oper));
+    };
+}
+
+
+ExprFn ClosureCompiler::compile_unary(const UnaryNode& expr) {
+    ExprFn operand = this->compile(*expr.operand);
+    const Token* oper = &expr.oper;
+    switch (oper->type) {
+        case TokenType::MINUS: {
+            return [operand = std::move(operand)](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                auto res = operand(in);
+                if (!res.has_value()) return res;
+                return -res.value().checked_number();
+            };
+        }
+        case TokenType::BANG: {
+            return [operand = std::move(operand)](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                auto res = operand(in);
+                if (!res.has_value()) return res;
+                return !in.is_truthy(res.value());
+            };
+        }
+        default:
+            break;
+    }
+    return [oper](Interpreter&) -> std::expected<Object, InterpreterSignal> {
+        return std::unexpected(InterpreterError(InterpreterErrorType::UnimplementedOperator, *oper));
+    };
+}
+
+
+ExprFn ClosureCompiler::compile_logical(const LogicalNode& expr) {
+    ExprFn left = this->compile(*expr.left);
+    ExprFn right = this->compile(*expr.right);
+    bool is_or = expr.oper.type == TokenType::OR;
+    return [left = std::move(left), right = std::move(right), is_or](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+        auto l = left(in);
+        if (!l.has_value()) return l;
+        if (in.is_truthy(l.value()) == is_or) return l;
+        return right(in);
+    };
+}
+
+
+ExprFn ClosureCompiler::compile_call(const CallNode& expr) {
+    ExprFn callee = this->compile(*expr.callee);
+    std::vector<ExprFn> args;
+    for (const ExpressionNode* argument : expr.args) {
+        args.push_back(this->compile(*argument));
+    }
+    const Token* paren = &expr.paren;
+    return [this, callee = std::move(callee), args = std::move(args), paren](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+        auto res = callee(in);
+        if (!res.has_value()) return res;
+
+        Arguments arguments;
+        arguments.reserve(args.size());
+        for (const auto& argument : args) {
+            auto arg = argument(in);
+            if (!arg.has_value()) return arg;
+            arguments.push_back(std::move(arg.value()));
+        }
+        return this->call(in, res.value(), arguments, *paren);
+    };
+}
+
+
+ExprFn ClosureCompiler::compile_get(const GetNode& expr) {
+    const Token* name = &expr.name;
+    return [object = this->compile(*expr.object), name](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+        auto obj = object(in);
+        if (!obj.has_value()) return obj;
+        if (!obj.value().is_instance()) {
+            return std::unexpected(InterpreterError(InterpreterErrorType::NotInstance, *name));
+        }
+        return lift(obj.value().as<LoxInstance>()->get(*name));
+    };
+}
+
+
+ExprFn ClosureCompiler::compile_set(const SetNode& expr) {
+    const Token* name = &expr.name;
+    return [object = this->compile(*expr.object), value = this->compile(*expr.value), name](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+        auto obj = object(in);
+        if (!obj.has_value()) return obj;
+        if (!obj.value().is_instance()) {
+            return std::unexpected(InterpreterError(InterpreterErrorType::NotInstanceSet, *name));
+        }
+        auto val = value(in);
+        if (!val.has_value()) return val;
+        obj.value().as<LoxInstance>()->set(*name, val.value());
+        return val;
+    };
+}
+
+
+ExprFn ClosureCompiler::compile_variable(const ExpressionNode& expr, const Token& name) {
+    Resolution variable = expr.get_variable();
+    uint32_t index = variable.index;
+    switch (variable.kind) {
+        case VariableKind::GLOBAL:
+            return [index, name = &name](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                return lift(in.global_env->get(index, *name));
+            };
+        case VariableKind::SLOT:
+            return [index](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                return in.frame.slots[index];
+            };
+        case VariableKind::CELL:
+            return [index](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                return in.frame.cells[index]->value;
+            };
+        default:
+            return [index](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+                return in.frame.upvalues[index]->value;
+            };
+    }
+}
+
+
+ExprFn ClosureCompiler::compile_assignment(const ExpressionNode& expr) {
+    const AssignmentNode& assign_node = *expr.get_assignment_node();
+    ExprFn value = this->compile(*assign_node.expr);
+    Resolution variable = expr.get_variable();
+    if (variable.kind == VariableKind::GLOBAL) {
+        return [value = std::move(value), index = variable.index, name = &assign_node.name](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+            auto res = value(in);
+            if (!res.has_value()) return res;
+            if (auto err = in.global_env->assign(index, *name, res.value()); err.has_value()) {
+                return std::unexpected(err.value());
+            }
+            return res;
+        };
+    }
+    if (variable.kind == VariableKind::SLOT) {
+        return [value = std::move(value), index = variable.index](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+            auto res = value(in);
+            if (!res.has_value()) return res;
+            in.frame.slots[index] = res.value();
+            return res;
+        };
+    }
+    return [value = std::move(value), variable](Interpreter& in) -> std::expected<Object, InterpreterSignal> {
+        auto res = value(in);
+        if (!res.has_value()) return res;
+        in.assign_local(variable, res.value());
+        return res;
+    };
+}
+
+
+std::expected<Object, InterpreterSignal> ClosureCompiler::call(Interpreter& in, const Object& callee, Arguments& arguments, const Token& paren) {
+    if (!callee.is_callable()) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::NotCallable, paren));
+    }
+    LoxCallable* function = callee.as<LoxCallable>();
+    if (arguments.size() != function->arity()) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::Arity, paren, function->arity(), arguments.size()));
+    }
+    if (heap.out_of_memory()) [[unlikely]] {
+        return std::unexpected(InterpreterError(InterpreterErrorType::OutOfMemory, paren));
+    }
+
+    auto res = [&]() -> std::optional<InterpreterSignal> {
+        if (auto lox_function = dynamic_cast<LoxFunction*>(function)) {
+            return this->call_function(in, *lox_function, arguments);
+        }
+        if (auto lox_class = dynamic_cast<LoxClass*>(function)) {
+            auto inst = make_ref<LoxInstance>(lox_class);
+            if (auto init = lox_class->find_method(names::INIT)) {
+                return this->call_function(in, *init->bind(inst), arguments);
+            }
+            return ReturnSignal{inst};
+        }
+        if (function->call(in, arguments) == Status::ERROR) {
+            return in.take_error();
+        }
+        return ReturnSignal{std::move(in.result)};
+    }();
+
+    if (res.has_value()) {
+        if (std::holds_alternative<ReturnSignal>(res.value())) {
+            return std::get<ReturnSignal>(res.value()).value;
+        }
+        return std::unexpected(res.value());
+    }
+    return None();
+}
+
+
+std::optional<InterpreterSignal> ClosureCompiler::call_function(Interpreter& in, const LoxFunction& function, Arguments& arguments) {
+    auto body = this->functions.find(function.declaration);
+    if (body == this->functions.end()) {
+        return InterpreterError(InterpreterErrorType::NotCompiled, function.declaration->name);
+    }
+
+    auto caller = in.push_frame(function, arguments);
+    if (!caller.has_value()) {
+        return caller.error();
+    }
+    auto ret = run_statements(in, body->second);
+    in.pop_frame(caller.value());
+
+    if (ret.has_value() && std::holds_alternative<InterpreterError>(ret.value())) {
+        return ret;
+    }
+    if (function.is_initializer) {
+        return ReturnSignal{function.receiver};
+    }
+    return ret;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <expected>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+#include <unordered_map>
+#include "node.hpp"
+#include "interpreter.hpp"
+
+class LoxFunction;
+
+using ExprFn = std::function<std::expected<Object, InterpreterSignal>(Interpreter&)>;
+using StmtFn = std::function<std::optional<InterpreterSignal>(Interpreter&)>;
+
+// Translates resolved statements into trees of specialized closures so that
+// node types, operators and variable resolution are decided once, up front.
+// The closures run against the Interpreter's frames and signals.
+struct ClosureCompiler {
+    Interpreter& interpreter;
+    std::unordered_map<const FunctionDeclarationNode*, std::vector<StmtFn>> functions;
+
+    explicit ClosureCompiler(Interpreter&);
+
+    void interpret(const std::span<StatementNode*>&);
+
+    [[nodiscard]] StmtFn compile(const StatementNode&);
+    [[nodiscard]] ExprFn compile(const ExpressionNode&);
+    [[nodiscard]] std::vector<StmtFn> compile(std::span<StatementNode* const>);
+    void compile_function(const FunctionDeclarationNode&);
+
+    [[nodiscard]] StmtFn compile_block(const BlockStatementNode&);
+    [[nodiscard]] StmtFn compile_if(const IfStatementNode&);
+    [[nodiscard]] StmtFn compile_while(const WhileStatementNode&);
+    [[nodiscard]] StmtFn compile_return(const ReturnStatementNode&);
+    [[nodiscard]] StmtFn compile_class(const ClassDeclarationNode&);
+
+    [[nodiscard]] ExprFn compile_binary(const BinaryNode&);
+    [[nodiscard]] ExprFn compile_unary(const UnaryNode&);
+    [[nodiscard]] ExprFn compile_logical(const LogicalNode&);
+    [[nodiscard]] ExprFn compile_call(const CallNode&);
+    [[nodiscard]] ExprFn compile_get(const GetNode&);
+    [[nodiscard]] ExprFn compile_set(const SetNode&);
+    [[nodiscard]] ExprFn compile_variable(const ExpressionNode&, const Token&);
+    [[nodiscard]] ExprFn compile_assignment(const ExpressionNode&);
+
+    [[nodiscard]] std::expected<Object, InterpreterSignal> call(Interpreter&, const Object&, Arguments&, const Token&);
+    [[nodiscard]] std::optional<InterpreterSignal> call_function(Interpreter&, const LoxFunction&, Arguments&);
+};
@@ -0,0 +1,359 @@
+#include <limits>
+#include <stdexcept>
+#include "compiler.hpp"
+
+
+uint16_t to_operand(size_t v) {
+    if (v > std::numeric_limits<uint16_t>::max()) {
+        throw std::runtime_error("Bytecode operand out of range");
+    }
+    return static_cast<uint16_t>(v);
+}
+
+
+Compiler::Compiler(std::unordered_map<const FunctionDeclarationNode*, Chunk>& functions): functions{functions} {}
+
+
+Chunk Compiler::compile_script(const StatementNode& stmt, bool repl_mode) {
+    Chunk script;
+    this->chunk = &script;
+    this->loops.clear();
+
+    if (repl_mode && stmt.get_type() == StatementType::EXPRESSION) {
+        this->compile(*stmt.get_expression_statement_node()->expr);
+        this->emit(OpCode::PRINT);
+    } else {
+        this->compile(stmt);
+    }
+    this->emit(OpCode::NIL);
+    this->emit(OpCode::RETURN);
+
+    this->chunk = nullptr;
+    return script;
+}
+
+
+void Compiler::compile_function(const FunctionDeclarationNode& func) {
+    Chunk* enclosing_chunk = this->chunk;
+    std::vector<LoopInfo> enclosing_loops = std::move(this->loops);
+
+    // Parameters are bound into the frame by Interpreter::push_frame
+    Chunk& body = this->functions[&func];
+    body = Chunk{};
+    this->chunk = &body;
+    this->loops.clear();
+    for (const auto& stmt : func.body->stmts) {
+        this->compile(*stmt);
+    }
+    this->emit(OpCode::NIL);
+    this->emit(OpCode::RETURN);
+
+    this->chunk = enclosing_chunk;
+    this->loops = std::move(enclosing_loops);
+}
+
+
+void Compiler::compile(const StatementNode& stmt) {
+    using enum StatementType;
+    switch (stmt.get_type()) {
+        case PRINT: {
+            this->compile(*stmt.get_print_statement_node()->expr);
+            this->emit(OpCode::PRINT);
+            break;
+        }
+        case EXPRESSION: {
+            this->compile(*stmt.get_expression_statement_node()->expr);
+            this->emit(OpCode::POP);
+            break;
+        }
+        case VARIABLE: {
+            const VariableDeclarationNode& var_dec = *stmt.get_variable_statement_node();
+            if (var_dec.initializer) {
+                this->compile(*var_dec.initializer);
+            } else {
+                this->emit(OpCode::NIL);
+            }
+            this->compile_define(var_dec.variable);
+            break;
+        }
+        case BLOCK: this->compile_block(*stmt.get_block_statement_node()); break;
+        case IF: this->compile_if(*stmt.get_if_statement_node()); break;
+        case WHILE: this->compile_while(*stmt.get_while_statement_node()); break;
+        case BREAK: this->compile_break(*stmt.get_break_statement_node()); break;
+        case RETURN: this->compile_return(*stmt.get_return_statement_node()); break;
+        case FUNCTION: {
+            const FunctionDeclarationNode& func = *stmt.get_function_declaration_node();
+            this->compile_function(func);
+            this->chunk->functions.push_back(&func);
+            this->compile_declaration(func.variable, OpCode::FUNCTION, to_operand(this->chunk->functions.size() - 1));
+            break;
+        }
+        case CLASS: this->compile_class(*stmt.get_class_declaration_node()); break;
+    }
+}
+
+
+void Compiler::compile_block(const BlockStatementNode& block) {
+    for (const auto& stmt : block.stmts) {
+        this->compile(*stmt);
+    }
+}
+
+
+void Compiler::compile_if(const IfStatementNode& stmt) {
+    this->compile(*stmt.condition);
+    size_t then_jump = this->emit_jump(OpCode::JUMP_IF_FALSE);
+    this->emit(OpCode::POP);
+    this->compile(*stmt.then_branch);
+    size_t else_jump = this->emit_jump(OpCode::JUMP);
+    this->patch_jump(then_jump);
+    this->emit(OpCode::POP);
+    if (stmt.else_branch) {
+        this->compile(*stmt.else_branch);
+    }
+    this->patch_jump(else_jump);
+}
+
+
+void Compiler::compile_while(const WhileStatementNode& stmt) {
+    size_t loop_start = this->chunk->code.size();
+    this->compile(*stmt.condition);
+    size_t exit_jump = this->emit_jump(OpCode::JUMP_IF_FALSE);
+    this->emit(OpCode::POP);
+
+    this->loops.push_back(LoopInfo{});
+    this->compile(*stmt.body);
+    this->emit_loop(loop_start, stmt.tk);
+
+    this->patch_jump(exit_jump);
+    this->emit(OpCode::POP);
+
+    // The condition was already popped when a break runs, so land after the exit POP
+    for (size_t jump : this->loops.back().breaks) {
+        this->patch_jump(jump);
+    }
+    this->loops.pop_back();
+}
+
+
+void Compiler::compile_break(const BreakStatementNode&) {
+    this->loops.back().breaks.push_back(this->emit_jump(OpCode::JUMP));
+}
+
+
+void Compiler::compile_return(const ReturnStatementNode& stmt) {
+    if (stmt.expr) {
+        this->compile(*stmt.expr);
+    } else {
+        this->emit(OpCode::NIL);
+    }
+    this->emit(OpCode::RETURN);
+}
+
+
+void Compiler::compile_class(const ClassDeclarationNode& class_) {
+    for (const auto& method : class_.methods) {
+        this->compile_function(*method);
+    }
+    this->chunk->classes.push_back(&class_);
+    this->compile_declaration(class_.variable, OpCode::CLASS, to_operand(this->chunk->classes.size() - 1));
+}
+
+
+// Pops the value on top of the stack into a newly declared variable
+void Compiler::compile_define(Resolution variable) {
+    switch (variable.kind) {
+        case VariableKind::GLOBAL: this->emit(OpCode::DEFINE, to_operand(variable.index)); break;
+        case VariableKind::SLOT: this->emit(OpCode::DEFINE_LOCAL, to_operand(variable.index)); break;
+        default: this->emit(OpCode::DEFINE_CELL, to_operand(variable.index)); break;
+    }
+}
+
+
+// Declares a function or class made by `op`. When its own closures capture
+// it, the cell must exist before they do, see Interpreter::define_recursive.
+void Compiler::compile_declaration(Resolution variable, OpCode op, uint16_t operand) {
+    if (variable.kind != VariableKind::CELL) {
+        this->emit(op, operand);
+        this->compile_define(variable);
+        return;
+    }
+    this->emit(OpCode::NIL);
+    this->emit(OpCode::DEFINE_CELL, to_operand(variable.index));
+    this->emit(op, operand);
+    this->emit(OpCode::SET_CELL, to_operand(variable.index));
+    this->emit(OpCode::POP);
+}
+
+
+void Compiler::compile(const ExpressionNode& expr) {
+    using enum ExpressionType;
+    switch (expr.get_type()) {
+        case LITERAL: this->emit_constant(*expr.get_literal_node()->value); break;
+        case BINARYOP: this->compile_binary(*expr.get_binary_node()); break;
+        case UNARYOP: this->compile_unary(*expr.get_unary_node()); break;
+        case VARIABLE: this->compile_variable(expr, expr.get_variable_node()->name); break;
+        case ASSIGNMENT: this->compile_assignment(expr); break;
+        case LOGICAL: this->compile_logical(*expr.get_logical_node()); break;
+        case CALL: this->compile_call(*expr.get_call_node()); break;
+        case GET: {
+            const GetNode& get = *expr.get_get_node();
+            this->compile(*get.object);
+            this->emit(OpCode::GET_PROPERTY, this->add_token(get.name));
+            break;
+        }
+        case SET: {
+            const SetNode& set = *expr.get_set_node();
+            this->compile(*set.object);
+            // The tree-walker rejects non-instances before evaluating the value
+            this->emit(OpCode::CHECK_INSTANCE, this->add_token(set.name));
+            this->compile(*set.value);
+            this->emit(OpCode::SET_PROPERTY, this->add_token(set.name));
+            break;
+        }
+        case THIS: this->compile_variable(expr, expr.get_this_node()->tk); break;
+        case LOCAL_LESS_CONST:
+        case INCREMENT_LOCAL:
+        case THIS_GET:
+        case CALL_GLOBAL: this->compile(*expr.get_original()); break;
+    }
+}
+
+
+void Compiler::compile_binary(const BinaryNode& expr) {
+    this->compile(*expr.left);
+    this->compile(*expr.right);
+
+    uint16_t tk = this->add_token(expr.oper);
+    switch (expr.oper.type) {
+        case TokenType::MINUS: this->emit(OpCode::SUBTRACT, tk); break;
+        case TokenType::PLUS: this->emit(OpCode::ADD, tk); break;
+        case TokenType::SLASH: this->emit(OpCode::DIVIDE, tk); break;
+        case TokenType::STAR: this->emit(OpCode::MULTIPLY, tk); break;
+        case TokenType::GREATER: this->emit(OpCode::GREATER, tk); break;
+        case TokenType::GREATER_EQUAL: this->emit(OpCode::GREATER_EQUAL, tk); break;
+        case TokenType::LESS: this->emit(OpCode::LESS, tk); break;
+        case TokenType::LESS_EQUAL: this->emit(OpCode::LESS_EQUAL, tk); break;
+        case TokenType::BANG_EQUAL: this->emit(OpCode::NOT_EQUAL); break;
+        case TokenType::EQUAL_EQUAL: this->emit(OpCode::EQUAL); break;
+        default: throw std::runtime_error("Binary operator not implemented");
+    }
+}
+
+
+void Compiler::compile_unary(const UnaryNode& expr) {
+    this->compile(*expr.operand);
+    switch (expr.oper.type) {
+        case TokenType::MINUS: this->emit(OpCode::NEGATE); break;
+        case TokenType::BANG: this->emit(OpCode::NOT); break;
+        default: throw std::runtime_error("Unary operator not implemented");
+    }
+}
+
+
+void Compiler::compile_logical(const LogicalNode& expr) {
+    this->compile(*expr.left);
+    if (expr.oper.type == TokenType::OR) {
+        size_t else_jump = this->emit_jump(OpCode::JUMP_IF_FALSE);
+        size_t end_jump = this->emit_jump(OpCode::JUMP);
+        this->patch_jump(else_jump);
+        this->emit(OpCode::POP);
+        this->compile(*expr.right);
+        this->patch_jump(end_jump);
+    } else {
+        size_t end_jump = this->emit_jump(OpCode::JUMP_IF_FALSE);
+        this->emit(OpCode::POP);
+        this->compile(*expr.right);
+        this->patch_jump(end_jump);
+    }
+}
+
+
+void Compiler::compile_call(const CallNode& expr) {
+    this->compile(*expr.callee);
+    size_t argc = 0;
+    for (const ExpressionNode* argument : expr.args) {
+        this->compile(*argument);
+    }
+    argc = expr.args.size();
+    this->emit(OpCode::CALL, to_operand(argc), this->add_token(expr.paren));
+}
+
+
+void Compiler::compile_variable(const ExpressionNode& expr, const Token& name) {
+    Resolution variable = expr.get_variable();
+    switch (variable.kind) {
+        case VariableKind::GLOBAL: this->emit(OpCode::GET_GLOBAL, to_operand(variable.index), this->add_token(name)); break;
+        case VariableKind::SLOT: this->emit(OpCode::GET_LOCAL, to_operand(variable.index)); break;
+        case VariableKind::CELL: this->emit(OpCode::GET_CELL, to_operand(variable.index)); break;
+        case VariableKind::UPVALUE: this->emit(OpCode::GET_UPVALUE, to_operand(variable.index)); break;
+    }
+}
+
+
+void Compiler::compile_assignment(const ExpressionNode& expr) {
+    const AssignmentNode& assign_node = *expr.get_assignment_node();
+    this->compile(*assign_node.expr);
+    Resolution variable = expr.get_variable();
+    switch (variable.kind) {
+        case VariableKind::GLOBAL: this->emit(OpCode::SET_GLOBAL, to_operand(variable.index), this->add_token(assign_node.name)); break;
+        case VariableKind::SLOT: this->emit(OpCode::SET_LOCAL, to_operand(variable.index)); break;
+        case VariableKind::CELL: this->emit(OpCode::SET_CELL, to_operand(variable.index)); break;
+        case VariableKind::UPVALUE: this->emit(OpCode::SET_UPVALUE, to_operand(variable.index)); break;
+    }
+}
+
+
+void Compiler::emit(OpCode op) {
+    this->chunk->write(op);
+}
+
+
+void Compiler::emit(OpCode op, uint16_t a) {
+    this->chunk->write(op);
+    this->chunk->write_u16(a);
+}
+
+
+void Compiler::emit(OpCode op, uint16_t a, uint16_t b) {
+    this->chunk->write(op);
+    this->chunk->write_u16(a);
+    this->chunk->write_u16(b);
+}
+
+
+void Compiler::emit_constant(const Object& value) {
+    if (value.is_nil()) {
+        this->emit(OpCode::NIL);
+    } else if (value.is_bool()) {
+        this->emit(value.as_bool() ? OpCode::TRUE : OpCode::FALSE);
+    } else {
+        this->chunk->constants.push_back(value);
+        this->emit(OpCode::CONSTANT, to_operand(this->chunk->constants.size() - 1));
+    }
+}
+
+
+size_t Compiler::emit_jump(OpCode op) {
+    this->emit(op, 0xffff);
+    return this->chunk->code.size() - 2;
+}
+
+
+void Compiler::patch_jump(size_t operand) {
+    uint16_t jump = to_operand(this->chunk->code.size() - operand - 2);
+    this->chunk->code[operand] = static_cast<uint8_t>(jump & 0xff);
+    this->chunk->code[operand + 1] = static_cast<uint8_t>(jump >> 8);
+}
+
+
+void Compiler::emit_loop(size_t loop_start, const Token& tk) {
+    uint16_t token = this->add_token(tk);
+    this->emit(OpCode::LOOP, to_operand(this->chunk->code.size() + 5 - loop_start), token);
+}
+
+
+uint16_t Compiler::add_token(const Token& tk) {
+    this->chunk->tokens.push_back(&tk);
+    return to_operand(this->chunk->tokens.size() - 1);
+}
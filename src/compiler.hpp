@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include "chunk.hpp"
+#include "node.hpp"
+#include "interpreter.hpp"
+
+// Lowers resolved statements into bytecode for the VM. Variable resolution
+// is read from the AST, so the Resolver must run first.
+struct Compiler {
+    struct LoopInfo {
+        std::vector<size_t> breaks;
+    };
+
+    std::unordered_map<const FunctionDeclarationNode*, Chunk>& functions;
+    Chunk* chunk = nullptr;
+    std::vector<LoopInfo> loops;
+
+    explicit Compiler(std::unordered_map<const FunctionDeclarationNode*, Chunk>&);
+
+    [[nodiscard]] Chunk compile_script(const StatementNode&, bool);
+    void compile_function(const FunctionDeclarationNode&);
+
+    void compile(const StatementNode&);
+    void compile(const ExpressionNode&);
+
+    void compile_block(const BlockStatementNode&);
+    void compile_if(const IfStatementNode&);
+    void compile_while(const WhileStatementNode&);
+    void compile_break(const BreakStatementNode&);
+    void compile_return(const ReturnStatementNode&);
+    void compile_class(const ClassDeclarationNode&);
+
+    void compile_binary(const BinaryNode&);
+    void compile_unary(const UnaryNode&);
+    void compile_logical(const LogicalNode&);
+    void compile_call(const CallNode&);
+    void compile_variable(const ExpressionNode&, const Token&);
+    void compile_assignment(const ExpressionNode&);
+    void compile_define(Resolution);
+    void compile_declaration(Resolution, OpCode, uint16_t);
+
+    void emit(OpCode);
+    void emit(OpCode, uint16_t);
+    void emit(OpCode, uint16_t, uint16_t);
+    void emit_constant(const Object&);
+    [[nodiscard]] size_t emit_jump(OpCode);
+    void patch_jump(size_t);
+    void emit_loop(size_t, const Token&);
+
+    [[nodiscard]] uint16_t add_token(const Token&);
+};
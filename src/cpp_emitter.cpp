@@ -0,0 +1,390 @@
+#include <charconv>
+#include <cmath>
+#include "cpp_emitter.hpp"
+#include "lox.hpp"
+
+
+namespace {
+
+std::string cpp_string(std::string_view text) {
+    std::string out = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            // Octal escapes always take exactly three digits
+            out += '\\';
+            out += static_cast<char>('0' + (c >> 6));
+            out += static_cast<char>('0' + ((c >> 3) & 7));
+            out += static_cast<char>('0' + (c & 7));
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    return out + "\"";
+}
+
+std::string cpp_number(double value) {
+    if (std::isinf(value)) {
+        return "lox::Number(HUGE_VAL)";
+    }
+    char buffer[64];
+    auto [end, _] = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::hex);
+    return "lox::Number(0x" + std::string(buffer, end) + ")";
+}
+
+std::string line_of(const Token& tk) {
+    return std::to_string(Lox::program->line(tk));
+}
+
+}
+
+
+CppEmitter::CppEmitter(const Interpreter& interpreter): interpreter{interpreter} {}
+
+
+void CppEmitter::fail(const Token& tk, std::string_view message) {
+    this->failed = true;
+    Lox::error(tk, message);
+}
+
+
+void CppEmitter::line(std::string_view text) {
+    this->current.code.append(static_cast<size_t>(this->current.indent) * 4, ' ');
+    this->current.code += text;
+    this->current.code += '\n';
+}
+
+
+std::string CppEmitter::env_at(int depth) const {
+    size_t target = this->scopes.size() - 1 - static_cast<size_t>(depth);
+    if (target >= this->current.base) {
+        return this->scopes[target];
+    }
+    std::string path = this->scopes[this->current.base];
+    for (size_t i = this->current.base; i > target; i--) {
+        path += "->enclosing";
+    }
+    return path;
+}
+
+
+std::string CppEmitter::current_env() const {
+    return this->scopes.size() > this->current.base ? this->scopes.back() : "nullptr";
+}
+
+
+std::string CppEmitter::global(const Token& tk) {
+    this->globals.emplace(symbols.name(tk.symbol));
+    return "g_" + std::string(symbols.name(tk.symbol));
+}
+
+
+std::string CppEmitter::string_constant(std::string_view text) {
+    // One shared string per distinct literal, like the interned strings
+    // the scanner creates, so == on strings compares the same way as in the
+    // tree-walker
+    if (auto found = this->string_constants.find(text); found != this->string_constants.end()) {
+        return found->second;
+    }
+    std::string name = "k" + std::to_string(this->constants.size());
+    this->constants.push_back("static const lox::Value " + name + " = lox::string(" + cpp_string(text) + ");");
+    this->string_constants.emplace(text, name);
+    return name;
+}
+
+
+std::optional<std::string> CppEmitter::emit(std::span<StatementNode* const> stmts) {
+    std::vector<std::string> statements;
+    for (const auto& stmt : stmts) {
+        this->current = Function{};
+        this->statement(*stmt);
+        std::string name = "s" + std::to_string(statements.size());
+        statements.push_back(name);
+        this->functions.push_back("static void " + name + "() {\n" + this->current.code + "}\n");
+    }
+    if (this->failed) {
+        return std::nullopt;
+    }
+
+    std::string out = "// Generated by lox --emit-cpp\n#include \"lox_runtime.hpp\"\n\n";
+    for (const auto& constant : this->constants) {
+        out += constant + '\n';
+    }
+    out += '\n';
+    for (const auto& name : this->globals) {
+        if (name == "clock") {
+            out += "static lox::Global g_clock {\"clock\", std::shared_ptr<lox::Callable>(std::make_shared<lox::Clock>()), true};\n";
+        } else {
+            out += "static lox::Global g_" + std::string(name) + " {\"" + std::string(name) + "\"};\n";
+        }
+    }
+    out += '\n';
+    for (uint32_t i = 0; i < this->function_count; i++) {
+        out += "static lox::Value f" + std::to_string(i) + "(const std::shared_ptr<lox::Env>&);\n";
+    }
+    for (const auto& function : this->functions) {
+        out += '\n' + function;
+    }
+    out += "\nint main() {\n    return lox::run({";
+    for (size_t i = 0; i < statements.size(); i++) {
+        out += (i ? ", " : "") + statements[i];
+    }
+    out += "});\n}\n";
+    return out;
+}
+
+
+// Emits the body of a function or method as a separate C++ function and
+// returns its name. A method's environment sits below the one holding `this`.
+std::string CppEmitter::function(const FunctionDeclarationNode& func, bool method) {
+    std::string name = "f" + std::to_string(this->function_count++);
+    Function enclosing = std::move(this->current);
+    size_t depth = this->scopes.size();
+
+    if (method) {
+        this->scopes.emplace_back();
+        this->scope_names.push_back({names::THIS});
+    }
+    this->current = Function{};
+    this->current.base = this->scopes.size();
+    this->current.envs = 1;
+    this->scopes.emplace_back("env0");
+    this->scope_names.emplace_back();
+    for (const Token& param : func.params) {
+        this->scope_names.back().push_back(param.symbol);
+    }
+    this->statements(func.body->stmts);
+    this->line("return lox::None{};");
+
+    this->functions.push_back("static lox::Value " + name + "(const std::shared_ptr<lox::Env>& env0) {\n" + this->current.code + "}\n");
+    this->scopes.resize(depth);
+    this->scope_names.resize(depth);
+    this->current = std::move(enclosing);
+    return name;
+}
+
+
+void CppEmitter::declare(const Token& name, const std::string& value) {
+    if (this->scopes.empty()) {
+        this->line(this->global(name) + ".define(" + value + ");");
+    } else {
+        this->line(this->current_env() + "->values.push_back(" + value + ");");
+    }
+}
+
+
+// Makes a local visible to the code emitted after this. Functions and classes
+// are visible to their own bodies, variables only after their initializer.
+void CppEmitter::introduce(const Token& name) {
+    if (!this->scope_names.empty()) {
+        this->scope_names.back().push_back(name.symbol);
+    }
+}
+
+
+void CppEmitter::statements(std::span<StatementNode* const> stmts) {
+    for (const auto& stmt : stmts) {
+        this->statement(*stmt);
+    }
+}
+
+
+void CppEmitter::block(std::span<StatementNode* const> stmts) {
+    std::string env = "env" + std::to_string(this->current.envs++);
+    this->line("{");
+    this->current.indent++;
+    this->line("auto " + env + " = std::make_shared<lox::Env>(" + this->current_env() + ");");
+    this->scopes.push_back(env);
+    this->scope_names.emplace_back();
+    this->statements(stmts);
+    this->scope_names.pop_back();
+    this->scopes.pop_back();
+    this->current.indent--;
+    this->line("}");
+}
+
+
+void CppEmitter::statement(const StatementNode& stmt) {
+    switch (stmt.get_type()) {
+        case StatementType::PRINT:
+            this->line("std::cout << lox::stringify(" + this->expression(*stmt.get_print_statement_node()->expr) + ") << '\\n';");
+            break;
+        case StatementType::EXPRESSION:
+            this->line("(void)" + this->expression(*stmt.get_expression_statement_node()->expr) + ";");
+            break;
+        case StatementType::VARIABLE: {
+            const VariableDeclarationNode& var_dec = *stmt.get_variable_statement_node();
+            std::string value = var_dec.initializer ? "lox::Value(" + this->expression(*var_dec.initializer) + ")" : "lox::None{}";
+            this->introduce(var_dec.name);
+            this->declare(var_dec.name, value);
+            break;
+        }
+        case StatementType::BLOCK:
+            this->block(stmt.get_block_statement_node()->stmts);
+            break;
+        case StatementType::IF: {
+            const IfStatementNode& if_stmt = *stmt.get_if_statement_node();
+            this->line("if (lox::truthy(" + this->expression(*if_stmt.condition) + ")) {");
+            this->current.indent++;
+            this->statement(*if_stmt.then_branch);
+            this->current.indent--;
+            if (if_stmt.else_branch) {
+                this->line("} else {");
+                this->current.indent++;
+                this->statement(*if_stmt.else_branch);
+                this->current.indent--;
+            }
+            this->line("}");
+            break;
+        }
+        case StatementType::WHILE: {
+            const WhileStatementNode& while_stmt = *stmt.get_while_statement_node();
+            this->line("while (lox::truthy(" + this->expression(*while_stmt.condition) + ")) {");
+            this->current.indent++;
+            this->current.loops++;
+            this->statement(*while_stmt.body);
+            this->current.loops--;
+            this->current.indent--;
+            this->line("}");
+            break;
+        }
+        case StatementType::BREAK:
+            // The resolver allows a break in a function declared inside a
+            // loop, where the tree-walker would leak it out of the call
+            if (this->current.loops == 0) {
+                this->fail(stmt.get_break_statement_node()->tk, "Can't compile 'break' outside of a loop in the same function.");
+            }
+            this->line("break;");
+            break;
+        case StatementType::RETURN: {
+            const ReturnStatementNode& ret = *stmt.get_return_statement_node();
+            this->line(ret.expr ? "return " + this->expression(*ret.expr) + ";" : "return lox::None{};");
+            break;
+        }
+        case StatementType::FUNCTION: {
+            const FunctionDeclarationNode& func = *stmt.get_function_declaration_node();
+            this->introduce(func.name);
+            std::string name = this->function(func, false);
+            this->declare(func.name, "lox::function(" + cpp_string(symbols.name(func.name.symbol)) + ", " + line_of(func.name) + ", " + std::to_string(func.params.size()) + ", " + name + ", " + this->current_env() + ")");
+            break;
+        }
+        case StatementType::CLASS: {
+            const ClassDeclarationNode& class_ = *stmt.get_class_declaration_node();
+            this->introduce(class_.name);
+            std::string methods;
+            for (const auto& method : class_.methods) {
+                std::string name = this->function(*method, true);
+                methods += (methods.empty() ? "{" : ", {") + cpp_string(symbols.name(method->name.symbol)) + ", " + line_of(method->name) + ", " + std::to_string(method->params.size()) + ", " + name + "}";
+            }
+            this->declare(class_.name, "lox::make_class(" + cpp_string(symbols.name(class_.name.symbol)) + ", {" + methods + "}, " + this->current_env() + ")");
+            break;
+        }
+    }
+}
+
+
+std::string CppEmitter::variable(const ExpressionNode& expr, const Token& name) {
+    if (expr.get_variable().kind != VariableKind::GLOBAL) {
+        return this->local(name);
+    }
+    return this->global(name) + ".get(" + line_of(name) + ")";
+}
+
+
+// Innermost declaration of `name` visible here, which is the one the
+// resolver picked
+std::string CppEmitter::local(const Token& name) const {
+    for (size_t i = this->scope_names.size(); i-- > 0;) {
+        const auto& names = this->scope_names[i];
+        for (size_t j = names.size(); j-- > 0;) {
+            if (names[j] == name.symbol) {
+                return this->env_at(static_cast<int>(this->scope_names.size() - 1 - i)) + "->values[" + std::to_string(j) + "]";
+            }
+        }
+    }
+    return "";
+}
+
+
+std::string CppEmitter::expression(const ExpressionNode& expr) {
+    switch (expr.get_type()) {
+        case ExpressionType::LITERAL: {
+            const Object& value = *expr.get_literal_node()->value;
+            if (value.is_number()) return "lox::Value(" + cpp_number(value.as_number()) + ")";
+            if (value.is_string()) return this->string_constant(value.as_string());
+            if (value.is_bool()) return value.as_bool() ? "lox::Value(true)" : "lox::Value(false)";
+            return "lox::Value(lox::None{})";
+        }
+        case ExpressionType::VARIABLE:
+            return this->variable(expr, expr.get_variable_node()->name);
+        case ExpressionType::THIS:
+            return this->variable(expr, expr.get_this_node()->tk);
+        case ExpressionType::ASSIGNMENT: {
+            const AssignmentNode& assign = *expr.get_assignment_node();
+            std::string value = this->expression(*assign.expr);
+            if (expr.get_variable().kind != VariableKind::GLOBAL) {
+                return "lox::Value(" + this->local(assign.name) + " = " + value + ")";
+            }
+            return this->global(assign.name) + ".assign(" + value + ", " + line_of(assign.name) + ")";
+        }
+        case ExpressionType::UNARYOP: {
+            const UnaryNode& unary = *expr.get_unary_node();
+            std::string operand = this->expression(*unary.operand);
+            if (unary.oper.type == TokenType::MINUS) return "lox::negate(" + operand + ")";
+            if (unary.oper.type == TokenType::BANG) return "lox::Value(!lox::truthy(" + operand + "))";
+            this->fail(unary.oper, "Unary operator not implemented");
+            return "lox::Value()";
+        }
+        case ExpressionType::BINARYOP: {
+            const BinaryNode& bin = *expr.get_binary_node();
+            std::string operands = "lox::Operands{" + this->expression(*bin.left) + ", " + this->expression(*bin.right) + "}";
+            std::string at = ", " + line_of(bin.oper) + ")";
+            switch (bin.oper.type) {
+                case TokenType::PLUS: return "lox::add(" + operands + at;
+                case TokenType::MINUS: return "lox::subtract(" + operands + at;
+                case TokenType::STAR: return "lox::multiply(" + operands + at;
+                case TokenType::SLASH: return "lox::divide(" + operands + at;
+                case TokenType::GREATER: return "lox::greater(" + operands + at;
+                case TokenType::GREATER_EQUAL: return "lox::greater_equal(" + operands + at;
+                case TokenType::LESS: return "lox::less(" + operands + at;
+                case TokenType::LESS_EQUAL: return "lox::less_equal(" + operands + at;
+                case TokenType::EQUAL_EQUAL: return "lox::equal(" + operands + ")";
+                case TokenType::BANG_EQUAL: return "lox::not_equal(" + operands + ")";
+                default:
+                    this->fail(bin.oper, "Binary operator not implemented");
+                    return "lox::Value()";
+            }
+        }
+        case ExpressionType::LOGICAL: {
+            const LogicalNode& logical = *expr.get_logical_node();
+            std::string test = logical.oper.type == TokenType::OR ? "lox::truthy(l)" : "!lox::truthy(l)";
+            return "[&]() -> lox::Value { lox::Value l = " + this->expression(*logical.left) + "; "
+                   "if (" + test + ") return l; return " + this->expression(*logical.right) + "; }()";
+        }
+        case ExpressionType::CALL: {
+            const CallNode& call = *expr.get_call_node();
+            std::string args;
+            for (const ExpressionNode* argument : call.args) {
+                args += (args.empty() ? "" : ", ") + this->expression(*argument);
+            }
+            return "lox::call(lox::CallSite{" + this->expression(*call.callee) + ", {" + args + "}}, " + line_of(call.paren) + ")";
+        }
+        case ExpressionType::GET: {
+            const GetNode& get = *expr.get_get_node();
+            return "lox::get(" + this->expression(*get.object) + ", " + cpp_string(symbols.name(get.name.symbol)) + ", " + line_of(get.name) + ")";
+        }
+        case ExpressionType::SET: {
+            const SetNode& set = *expr.get_set_node();
+            return "[&]() -> lox::Value { auto instance = lox::settable(" + this->expression(*set.object) + ", " + line_of(set.name) + "); "
+                   "return lox::set(instance, " + cpp_string(symbols.name(set.name.symbol)) + ", " + this->expression(*set.value) + "); }()";
+        }
+        case ExpressionType::LOCAL_LESS_CONST:
+        case ExpressionType::INCREMENT_LOCAL:
+        case ExpressionType::THIS_GET:
+        case ExpressionType::CALL_GLOBAL:
+            return this->expression(*expr.get_original());
+    }
+    return "lox::Value()";
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "node.hpp"
+#include "interpreter.hpp"
+
+// Translates a resolved program into a C++ translation unit built on
+// src/aot/lox_runtime.hpp. Every Lox function becomes a C++ function taking
+// its call environment; locals are reached through a chain of environments,
+// one per scope, with each reference's (depth, index) in that chain worked
+// out from the declarations in scope. Constructs the output can't reproduce are
+// reported through Lox::error and make emit() return nullopt.
+struct CppEmitter {
+    const Interpreter& interpreter;
+
+    explicit CppEmitter(const Interpreter&);
+
+    [[nodiscard]] std::optional<std::string> emit(std::span<StatementNode* const>);
+
+private:
+    // The code of the C++ function currently being emitted
+    struct Function {
+        std::string code;
+        size_t base = 0;        // first scope that belongs to this function
+        uint32_t envs = 0;      // names env0, env1, ...
+        uint32_t loops = 0;
+        int indent = 1;
+    };
+
+    Function current;
+    // C++ variable holding each resolver scope's environment, innermost last.
+    // Scopes of enclosing functions, and the scope holding a method's `this`,
+    // have no variable in the current function and are reached via `enclosing`.
+    std::vector<std::string> scopes;
+    // Names declared in each of `scopes`, in the order their values are pushed
+    std::vector<std::vector<Symbol>> scope_names;
+    std::vector<std::string> functions;
+    std::vector<std::string> constants;
+    // Constant holding each distinct string literal
+    std::map<std::string, std::string, std::less<>> string_constants;
+    std::set<std::string_view> globals;
+    uint32_t function_count = 0;
+    bool failed = false;
+
+    void line(std::string_view);
+    std::string env_at(int depth) const;
+    std::string current_env() const;
+    std::string global(const Token&);
+    std::string string_constant(std::string_view);
+    std::string function(const FunctionDeclarationNode&, bool method);
+    void declare(const Token&, const std::string& value);
+    void introduce(const Token&);
+    void fail(const Token&, std::string_view);
+
+    void statements(std::span<StatementNode* const>);
+    void statement(const StatementNode&);
+    void block(std::span<StatementNode* const>);
+    std::string expression(const ExpressionNode&);
+    std::string variable(const ExpressionNode&, const Token&);
+    std::string local(const Token&) const;
+};
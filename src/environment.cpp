@@ -2,73 +2,27 @@
 #include <iostream>
 
 
-void Environment::define(std::string_view n, Object v) {
-    this->values.push_back(std::move(v));
-    this->values_map[std::string(n)] = this->values.size() - 1;
-}
-
-
-std::expected<Object, InterpreterError> Environment::get(const Token& name) const {
-    auto res = this->values_map.find(name.lexeme);
-    if (res == this->values_map.end()) {
-        if (this->enclosing) {
-            return this->enclosing->get(name);
-        }
-        return std::unexpected(InterpreterError(InterpreterErrorType::UndefinedVariable, name, "Undefined variable '" + std::string(name.lexeme) + "'."));
-    }
-    return this->get(res->second);
-}
-
-std::expected<Object, InterpreterError> Environment::get(size_t index) const {
-    if (index > this->values.size()) {
-        return std::unexpected(InterpreterError(InterpreterErrorType::UndefinedVariable, "Undefined variable."));
+uint32_t Environment::slot(Symbol name) {
+    auto [it, inserted] = this->slots.try_emplace(name, static_cast<uint32_t>(this->values.size()));
+    if (inserted) {
+        this->values.push_back(Object::undefined());
     }
-    return this->values[index];
+    return it->second;
 }
 
 
-std::expected<Object, InterpreterError> Environment::get_at(int depth, size_t index) const {
-    auto env = this->ancestor(depth);
-    return env->get(index);
+InterpreterError Environment::undefined(const Token& name) {
+    return InterpreterError(InterpreterErrorType::UndefinedVariable, name);
 }
 
 
-Environment* Environment::ancestor(int depth) const {
-    const Environment* env = this;
-    for (; depth > 0; --depth) {
-        if (!env->enclosing) {
-            break;
-        }
-        env = env->enclosing.get();
-    }
-    return const_cast<Environment*>(env);
-}
-
-
-std::optional<InterpreterError> Environment::assign(const Token& name, Object value) {
-    auto res = this->values_map.find(name.lexeme);
-
-    if (res == this->values_map.end()) {
-        if (this->enclosing) {
-            return this->enclosing->assign(name, std::move(value));
-        }
-        return InterpreterError(InterpreterErrorType::UndefinedVariable, name, "Undefined variable '" + std::string(name.lexeme) + "'.");
-    }
-
-    this->values[res->second] = std::move(value);
-    return std::nullopt;
-}
-
-std::optional<InterpreterError> Environment::assign(size_t index, Object value) {
-    if (index > this->values.size()) {
-        return InterpreterError(InterpreterErrorType::UndefinedVariable, "Undefined variable.");
+void Environment::trace(GcVisitor& visitor) const {
+    for (const auto& value : this->values) {
+        ::trace(visitor, value);
     }
-    this->values[index] = std::move(value);
-    return std::nullopt;
 }
 
 
-std::optional<InterpreterError> Environment::assign_at(int depth, size_t index, Object value) {
-    auto env = this->ancestor(depth);
-    return env->assign(index, std::move(value));
+void Environment::clear() {
+    this->values.clear();
 }
@@ -8,22 +8,73 @@
 #include <string_view>
 #include "token.hpp"
 #include "errors.hpp"
-#include "string_hash.hpp"
 
 
-class Environment {
-    std::shared_ptr<Environment> enclosing;
-    std::unordered_map<std::string, size_t, string_hash, std::equal_to<>> values_map;
+// Global variables. The resolver gives each global name a slot the first
+// time it sees it, and running code indexes the slot directly. A slot holds
+// the undefined marker until the global's declaration runs, so globals can be
+// used before they are defined, and redefining one (in the REPL) reuses its
+// slot. Locals never get here: the resolver puts them in frame slots, see
+// Interpreter::Frame.
+class Environment: public LoxObject {
+    std::unordered_map<Symbol, uint32_t> slots;
     std::vector<Object> values;
+
+    static InterpreterError undefined(const Token&);
 public:
     Environment() = default;
-    explicit Environment(std::shared_ptr<Environment> enclosing): enclosing{enclosing} {}
-    void define(std::string_view, Object);
-    Environment* ancestor(int) const;
-    std::expected<Object, InterpreterError> get(const Token&) const;
-    std::expected<Object, InterpreterError> get(size_t) const;
-    std::expected<Object, InterpreterError> get_at(int, size_t) const;
-    std::optional<InterpreterError> assign(const Token&, Object);
-    std::optional<InterpreterError> assign(size_t, Object);
-    std::optional<InterpreterError> assign_at(int, size_t, Object);
+    uint32_t slot(Symbol);
+
+    void define(uint32_t slot, Object value) {
+        write_barrier(*this, value);
+        this->values[slot] = std::move(value);
+    }
+
+    std::expected<Object, InterpreterError> get(uint32_t slot, const Token& name) const {
+        const Object& value = this->values[slot];
+        if (value.is_undefined()) [[unlikely]] {
+            return std::unexpected(undefined(name));
+        }
+        return value;
+    }
+
+    std::optional<InterpreterError> assign(uint32_t slot, const Token& name, Object value) {
+        if (this->values[slot].is_undefined()) [[unlikely]] {
+            return undefined(name);
+        }
+        write_barrier(*this, value);
+        this->values[slot] = std::move(value);
+        return std::nullopt;
+    }
+
+    // The global in `slot`, or null while it is undefined
+    Object* find(uint32_t slot) {
+        Object* value = &this->values[slot];
+        return value->is_undefined() ? nullptr : value;
+    }
+
+    void trace(GcVisitor&) const override;
+    void clear() override;
+};
+
+
+// Heap box for a local that a closure captures. The declaring frame and every
+// closure that captures the local share the same cell.
+struct Upvalue: LoxObject {
+    Object value;
+
+    explicit Upvalue(Object value): value{std::move(value)} {}
+
+    void set(Object value) {
+        write_barrier(*this, value);
+        this->value = std::move(value);
+    }
+
+    void trace(GcVisitor& visitor) const override {
+        ::trace(visitor, this->value);
+    }
+
+    void clear() override {
+        this->value = None();
+    }
 };
@@ -1,24 +1,41 @@
 #pragma once
 
-#include <string>
+#include <cstdint>
 #include "token.hpp"
 
 
-enum class InterpreterErrorType {
-    Unimplemented,
+enum class InterpreterErrorType: uint8_t {
+    UnimplementedStatement,
+    UnimplementedExpression,
+    UnimplementedOperator,
+    NotCompiled,
     BinOpValuesNotCompatible,
     MustBeNumbers,
     UndefinedVariable,
     NotCallable,
     Arity,
     NotInstance,
-    UndefinedProperty
+    NotInstanceSet,
+    UndefinedProperty,
+    StackOverflow,
+    OutOfMemory
 };
 
+// A runtime error is its code and where it was raised, plus the name or
+// counts its message needs. The message and the line number are only worked
+// out when the error is reported (Lox::runtime_error).
 struct InterpreterError {
-    const InterpreterErrorType type;
-    const Token where;
-    const std::string msg;
-    InterpreterError(InterpreterErrorType t, Token where, std::string msg): type{t}, where{std::move(where)}, msg{std::move(msg)} {}
-    InterpreterError(InterpreterErrorType t, std::string msg): type{t}, where{}, msg{std::move(msg)} {}
+    InterpreterErrorType type;
+    // Offset in the source of the token it was raised at
+    uint32_t where = 0;
+    // The variable or property an Undefined* error names, or the arity an
+    // Arity error expected
+    uint32_t operand = 0;
+    // The number of arguments an Arity error got
+    uint32_t count = 0;
+
+    explicit InterpreterError(InterpreterErrorType t): type{t} {}
+    InterpreterError(InterpreterErrorType t, const Token& token): type{t}, where{token.span.start}, operand{token.symbol} {}
+    InterpreterError(InterpreterErrorType t, const Token& token, uint32_t expected, uint32_t got):
+        type{t}, where{token.span.start}, operand{expected}, count{got} {}
 };
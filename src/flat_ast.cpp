@@ -0,0 +1,260 @@
+#include "flat_ast.hpp"
+
+
+FlatBuilder::FlatBuilder(FlatProgram& program): program{program} {}
+
+
+uint32_t FlatBuilder::emit(FlatOp op) {
+    this->program.ops.push_back(op);
+    this->program.a.push_back(0);
+    this->program.b.push_back(0);
+    this->program.c.push_back(0);
+    return static_cast<uint32_t>(this->program.ops.size() - 1);
+}
+
+
+uint32_t FlatBuilder::add_token(const Token& tk) {
+    this->program.tokens.push_back(tk);
+    return static_cast<uint32_t>(this->program.tokens.size() - 1);
+}
+
+
+FlatFunction FlatBuilder::flatten(std::span<StatementNode* const> stmts) {
+    std::vector<uint32_t> children;
+    children.reserve(stmts.size());
+    for (const auto& stmt : stmts) {
+        children.push_back(this->flatten(*stmt));
+    }
+    auto first = static_cast<uint32_t>(this->program.lists.size());
+    this->program.lists.insert(this->program.lists.end(), children.begin(), children.end());
+    return FlatFunction{first, static_cast<uint32_t>(children.size())};
+}
+
+
+// The copy keeps everything a call needs except the body, which is flattened
+FunctionDeclarationNode* FlatBuilder::flatten_function(const FunctionDeclarationNode& func) {
+    ASTAllocator& declarations = this->program.declarations;
+    auto copy = declarations.create<FunctionDeclarationNode>(func);
+    copy->params = declarations.copy<Token>(func.params);
+    copy->body = nullptr;
+    copy->arguments = declarations.copy<Resolution>(func.arguments);
+    copy->captures = declarations.copy<Capture>(func.captures);
+    this->program.bodies[copy] = this->flatten(func.body->stmts);
+    return copy;
+}
+
+
+uint32_t FlatBuilder::flatten(const StatementNode& stmt) {
+    auto& program = this->program;
+    switch (stmt.get_type()) {
+        case StatementType::PRINT: {
+            uint32_t i = this->emit(FlatOp::PRINT);
+            this->flatten(*stmt.get_print_statement_node()->expr);
+            return i;
+        }
+        case StatementType::EXPRESSION: {
+            uint32_t i = this->emit(FlatOp::EXPRESSION);
+            this->flatten(*stmt.get_expression_statement_node()->expr);
+            return i;
+        }
+        case StatementType::VARIABLE: {
+            const VariableDeclarationNode& var_dec = *stmt.get_variable_statement_node();
+            uint32_t i = this->emit(FlatOp::VAR_DECL);
+            program.a[i] = static_cast<uint32_t>(var_dec.variable.kind);
+            program.b[i] = var_dec.variable.index;
+            if (var_dec.initializer) {
+                this->flatten(*var_dec.initializer);
+            } else {
+                this->emit(FlatOp::NIL);
+            }
+            return i;
+        }
+        case StatementType::BLOCK: {
+            uint32_t i = this->emit(FlatOp::BLOCK);
+            FlatFunction list = this->flatten(stmt.get_block_statement_node()->stmts);
+            program.a[i] = list.first;
+            program.b[i] = list.count;
+            return i;
+        }
+        case StatementType::IF: {
+            const IfStatementNode& if_stmt = *stmt.get_if_statement_node();
+            uint32_t i = this->emit(FlatOp::IF);
+            this->flatten(*if_stmt.condition);
+            uint32_t then_branch = this->flatten(*if_stmt.then_branch);
+            uint32_t else_branch = if_stmt.else_branch ? this->flatten(*if_stmt.else_branch) : NO_NODE;
+            program.a[i] = then_branch;
+            program.b[i] = else_branch;
+            return i;
+        }
+        case StatementType::WHILE: {
+            const WhileStatementNode& while_stmt = *stmt.get_while_statement_node();
+            uint32_t i = this->emit(FlatOp::WHILE);
+            program.c[i] = this->add_token(while_stmt.tk);
+            this->flatten(*while_stmt.condition);
+            uint32_t body = this->flatten(*while_stmt.body);
+            program.a[i] = body;
+            return i;
+        }
+        case StatementType::BREAK: return this->emit(FlatOp::BREAK);
+        case StatementType::RETURN: {
+            const ReturnStatementNode& ret = *stmt.get_return_statement_node();
+            uint32_t i = this->emit(FlatOp::RETURN);
+            if (ret.expr) {
+                program.a[i] = 1;
+                this->flatten(*ret.expr);
+            }
+            return i;
+        }
+        case StatementType::FUNCTION: {
+            const FunctionDeclarationNode& func = *stmt.get_function_declaration_node();
+            this->program.functions.push_back(this->flatten_function(func));
+            uint32_t i = this->emit(FlatOp::FUNCTION);
+            program.a[i] = static_cast<uint32_t>(this->program.functions.size() - 1);
+            return i;
+        }
+        case StatementType::CLASS: {
+            const ClassDeclarationNode& class_ = *stmt.get_class_declaration_node();
+            auto copy = this->program.declarations.create<ClassDeclarationNode>(class_);
+            copy->methods = this->program.declarations.array<FunctionDeclarationNode*>(class_.methods.size());
+            for (size_t m = 0; m < class_.methods.size(); m++) {
+                copy->methods[m] = this->flatten_function(*class_.methods[m]);
+            }
+            this->program.classes.push_back(copy);
+            uint32_t i = this->emit(FlatOp::CLASS);
+            program.a[i] = static_cast<uint32_t>(this->program.classes.size() - 1);
+            return i;
+        }
+    }
+    uint32_t i = this->emit(FlatOp::UNIMPLEMENTED);
+    program.c[i] = NO_NODE;
+    return i;
+}
+
+
+uint32_t FlatBuilder::flatten(const ExpressionNode& expr) {
+    auto& program = this->program;
+    switch (expr.get_type()) {
+        case ExpressionType::LITERAL: {
+            const Object& value = *expr.get_literal_node()->value;
+            if (value.is_nil()) {
+                return this->emit(FlatOp::NIL);
+            }
+            if (value.is_bool()) {
+                return this->emit(value.as_bool() ? FlatOp::TRUE : FlatOp::FALSE);
+            }
+            uint32_t i = this->emit(FlatOp::CONSTANT);
+            this->program.constants.push_back(value);
+            program.a[i] = static_cast<uint32_t>(this->program.constants.size() - 1);
+            return i;
+        }
+        case ExpressionType::BINARYOP: {
+            const BinaryNode& bin = *expr.get_binary_node();
+            FlatOp op = FlatOp::UNIMPLEMENTED;
+            switch (bin.oper.type) {
+                case TokenType::PLUS: op = FlatOp::ADD; break;
+                case TokenType::MINUS: op = FlatOp::SUBTRACT; break;
+                case TokenType::STAR: op = FlatOp::MULTIPLY; break;
+                case TokenType::SLASH: op = FlatOp::DIVIDE; break;
+                case TokenType::GREATER: op = FlatOp::GREATER; break;
+                case TokenType::GREATER_EQUAL: op = FlatOp::GREATER_EQUAL; break;
+                case TokenType::LESS: op = FlatOp::LESS; break;
+                case TokenType::LESS_EQUAL: op = FlatOp::LESS_EQUAL; break;
+                case TokenType::EQUAL_EQUAL: op = FlatOp::EQUAL; break;
+                case TokenType::BANG_EQUAL: op = FlatOp::NOT_EQUAL; break;
+                default: break;
+            }
+            uint32_t i = this->emit(op);
+            program.c[i] = this->add_token(bin.oper);
+            this->flatten(*bin.left);
+            uint32_t right = this->flatten(*bin.right);
+            program.b[i] = right;
+            return i;
+        }
+        case ExpressionType::UNARYOP: {
+            const UnaryNode& unary = *expr.get_unary_node();
+            FlatOp op = FlatOp::UNIMPLEMENTED;
+            if (unary.oper.type == TokenType::MINUS) op = FlatOp::NEGATE;
+            if (unary.oper.type == TokenType::BANG) op = FlatOp::NOT;
+            uint32_t i = this->emit(op);
+            program.c[i] = this->add_token(unary.oper);
+            this->flatten(*unary.operand);
+            return i;
+        }
+        case ExpressionType::VARIABLE:
+        case ExpressionType::THIS: {
+            const Token& name = expr.get_type() == ExpressionType::VARIABLE ? expr.get_variable_node()->name : expr.get_this_node()->tk;
+            Resolution variable = expr.get_variable();
+            if (variable.kind != VariableKind::GLOBAL) {
+                uint32_t i = this->emit(FlatOp::GET_LOCAL);
+                program.a[i] = static_cast<uint32_t>(variable.kind);
+                program.b[i] = variable.index;
+                return i;
+            }
+            uint32_t i = this->emit(FlatOp::GET_GLOBAL);
+            program.b[i] = variable.index;
+            program.c[i] = this->add_token(name);
+            return i;
+        }
+        case ExpressionType::ASSIGNMENT: {
+            const AssignmentNode& assign = *expr.get_assignment_node();
+            Resolution variable = expr.get_variable();
+            uint32_t i;
+            if (variable.kind != VariableKind::GLOBAL) {
+                i = this->emit(FlatOp::SET_LOCAL);
+                program.a[i] = static_cast<uint32_t>(variable.kind);
+            } else {
+                i = this->emit(FlatOp::SET_GLOBAL);
+                program.c[i] = this->add_token(assign.name);
+            }
+            program.b[i] = variable.index;
+            this->flatten(*assign.expr);
+            return i;
+        }
+        case ExpressionType::LOGICAL: {
+            const LogicalNode& logical = *expr.get_logical_node();
+            uint32_t i = this->emit(logical.oper.type == TokenType::OR ? FlatOp::OR : FlatOp::AND);
+            this->flatten(*logical.left);
+            uint32_t right = this->flatten(*logical.right);
+            program.b[i] = right;
+            return i;
+        }
+        case ExpressionType::CALL: {
+            const CallNode& call = *expr.get_call_node();
+            uint32_t i = this->emit(FlatOp::CALL);
+            program.c[i] = this->add_token(call.paren);
+            this->flatten(*call.callee);
+            std::vector<uint32_t> args;
+            for (const ExpressionNode* argument : call.args) {
+                args.push_back(this->flatten(*argument));
+            }
+            program.a[i] = static_cast<uint32_t>(this->program.lists.size());
+            program.b[i] = static_cast<uint32_t>(args.size());
+            this->program.lists.insert(this->program.lists.end(), args.begin(), args.end());
+            return i;
+        }
+        case ExpressionType::GET: {
+            const GetNode& get = *expr.get_get_node();
+            uint32_t i = this->emit(FlatOp::GET);
+            program.c[i] = this->add_token(get.name);
+            this->flatten(*get.object);
+            return i;
+        }
+        case ExpressionType::LOCAL_LESS_CONST:
+        case ExpressionType::INCREMENT_LOCAL:
+        case ExpressionType::THIS_GET:
+        case ExpressionType::CALL_GLOBAL:
+            return this->flatten(*expr.get_original());
+        case ExpressionType::SET: {
+            const SetNode& set = *expr.get_set_node();
+            uint32_t i = this->emit(FlatOp::SET);
+            program.c[i] = this->add_token(set.name);
+            this->flatten(*set.object);
+            uint32_t value = this->flatten(*set.value);
+            program.b[i] = value;
+            return i;
+        }
+    }
+    uint32_t i = this->emit(FlatOp::UNIMPLEMENTED);
+    program.c[i] = NO_NODE;
+    return i;
+}
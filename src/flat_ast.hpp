@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "token.hpp"
+#include "node.hpp"
+#include "allocator.hpp"
+#include "interpreter.hpp"
+
+// Post-parse representation of a resolved program: every node is addressed by
+// a 32 bit index into parallel arrays, one per field. Nodes are laid out in
+// pre-order, so the first child of node `i` is always `i + 1` and the
+// remaining children follow in evaluation order.
+//
+// It replaces the pointer tree rather than living alongside it: each top-level
+// statement is flattened as soon as it is resolved, and its tree is freed
+// before the next one is parsed. The tokens errors need are copied into
+// `tokens`, and function and class declarations, which the runtime's function
+// objects point at, into `declarations` without their bodies.
+enum class FlatOp : uint8_t {
+    // expressions
+    CONSTANT,       // a: constant
+    NIL,
+    TRUE,
+    FALSE,
+    ADD,            // left: i + 1, b: right, c: token
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    GREATER,
+    GREATER_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    EQUAL,          // left: i + 1, b: right
+    NOT_EQUAL,
+    NEGATE,         // operand: i + 1
+    NOT,
+    GET_LOCAL,      // a: VariableKind, b: index
+    GET_GLOBAL,     // b: global slot, c: token
+    SET_LOCAL,      // value: i + 1, a: VariableKind, b: index
+    SET_GLOBAL,     // value: i + 1, b: global slot, c: token
+    AND,            // left: i + 1, b: right
+    OR,
+    CALL,           // callee: i + 1, a: first list entry, b: argument count, c: token
+    GET,            // object: i + 1, c: token
+    SET,            // object: i + 1, b: value, c: token
+    UNIMPLEMENTED,  // c: token or NO_NODE
+
+    // statements
+    PRINT,          // expr: i + 1
+    EXPRESSION,     // expr: i + 1
+    VAR_DECL,       // init: i + 1, a: VariableKind, b: index
+    BLOCK,          // a: first list entry, b: statement count
+    IF,             // condition: i + 1, a: then, b: else or NO_NODE
+    WHILE,          // condition: i + 1, a: body, c: token
+    BREAK,
+    RETURN,         // expr: i + 1 if a != 0
+    FUNCTION,       // a: function
+    CLASS,          // a: class
+
+    _COUNT
+};
+
+constexpr uint32_t NO_NODE = UINT32_MAX;
+
+struct FlatFunction {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct FlatProgram {
+    // Node fields, struct-of-arrays: dispatch only touches `ops`, and the
+    // token index in `c` is only read when an error is raised
+    std::vector<FlatOp> ops;
+    std::vector<uint32_t> a;
+    std::vector<uint32_t> b;
+    std::vector<uint32_t> c;
+    std::vector<uint32_t> lists;
+    std::vector<Object> constants;
+    std::vector<Token> tokens;
+    ASTAllocator declarations;
+    std::vector<const FunctionDeclarationNode*> functions;
+    std::vector<const ClassDeclarationNode*> classes;
+    std::unordered_map<const FunctionDeclarationNode*, FlatFunction> bodies;
+};
+
+
+// Appends resolved statements to a FlatProgram, copying each variable's
+// resolution from the AST into its flat node. Nothing in the program points
+// back into the AST afterwards.
+struct FlatBuilder {
+    FlatProgram& program;
+
+    explicit FlatBuilder(FlatProgram&);
+
+    uint32_t flatten(const StatementNode&);
+    uint32_t flatten(const ExpressionNode&);
+    FlatFunction flatten(std::span<StatementNode* const>);
+    FunctionDeclarationNode* flatten_function(const FunctionDeclarationNode&);
+
+    uint32_t emit(FlatOp);
+    uint32_t add_token(const Token&);
+};
@@ -0,0 +1,398 @@
+#include <format>
+#include <iostream>
+#include "flat_interpreter.hpp"
+#include "lox_callable.hpp"
+#include "lox_class.hpp"
+#include "lox_instance.hpp"
+#include "lox.hpp"
+
+#if defined(__GNUC__)
+#define LOX_COMPUTED_GOTO
+// Labels as values are a GNU extension
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+#ifdef LOX_COMPUTED_GOTO
+// The do/while keeps `break` meaningful without a switch
+#define FLAT_DISPATCH(table, op) goto *table[std::to_underlying(op)]; do
+#define FLAT_CASE(name) op_##name
+#define FLAT_DEFAULT op_INVALID
+#define FLAT_END while (false);
+#else
+#define FLAT_DISPATCH(table, op) switch (op)
+#define FLAT_CASE(name) case FlatOp::name
+#define FLAT_DEFAULT default
+#define FLAT_END
+#endif
+
+
+FlatInterpreter::FlatInterpreter(Interpreter& interpreter): interpreter{interpreter} {}
+
+
+void FlatInterpreter::interpret(std::span<const uint32_t> stmts) {
+    for (uint32_t i : stmts) {
+        if (this->interpreter.repl_mode && this->program.ops[i] == FlatOp::EXPRESSION) {
+            auto value = this->evaluate(i + 1);
+            if (!value.has_value()) {
+                if (auto err = std::get_if<InterpreterError>(&value.error())) {
+                    Lox::runtime_error(*err);
+                }
+                continue;
+            }
+            std::cout << stringify(value.value()) << '\n';
+            continue;
+        }
+        if (auto res = this->execute(i); res.has_value()) {
+            if (auto err = std::get_if<InterpreterError>(&res.value())) {
+                Lox::runtime_error(*err);
+            }
+        }
+    }
+}
+
+
+std::optional<InterpreterSignal> FlatInterpreter::execute_list(uint32_t first, uint32_t count) {
+    const uint32_t* list = this->program.lists.data() + first;
+    for (uint32_t n = 0; n < count; n++) {
+        if (auto res = this->execute(list[n]); res.has_value()) {
+            return res;
+        }
+    }
+    return std::nullopt;
+}
+
+
+std::optional<InterpreterSignal> FlatInterpreter::execute(uint32_t i) {
+#ifdef LOX_COMPUTED_GOTO
+    static const void* const labels[] = {
+        &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID,
+        &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID,
+        &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID,
+        &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_UNIMPLEMENTED,
+        &&op_PRINT, &&op_EXPRESSION, &&op_VAR_DECL, &&op_BLOCK, &&op_IF, &&op_WHILE, &&op_BREAK, &&op_RETURN,
+        &&op_FUNCTION, &&op_CLASS,
+    };
+    static_assert(std::size(labels) == std::to_underlying(FlatOp::_COUNT));
+#endif
+    const FlatProgram& program = this->program;
+    // Loaded once up front, so they aren't reloaded from their columns after
+    // every recursive call
+    const uint32_t a = program.a[i];
+    const uint32_t b = program.b[i];
+
+    FLAT_DISPATCH(labels, program.ops[i]) {
+        FLAT_CASE(PRINT): {
+            auto res = this->evaluate(i + 1);
+            if (!res.has_value()) {
+                return res.error();
+            }
+            std::cout << stringify(res.value()) << '\n';
+            return std::nullopt;
+        }
+        FLAT_CASE(EXPRESSION): {
+            if (auto res = this->evaluate(i + 1); !res.has_value()) {
+                return res.error();
+            }
+            return std::nullopt;
+        }
+        FLAT_CASE(VAR_DECL): {
+            auto res = this->evaluate(i + 1);
+            if (!res.has_value()) {
+                return res.error();
+            }
+            Resolution variable {static_cast<VariableKind>(a), b};
+            this->interpreter.define(variable, std::move(res.value()));
+            return std::nullopt;
+        }
+        FLAT_CASE(BLOCK): return this->execute_list(a, b);
+        FLAT_CASE(IF): {
+            auto condition = this->evaluate(i + 1);
+            if (!condition.has_value()) {
+                return condition.error();
+            }
+            if (this->interpreter.is_truthy(condition.value())) {
+                return this->execute(a);
+            }
+            if (b != NO_NODE) {
+                return this->execute(b);
+            }
+            return std::nullopt;
+        }
+        FLAT_CASE(WHILE): {
+            while (true) {
+                {
+                    auto res = this->evaluate(i + 1);
+                    if (!res.has_value()) {
+                        return res.error();
+                    }
+                    if (!this->interpreter.is_truthy(res.value())) {
+                        return std::nullopt;
+                    }
+                }
+                if (auto res = this->execute(a); res.has_value()) {
+                    if (std::holds_alternative<BreakSignal>(res.value())) {
+                        return std::nullopt;
+                    }
+                    return res;
+                }
+                if (heap.out_of_memory()) [[unlikely]] {
+                    return InterpreterError(InterpreterErrorType::OutOfMemory, program.tokens[program.c[i]]);
+                }
+            }
+        }
+        FLAT_CASE(BREAK): return BreakSignal{};
+        FLAT_CASE(RETURN): {
+            if (!a) {
+                return ReturnSignal{None()};
+            }
+            auto res = this->evaluate(i + 1);
+            if (!res.has_value()) {
+                return res.error();
+            }
+            return ReturnSignal{std::move(res.value())};
+        }
+        FLAT_CASE(FUNCTION): {
+            const FunctionDeclarationNode& func = *program.functions[a];
+            this->interpreter.define_recursive(func.variable, [&] {
+                return this->interpreter.make_function(func, false);
+            });
+            return std::nullopt;
+        }
+        FLAT_CASE(CLASS): {
+            const ClassDeclarationNode& class_ = *program.classes[a];
+            this->interpreter.define_recursive(class_.variable, [&] {
+                MethodTable methods;
+                for (auto& method : class_.methods) {
+                    methods[method->name.symbol] = this->interpreter.make_function(*method, method->name.symbol == names::INIT);
+                }
+                return make_ref<LoxClass>(symbols.name(class_.name.symbol), std::move(methods));
+            });
+            return std::nullopt;
+        }
+        FLAT_CASE(UNIMPLEMENTED):
+        FLAT_DEFAULT: break;
+    } FLAT_END
+    return InterpreterError(InterpreterErrorType::UnimplementedStatement);
+}
+
+
+std::expected<Object, InterpreterSignal> FlatInterpreter::evaluate(uint32_t i) {
+#ifdef LOX_COMPUTED_GOTO
+    static const void* const labels[] = {
+        &&op_CONSTANT, &&op_NIL, &&op_TRUE, &&op_FALSE,
+        &&op_ADD, &&op_SUBTRACT, &&op_MULTIPLY, &&op_DIVIDE,
+        &&op_GREATER, &&op_GREATER_EQUAL, &&op_LESS, &&op_LESS_EQUAL,
+        &&op_EQUAL, &&op_NOT_EQUAL, &&op_NEGATE, &&op_NOT,
+        &&op_GET_LOCAL, &&op_GET_GLOBAL, &&op_SET_LOCAL, &&op_SET_GLOBAL,
+        &&op_AND, &&op_OR, &&op_CALL, &&op_GET, &&op_SET, &&op_UNIMPLEMENTED,
+        &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID, &&op_INVALID,
+        &&op_INVALID, &&op_INVALID, &&op_INVALID,
+    };
+    static_assert(std::size(labels) == std::to_underlying(FlatOp::_COUNT));
+#endif
+    const FlatProgram& program = this->program;
+    // Loaded once up front, so they aren't reloaded from their columns after
+    // every recursive call
+    const uint32_t a = program.a[i];
+    const uint32_t b = program.b[i];
+
+    auto must_be_numbers = [&]() -> std::expected<Object, InterpreterSignal> {
+        return std::unexpected(InterpreterError(InterpreterErrorType::MustBeNumbers, program.tokens[program.c[i]]));
+    };
+    auto number_op = [&](auto op) -> std::expected<Object, InterpreterSignal> {
+        auto left = this->evaluate(i + 1);
+        if (!left.has_value()) return left;
+        auto right = this->evaluate(b);
+        if (!right.has_value()) return right;
+        if (!left.value().is_number() || !right.value().is_number()) return must_be_numbers();
+        return op(left.value().as_number(), right.value().as_number());
+    };
+
+    FLAT_DISPATCH(labels, program.ops[i]) {
+        FLAT_CASE(CONSTANT): return program.constants[a];
+        FLAT_CASE(NIL): return None();
+        FLAT_CASE(TRUE): return true;
+        FLAT_CASE(FALSE): return false;
+        FLAT_CASE(ADD): {
+            auto left = this->evaluate(i + 1);
+            if (!left.has_value()) return left;
+            auto right = this->evaluate(b);
+            if (!right.has_value()) return right;
+            if (left.value().is_number() && right.value().is_number()) {
+                return left.value().as_number() + right.value().as_number();
+            }
+            if (left.value().is_string() && right.value().is_string()) {
+                Object v = concat_strings(left.value(), right.value());
+                if (heap.out_of_memory()) [[unlikely]] {
+                    return std::unexpected(InterpreterError(InterpreterErrorType::OutOfMemory, program.tokens[program.c[i]]));
+                }
+                return v;
+            }
+            return std::unexpected(InterpreterError(InterpreterErrorType::BinOpValuesNotCompatible, program.tokens[program.c[i]]));
+        }
+        FLAT_CASE(SUBTRACT): return number_op(std::minus<>{});
+        FLAT_CASE(MULTIPLY): return number_op(std::multiplies<>{});
+        FLAT_CASE(DIVIDE): return number_op(std::divides<>{});
+        FLAT_CASE(GREATER): return number_op(std::greater<>{});
+        FLAT_CASE(GREATER_EQUAL): return number_op(std::greater_equal<>{});
+        FLAT_CASE(LESS): return number_op(std::less<>{});
+        FLAT_CASE(LESS_EQUAL): return number_op(std::less_equal<>{});
+        FLAT_CASE(EQUAL): {
+            auto left = this->evaluate(i + 1);
+            if (!left.has_value()) return left;
+            auto right = this->evaluate(b);
+            if (!right.has_value()) return right;
+            return this->interpreter.is_equal(left.value(), right.value());
+        }
+        FLAT_CASE(NOT_EQUAL): {
+            auto left = this->evaluate(i + 1);
+            if (!left.has_value()) return left;
+            auto right = this->evaluate(b);
+            if (!right.has_value()) return right;
+            return !this->interpreter.is_equal(left.value(), right.value());
+        }
+        FLAT_CASE(NEGATE): {
+            auto res = this->evaluate(i + 1);
+            if (!res.has_value()) return res;
+            return -res.value().checked_number();
+        }
+        FLAT_CASE(NOT): {
+            auto res = this->evaluate(i + 1);
+            if (!res.has_value()) return res;
+            return !this->interpreter.is_truthy(res.value());
+        }
+        FLAT_CASE(GET_LOCAL): return this->interpreter.local(Resolution{static_cast<VariableKind>(a), b});
+        FLAT_CASE(GET_GLOBAL): {
+            auto res = this->interpreter.global_env->get(b, program.tokens[program.c[i]]);
+            if (!res.has_value()) return std::unexpected(std::move(res.error()));
+            return std::move(res.value());
+        }
+        FLAT_CASE(SET_LOCAL): {
+            auto value = this->evaluate(i + 1);
+            if (!value.has_value()) return value;
+            this->interpreter.assign_local(Resolution{static_cast<VariableKind>(a), b}, value.value());
+            return value;
+        }
+        FLAT_CASE(SET_GLOBAL): {
+            auto value = this->evaluate(i + 1);
+            if (!value.has_value()) return value;
+            if (auto err = this->interpreter.global_env->assign(b, program.tokens[program.c[i]], value.value()); err.has_value()) {
+                return std::unexpected(err.value());
+            }
+            return value;
+        }
+        FLAT_CASE(AND): {
+            auto left = this->evaluate(i + 1);
+            if (!left.has_value() || !this->interpreter.is_truthy(left.value())) return left;
+            return this->evaluate(b);
+        }
+        FLAT_CASE(OR): {
+            auto left = this->evaluate(i + 1);
+            if (!left.has_value() || this->interpreter.is_truthy(left.value())) return left;
+            return this->evaluate(b);
+        }
+        FLAT_CASE(CALL): {
+            auto callee = this->evaluate(i + 1);
+            if (!callee.has_value()) return callee;
+            Arguments arguments;
+            arguments.reserve(b);
+            for (uint32_t n = 0; n < b; n++) {
+                auto res = this->evaluate(program.lists[a + n]);
+                if (!res.has_value()) return res;
+                arguments.push_back(std::move(res.value()));
+            }
+            return this->call(callee.value(), arguments, program.tokens[program.c[i]]);
+        }
+        FLAT_CASE(GET): {
+            auto obj = this->evaluate(i + 1);
+            if (!obj.has_value()) return obj;
+            if (!obj.value().is_instance()) {
+                return std::unexpected(InterpreterError(InterpreterErrorType::NotInstance, program.tokens[program.c[i]]));
+            }
+            auto res = obj.value().as<LoxInstance>()->get(program.tokens[program.c[i]]);
+            if (!res.has_value()) return std::unexpected(std::move(res.error()));
+            return std::move(res.value());
+        }
+        FLAT_CASE(SET): {
+            auto obj = this->evaluate(i + 1);
+            if (!obj.has_value()) return obj;
+            if (!obj.value().is_instance()) {
+                return std::unexpected(InterpreterError(InterpreterErrorType::NotInstanceSet, program.tokens[program.c[i]]));
+            }
+            auto value = this->evaluate(b);
+            if (!value.has_value()) return value;
+            obj.value().as<LoxInstance>()->set(program.tokens[program.c[i]], value.value());
+            return value;
+        }
+        FLAT_CASE(UNIMPLEMENTED): {
+            if (program.c[i] != NO_NODE) {
+                return std::unexpected(InterpreterError(InterpreterErrorType::UnimplementedOperator, program.tokens[program.c[i]]));
+            }
+            break;
+        }
+        FLAT_DEFAULT: break;
+    } FLAT_END
+    return std::unexpected(InterpreterError(InterpreterErrorType::UnimplementedExpression));
+}
+
+
+std::expected<Object, InterpreterSignal> FlatInterpreter::call(const Object& callee, Arguments& arguments, const Token& paren) {
+    if (!callee.is_callable()) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::NotCallable, paren));
+    }
+    LoxCallable* function = callee.as<LoxCallable>();
+    if (arguments.size() != function->arity()) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::Arity, paren, function->arity(), arguments.size()));
+    }
+    if (heap.out_of_memory()) [[unlikely]] {
+        return std::unexpected(InterpreterError(InterpreterErrorType::OutOfMemory, paren));
+    }
+
+    auto res = [&]() -> std::optional<InterpreterSignal> {
+        if (auto lox_function = dynamic_cast<LoxFunction*>(function)) {
+            return this->call_function(*lox_function, arguments);
+        }
+        if (auto lox_class = dynamic_cast<LoxClass*>(function)) {
+            auto inst = make_ref<LoxInstance>(lox_class);
+            if (auto init = lox_class->find_method(names::INIT)) {
+                return this->call_function(*init->bind(inst), arguments);
+            }
+            return ReturnSignal{inst};
+        }
+        if (function->call(this->interpreter, arguments) == Status::ERROR) {
+            return this->interpreter.take_error();
+        }
+        return ReturnSignal{std::move(this->interpreter.result)};
+    }();
+
+    if (res.has_value()) {
+        if (std::holds_alternative<ReturnSignal>(res.value())) {
+            return std::get<ReturnSignal>(res.value()).value;
+        }
+        return std::unexpected(res.value());
+    }
+    return None();
+}
+
+
+std::optional<InterpreterSignal> FlatInterpreter::call_function(const LoxFunction& function, Arguments& arguments) {
+    auto body = this->program.bodies.find(function.declaration);
+    if (body == this->program.bodies.end()) {
+        return InterpreterError(InterpreterErrorType::NotCompiled, function.declaration->name);
+    }
+
+    auto caller = this->interpreter.push_frame(function, arguments);
+    if (!caller.has_value()) {
+        return caller.error();
+    }
+    auto ret = this->execute_list(body->second.first, body->second.count);
+    this->interpreter.pop_frame(caller.value());
+
+    if (ret.has_value() && std::holds_alternative<InterpreterError>(ret.value())) {
+        return ret;
+    }
+    if (function.is_initializer) {
+        return ReturnSignal{function.receiver};
+    }
+    return ret;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <expected>
+#include <optional>
+#include <span>
+#include <vector>
+#include "flat_ast.hpp"
+#include "interpreter.hpp"
+
+class LoxFunction;
+
+// Executes a FlatProgram. Dispatch uses computed gotos (GCC labels-as-values)
+// when available and falls back to a switch otherwise.
+struct FlatInterpreter {
+    Interpreter& interpreter;
+    FlatProgram program;
+
+    explicit FlatInterpreter(Interpreter&);
+
+    // Runs top-level statements already flattened into `program`
+    void interpret(std::span<const uint32_t>);
+
+    [[nodiscard]] std::optional<InterpreterSignal> execute(uint32_t);
+    [[nodiscard]] std::optional<InterpreterSignal> execute_list(uint32_t, uint32_t);
+    [[nodiscard]] std::expected<Object, InterpreterSignal> evaluate(uint32_t);
+
+    [[nodiscard]] std::expected<Object, InterpreterSignal> call(const Object&, Arguments&, const Token&);
+    [[nodiscard]] std::optional<InterpreterSignal> call_function(const LoxFunction&, Arguments&);
+};
@@ -0,0 +1,146 @@
+#include "fuser.hpp"
+
+
+Fuser::Fuser(ASTAllocator& allocator): allocator{allocator} {}
+
+
+const Resolution* Fuser::resolution(const ExpressionNode& expr) const {
+    switch (expr.get_type()) {
+        case ExpressionType::VARIABLE:
+        case ExpressionType::ASSIGNMENT:
+        case ExpressionType::THIS:
+            return &expr.get_variable();
+        default:
+            return nullptr;
+    }
+}
+
+
+// The fused nodes read their local straight out of the frame, so they only
+// apply to locals no closure captures
+const Resolution* Fuser::slot(const ExpressionNode& expr) const {
+    const Resolution* l = this->resolution(expr);
+    return l && l->kind == VariableKind::SLOT ? l : nullptr;
+}
+
+
+// Moves `expr` to a new node so the fused node can take its place
+ExpressionNode* Fuser::keep_original(ExpressionNode& expr) {
+    return this->allocator.create<ExpressionNode>(expr);
+}
+
+
+void Fuser::fuse(std::span<StatementNode* const> stmts) {
+    for (const auto& stmt : stmts) {
+        this->fuse(*stmt);
+    }
+}
+
+
+void Fuser::fuse(StatementNode& stmt) {
+    switch (stmt.get_type()) {
+        case StatementType::PRINT: this->fuse(*stmt.get_print_statement_node()->expr); break;
+        case StatementType::EXPRESSION: this->fuse(*stmt.get_expression_statement_node()->expr); break;
+        case StatementType::VARIABLE:
+            if (auto init = stmt.get_variable_statement_node()->initializer) this->fuse(*init);
+            break;
+        case StatementType::BLOCK: this->fuse(stmt.get_block_statement_node()->stmts); break;
+        case StatementType::IF: {
+            IfStatementNode& if_stmt = *stmt.get_if_statement_node();
+            this->fuse(*if_stmt.condition);
+            this->fuse(*if_stmt.then_branch);
+            if (if_stmt.else_branch) this->fuse(*if_stmt.else_branch);
+            break;
+        }
+        case StatementType::WHILE:
+            this->fuse(*stmt.get_while_statement_node()->condition);
+            this->fuse(*stmt.get_while_statement_node()->body);
+            break;
+        case StatementType::BREAK: break;
+        case StatementType::RETURN:
+            if (auto expr = stmt.get_return_statement_node()->expr) this->fuse(*expr);
+            break;
+        case StatementType::FUNCTION: this->fuse(stmt.get_function_declaration_node()->body->stmts); break;
+        case StatementType::CLASS:
+            for (const auto& method : stmt.get_class_declaration_node()->methods) {
+                this->fuse(method->body->stmts);
+            }
+            break;
+    }
+}
+
+
+void Fuser::fuse(ExpressionNode& expr) {
+    switch (expr.get_type()) {
+        case ExpressionType::BINARYOP: {
+            const BinaryNode& bin = *expr.get_binary_node();
+            this->fuse(*bin.left);
+            this->fuse(*bin.right);
+            if (bin.oper.type != TokenType::LESS || bin.left->get_type() != ExpressionType::VARIABLE || bin.right->get_type() != ExpressionType::LITERAL) {
+                break;
+            }
+            const Resolution* l = this->slot(*bin.left);
+            const Object& constant = *bin.right->get_literal_node()->value;
+            if (l && constant.is_number()) {
+                expr.set(this->allocator.create<LocalLessConstNode>(this->keep_original(expr), l->index, constant.as_number()));
+            }
+            break;
+        }
+        case ExpressionType::ASSIGNMENT: {
+            const AssignmentNode& assign = *expr.get_assignment_node();
+            this->fuse(*assign.expr);
+            const Resolution* l = this->slot(expr);
+            if (!l || assign.expr->get_type() != ExpressionType::BINARYOP) {
+                break;
+            }
+            const BinaryNode& bin = *assign.expr->get_binary_node();
+            if (bin.oper.type != TokenType::PLUS || bin.left->get_type() != ExpressionType::VARIABLE || bin.right->get_type() != ExpressionType::LITERAL) {
+                break;
+            }
+            const Resolution* operand = this->slot(*bin.left);
+            const Object& constant = *bin.right->get_literal_node()->value;
+            if (operand && constant.is_number() && operand->index == l->index) {
+                expr.set(this->allocator.create<IncrementLocalNode>(this->keep_original(expr), l->index, constant.as_number()));
+            }
+            break;
+        }
+        case ExpressionType::GET: {
+            GetNode& get = *expr.get_get_node();
+            this->fuse(*get.object);
+            if (get.object->get_type() != ExpressionType::THIS) {
+                break;
+            }
+            if (const Resolution* l = this->slot(*get.object)) {
+                expr.set(this->allocator.create<ThisGetNode>(this->keep_original(expr), l->index, get.name));
+            }
+            break;
+        }
+        case ExpressionType::CALL: {
+            CallNode& call = *expr.get_call_node();
+            this->fuse(*call.callee);
+            for (ExpressionNode* argument : call.args) this->fuse(*argument);
+            const Resolution* callee = this->resolution(*call.callee);
+            if (call.callee->get_type() == ExpressionType::VARIABLE && callee && callee->kind == VariableKind::GLOBAL) {
+                expr.set(this->allocator.create<CallGlobalNode>(this->keep_original(expr), callee->index, &call));
+            }
+            break;
+        }
+        case ExpressionType::UNARYOP: this->fuse(*expr.get_unary_node()->operand); break;
+        case ExpressionType::LOGICAL:
+            this->fuse(*expr.get_logical_node()->left);
+            this->fuse(*expr.get_logical_node()->right);
+            break;
+        case ExpressionType::SET:
+            this->fuse(*expr.get_set_node()->object);
+            this->fuse(*expr.get_set_node()->value);
+            break;
+        case ExpressionType::LITERAL:
+        case ExpressionType::VARIABLE:
+        case ExpressionType::THIS:
+        case ExpressionType::LOCAL_LESS_CONST:
+        case ExpressionType::INCREMENT_LOCAL:
+        case ExpressionType::THIS_GET:
+        case ExpressionType::CALL_GLOBAL:
+            break;
+    }
+}
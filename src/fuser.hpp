@@ -0,0 +1,22 @@
+#pragma once
+
+#include <vector>
+#include "node.hpp"
+
+// Rewrites the hottest node shapes of a resolved program into fused nodes
+// (see node.hpp) that the tree-walker runs in a single step. Must run after
+// the resolver since it folds variable resolutions into the fused nodes.
+struct Fuser {
+    ASTAllocator& allocator;
+
+    explicit Fuser(ASTAllocator&);
+
+    void fuse(std::span<StatementNode* const>);
+    void fuse(StatementNode&);
+    void fuse(ExpressionNode&);
+
+private:
+    const Resolution* resolution(const ExpressionNode&) const;
+    const Resolution* slot(const ExpressionNode&) const;
+    ExpressionNode* keep_original(ExpressionNode&);
+};
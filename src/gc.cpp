@@ -0,0 +1,606 @@
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include "gc.hpp"
+#include "memory.hpp"
+
+
+constinit Heap heap {};
+
+
+void* Nursery::refill(size_t size) {
+    if (!this->reserve) {
+        this->reserve = memory.map(RESERVE);
+    }
+    // The tail of the old block is too small for this object; blocks are
+    // never returned, so leave it
+    size_t block_size = this->block_size;
+    void* block = memory.map(block_size);
+    if (!block) [[unlikely]] {
+        // Allocation can't fail, so carry on in the reserve and have the
+        // interpreter raise the error
+        if (!this->reserve) {
+            throw std::bad_alloc();
+        }
+        block = std::exchange(this->reserve, nullptr);
+        block_size = RESERVE;
+        heap.exhausted = true;
+        heap.backend_failed = true;
+    } else {
+        this->block_size = std::min(this->block_size * 2, MAX_BLOCK);
+    }
+    this->blocks++;
+    this->reserved += block_size;
+    this->cursor = static_cast<char*>(block);
+    this->limit = this->cursor + block_size;
+    void* object = this->cursor;
+    this->cursor += size;
+    return object;
+}
+
+
+void Heap::add(LoxObject* object, size_t size) {
+    object->size = static_cast<uint32_t>(size);
+    // Allocated black while a cycle runs
+    object->marked = this->phase != Phase::IDLE;
+    object->gc_next = this->young;
+    if (this->young) {
+        this->young->gc_prev = object;
+    }
+    this->young = object;
+    this->bytes += size;
+    this->young_bytes += size;
+    this->count++;
+    this->stats.objects++;
+    this->stats.allocated += size;
+    this->stats.since_minor += size;
+}
+
+
+// Deleting an object releases everything it references, so dropping the head
+// of a long chain would recurse once per link. Objects that die during a
+// delete are queued instead, and the outermost call deletes them in a loop.
+void LoxObject::destroy(const LoxObject* object) {
+    if (heap.destroying) {
+        heap.dying.push_back(object);
+        return;
+    }
+    heap.destroying = true;
+    delete object;
+    while (!heap.dying.empty()) {
+        const LoxObject* next = heap.dying.back();
+        heap.dying.pop_back();
+        delete next;
+    }
+    heap.destroying = false;
+}
+
+
+void Heap::remove(LoxObject* object) {
+    if (object == this->cursor) {
+        this->cursor = object->gc_next;
+    }
+    LoxObject*& list = object->young ? this->young : this->old;
+    if (object->gc_prev) {
+        object->gc_prev->gc_next = object->gc_next;
+    } else if (list == object) {
+        list = object->gc_next;
+    } else {
+        return; // never added
+    }
+    if (object->gc_next) {
+        object->gc_next->gc_prev = object->gc_prev;
+    }
+    if (object->remembered) {
+        // Swap the last entry into its place
+        LoxObject* last = this->remembered.back();
+        last->remembered_index = object->remembered_index;
+        this->remembered[object->remembered_index] = last;
+        this->remembered.pop_back();
+    }
+    this->bytes -= object->size;
+    if (object->young) {
+        this->young_bytes -= object->size;
+    }
+    this->count--;
+}
+
+
+void Heap::resize(LoxObject* object, size_t size) {
+    // Wraps around when shrinking, which the unsigned sums undo
+    size_t delta = size - object->size;
+    this->bytes += delta;
+    if (object->young) {
+        this->young_bytes += delta;
+    }
+    object->size = static_cast<uint32_t>(size);
+}
+
+
+namespace {
+
+struct SubtractInternal: GcVisitor {
+    bool young_only;
+
+    explicit SubtractInternal(bool young_only): young_only{young_only} {}
+
+    void visit(const LoxObject* object) override {
+        if (object->young || !this->young_only) {
+            object->gc_refs--;
+        }
+    }
+};
+
+struct Mark: GcVisitor {
+    bool young_only;
+    std::vector<const LoxObject*> stack;
+
+    explicit Mark(bool young_only): young_only{young_only} {}
+
+    void visit(const LoxObject* object) override {
+        if (!object->marked && (object->young || !this->young_only)) {
+            object->marked = true;
+            this->stack.push_back(object);
+        }
+    }
+
+    void drain() {
+        while (!this->stack.empty()) {
+            const LoxObject* o = this->stack.back();
+            this->stack.pop_back();
+            o->trace(*this);
+        }
+    }
+};
+
+// Keeps the garbage alive while its references to itself are dropped, then
+// lets the counts free it
+void sweep(LoxObject* list) {
+    std::vector<LoxObject*> garbage;
+    for (LoxObject* o = list; o; o = o->gc_next) {
+        if (!o->marked) {
+            o->retain();
+            garbage.push_back(o);
+        }
+    }
+    for (LoxObject* o : garbage) {
+        o->clear();
+    }
+    for (LoxObject* o : garbage) {
+        o->release();
+    }
+}
+
+// References among the candidates of an incremental cycle
+struct SubtractCandidates: GcVisitor {
+    void visit(const LoxObject* object) override {
+        if (object->candidate) {
+            object->gc_refs--;
+        }
+    }
+};
+
+struct MarkCandidates: GcVisitor {
+    std::vector<const LoxObject*> stack;
+
+    void visit(const LoxObject* object) override {
+        if (object->candidate && !object->marked) {
+            object->marked = true;
+            this->stack.push_back(object);
+        }
+    }
+};
+
+double elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+
+// Moves every young object to the old list; nothing is left for the
+// remembered set to point at
+void Heap::promote() {
+    LoxObject* last = nullptr;
+    for (LoxObject* o = this->young; o; o = o->gc_next) {
+        o->young = false;
+        // Black if a cycle is running
+        o->marked = true;
+        last = o;
+    }
+    if (last) {
+        last->gc_next = this->old;
+        if (this->old) {
+            this->old->gc_prev = last;
+        }
+        this->old = std::exchange(this->young, nullptr);
+    }
+    this->young_bytes = 0;
+    for (LoxObject* o : this->remembered) {
+        o->remembered = false;
+    }
+    this->remembered.clear();
+}
+
+
+void Heap::collect_young() {
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes_before = this->bytes;
+    size_t count_before = this->count;
+    size_t allocated = this->stats.since_minor;
+
+    for (LoxObject* o = this->young; o; o = o->gc_next) {
+        o->gc_refs = o->ref_count();
+        o->marked = false;
+    }
+    // The remembered objects' references are subtracted too and traced as
+    // roots below, so what's left is held from outside the heap
+    SubtractInternal subtract(true);
+    for (LoxObject* o = this->young; o; o = o->gc_next) {
+        o->trace(subtract);
+    }
+    for (const LoxObject* o : this->remembered) {
+        o->trace(subtract);
+    }
+
+    Mark mark(true);
+    for (const LoxObject* o : this->remembered) {
+        o->trace(mark);
+    }
+    for (LoxObject* o = this->young; o; o = o->gc_next) {
+        if (o->gc_refs > 0) {
+            mark.visit(o);
+        }
+    }
+    mark.drain();
+    sweep(this->young);
+
+    size_t promoted = this->young_bytes;
+    this->promote();
+    this->minor_cycles++;
+    this->stats.promoted += promoted;
+    this->stats.since_minor = 0;
+    double pause = elapsed_us(start);
+    this->stats.minor_pause_us += pause;
+    this->stats.max_minor_pause_us = std::max(this->stats.max_minor_pause_us, pause);
+    this->record_pause(pause);
+    // A minor collection can't be split, so under a budget size the nursery
+    // to what one can get through
+    if (this->pause_budget_us) {
+        if (pause > this->pause_budget_us && this->nursery_size > MIN_NURSERY) {
+            this->nursery_size /= 2;
+        } else if (pause < this->pause_budget_us / 4 && this->nursery_size < MAX_NURSERY) {
+            this->nursery_size *= 2;
+        }
+    }
+    if (this->log) {
+        std::cerr << "[gc] minor " << this->minor_cycles << ": pause " << pause << "us, reclaimed "
+                  << bytes_before - this->bytes << " bytes (" << count_before - this->count << " objects), promoted "
+                  << promoted << " of " << allocated << " bytes allocated\n";
+    }
+}
+
+
+void Heap::collect() {
+    auto start = std::chrono::steady_clock::now();
+    size_t bytes_before = this->bytes;
+    size_t count_before = this->count;
+
+    // What's left of a count after removing references from other heap
+    // objects is held by something outside the heap, which makes it a root
+    for (LoxObject* list : {this->young, this->old}) {
+        for (LoxObject* o = list; o; o = o->gc_next) {
+            o->gc_refs = o->ref_count();
+            o->marked = false;
+        }
+    }
+    SubtractInternal subtract(false);
+    for (LoxObject* list : {this->young, this->old}) {
+        for (LoxObject* o = list; o; o = o->gc_next) {
+            o->trace(subtract);
+        }
+    }
+
+    Mark mark(false);
+    for (LoxObject* list : {this->young, this->old}) {
+        for (LoxObject* o = list; o; o = o->gc_next) {
+            if (o->gc_refs > 0) {
+                mark.visit(o);
+            }
+        }
+    }
+    mark.drain();
+    sweep(this->young);
+    sweep(this->old);
+
+    this->stats.promoted += this->young_bytes;
+    this->stats.since_minor = 0;
+    this->promote();
+    this->cycles++;
+    this->threshold = std::max<size_t>(1 << 20, std::max(this->bytes, this->nursery.carved()) * 2);
+    double pause = elapsed_us(start);
+    this->stats.major_pause_us += pause;
+    this->record_pause(pause);
+    if (this->log) {
+        std::cerr << "[gc] cycle " << this->cycles << ": pause " << pause << "us, reclaimed "
+                  << bytes_before - this->bytes << " bytes (" << count_before - this->count << " objects), "
+                  << this->bytes << " bytes live\n";
+    }
+}
+
+
+void Heap::reached_limit(size_t size) {
+    if (this->exhausted) {
+        return;
+    }
+    // Dead cycles may be what's over the limit
+    while (this->phase != Phase::IDLE) {
+        this->collect_slice();
+    }
+    this->collect();
+    this->exhausted = this->nursery.live_bytes + size > this->max_heap;
+}
+
+
+void Heap::shade(const LoxObject* object) {
+    object->marked = true;
+    object->retain();
+    this->gray.push_back(object);
+}
+
+
+void Heap::start_cycle() {
+    // Everything allocated from here on is black, so start with an empty
+    // young generation
+    this->collect_young();
+    this->phase = Phase::INIT;
+    this->cursor = this->old;
+}
+
+
+void Heap::collect_slice() {
+    if (this->phase == Phase::IDLE) {
+        this->start_cycle();
+    }
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::microseconds(this->pause_budget_us);
+    this->since_slice = 0;
+
+    struct Shade: GcVisitor {
+        Heap& heap;
+
+        explicit Shade(Heap& heap): heap{heap} {}
+
+        void visit(const LoxObject* object) override {
+            if (!object->marked) {
+                this->heap.shade(object);
+            }
+        }
+    };
+
+    SubtractInternal subtract(false);
+    Shade shade(*this);
+    // Reading the clock costs more than most steps, so check it every few
+    for (size_t work = 1; this->phase != Phase::IDLE; work++) {
+        if (work % 64 == 0 && std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        switch (this->phase) {
+            case Phase::INIT:
+                if (!this->cursor) {
+                    this->phase = Phase::SUBTRACT;
+                    this->marking = true;
+                    this->cursor = this->old;
+                    break;
+                }
+                this->cursor->gc_refs = this->cursor->ref_count();
+                this->cursor->marked = false;
+                this->cursor = this->cursor->gc_next;
+                break;
+            case Phase::SUBTRACT:
+                if (!this->cursor) {
+                    this->phase = Phase::ROOTS;
+                    this->cursor = this->old;
+                    break;
+                }
+                if (!this->cursor->marked) {
+                    this->cursor->trace(subtract);
+                }
+                this->cursor = this->cursor->gc_next;
+                break;
+            case Phase::ROOTS:
+                if (!this->cursor) {
+                    this->phase = Phase::MARK;
+                    break;
+                }
+                if (!this->cursor->marked && this->cursor->gc_refs > 0) {
+                    this->shade(this->cursor);
+                }
+                this->cursor = this->cursor->gc_next;
+                break;
+            case Phase::MARK:
+                if (this->gray.empty()) {
+                    this->phase = Phase::GATHER;
+                    this->cursor = this->old;
+                    break;
+                } else {
+                    const LoxObject* o = this->gray.back();
+                    this->gray.pop_back();
+                    o->trace(shade);
+                    o->release();
+                }
+                break;
+            case Phase::GATHER:
+                // Checking runs in one step, so take the candidates in
+                // batches that fit the budget
+                if (!this->cursor || this->candidates.size() >= std::max<size_t>(64, this->pause_budget_us * 2)) {
+                    this->validate_candidates();
+                    break;
+                }
+                if (!this->cursor->marked) {
+                    this->cursor->retain();
+                    this->candidates.push_back(this->cursor);
+                }
+                this->cursor = this->cursor->gc_next;
+                break;
+            case Phase::CLEAR:
+                if (this->candidate_index == this->candidates.size()) {
+                    this->phase = Phase::RELEASE;
+                    this->candidate_index = 0;
+                    break;
+                }
+                const_cast<LoxObject*>(this->candidates[this->candidate_index++])->clear();
+                break;
+            case Phase::RELEASE:
+                if (this->candidate_index == this->candidates.size()) {
+                    this->objects_reclaimed += this->candidates.size();
+                    this->candidates.clear();
+                    if (this->cursor) {
+                        this->phase = Phase::GATHER;
+                    } else {
+                        this->finish_cycle();
+                    }
+                    break;
+                }
+                this->candidates[this->candidate_index++]->release();
+                break;
+            case Phase::IDLE:
+                break;
+        }
+    }
+
+    double pause = elapsed_us(start);
+    this->stats.slices++;
+    this->stats.max_slice_us = std::max(this->stats.max_slice_us, pause);
+    this->stats.major_pause_us += pause;
+    this->record_pause(pause);
+}
+
+
+// The candidates were found against counts and edges that kept changing.
+// Now, in one step, keep every candidate something outside the set still
+// references, and whatever those reach; the rest is unreachable garbage.
+void Heap::validate_candidates() {
+    this->marking = false;
+    for (const LoxObject* o : this->gray) {
+        o->release();
+    }
+    this->gray.clear();
+
+    for (const LoxObject* o : this->candidates) {
+        o->candidate = true;
+        o->marked = false;
+        // Less the reference the cycle holds itself
+        o->gc_refs = o->ref_count() - 1;
+    }
+    SubtractCandidates subtract;
+    for (const LoxObject* o : this->candidates) {
+        o->trace(subtract);
+    }
+    MarkCandidates mark;
+    for (const LoxObject* o : this->candidates) {
+        if (o->gc_refs > 0) {
+            mark.visit(o);
+        }
+    }
+    while (!mark.stack.empty()) {
+        const LoxObject* o = mark.stack.back();
+        mark.stack.pop_back();
+        o->trace(mark);
+    }
+
+    std::vector<const LoxObject*> live;
+    size_t garbage = 0;
+    for (const LoxObject* o : this->candidates) {
+        o->candidate = false;
+        if (o->marked) {
+            live.push_back(o);
+        } else {
+            this->candidates[garbage++] = o;
+            this->cycle_reclaimed += o->size;
+        }
+    }
+    this->candidates.resize(garbage);
+    for (const LoxObject* o : live) {
+        o->release();
+    }
+    this->phase = Phase::CLEAR;
+    this->candidate_index = 0;
+}
+
+
+void Heap::finish_cycle() {
+    this->phase = Phase::IDLE;
+    this->cycles++;
+    this->threshold = std::max<size_t>(1 << 20, std::max(this->bytes, this->nursery.carved()) * 2);
+    if (this->log) {
+        std::cerr << "[gc] cycle " << this->cycles << ": incremental, reclaimed " << this->cycle_reclaimed
+                  << " bytes (" << this->objects_reclaimed << " objects), " << this->bytes << " bytes live\n";
+    }
+    this->cycle_reclaimed = 0;
+    this->objects_reclaimed = 0;
+}
+
+
+void Heap::record_pause(double us) {
+    size_t bucket = us < 1 ? 0 : std::bit_width(static_cast<uint64_t>(us));
+    this->stats.pauses[std::min(bucket, PAUSE_BUCKETS - 1)]++;
+}
+
+
+void Heap::print_stats() const {
+    double survival = this->stats.allocated ? 100.0 * this->stats.promoted / this->stats.allocated : 0;
+    std::cerr << "objects allocated:  " << this->stats.objects << '\n'
+              << "bytes allocated:    " << this->stats.allocated << '\n'
+              << "bytes promoted:     " << this->stats.promoted << " (" << survival << "% survived the nursery)\n"
+              << "minor collections:  " << this->minor_cycles << '\n'
+              << "minor pause:        " << (this->minor_cycles ? this->stats.minor_pause_us / this->minor_cycles : 0)
+              << " us avg, " << this->stats.max_minor_pause_us << " us max\n"
+              << "major collections:  " << this->cycles << '\n';
+    if (this->stats.slices) {
+        std::cerr << "incremental slices: " << this->stats.slices << ", " << this->stats.max_slice_us << " us max\n";
+    } else {
+        std::cerr << "major pause:        " << (this->cycles ? this->stats.major_pause_us / this->cycles : 0) << " us avg\n";
+    }
+    size_t pooled = 0;
+    for (size_t i = 0; i < Nursery::MAX_OBJECT / Nursery::ALIGN; i++) {
+        pooled += this->nursery.classes[i].live * (i + 1) * Nursery::ALIGN;
+    }
+    size_t carved = this->nursery.carved();
+    std::cerr << "nursery blocks:     " << this->nursery.blocks << ", " << this->nursery.reserved / 1024 << " KB, "
+              << (carved ? 100.0 * pooled / carved : 0) << "% occupied\n"
+              << "bytes live:         " << this->bytes << " in objects, " << this->nursery.live_bytes << " with their buffers\n"
+              << "memory mapped:      " << memory.mapped << " bytes in " << memory.blocks << " blocks from " << memory.backend_name
+              << ", " << memory.peak << " peak\n";
+    if (this->max_heap != SIZE_MAX) {
+        std::cerr << "max heap:           " << this->max_heap << " bytes\n";
+    }
+    std::cerr << "size classes:       allocations, live\n";
+    for (size_t i = 0; i < Nursery::MAX_OBJECT / Nursery::ALIGN; i++) {
+        const Nursery::ClassStats& c = this->nursery.classes[i];
+        if (c.allocations) {
+            std::string size = std::to_string((i + 1) * Nursery::ALIGN) + " B";
+            std::cerr << "  " << size << std::string(18 - size.size(), ' ') << c.allocations << ", " << c.live << '\n';
+        }
+    }
+    if (this->nursery.large.allocations) {
+        std::string size = "> " + std::to_string(Nursery::MAX_OBJECT) + " B";
+        std::cerr << "  " << size << std::string(18 - size.size(), ' ')
+                  << this->nursery.large.allocations << ", " << this->nursery.large.live << '\n';
+    }
+    std::cerr << "pauses:\n";
+    for (size_t i = 0; i < PAUSE_BUCKETS; i++) {
+        if (!this->stats.pauses[i]) {
+            continue;
+        }
+        std::string range = i == 0 ? "< 1 us"
+            : i == PAUSE_BUCKETS - 1 ? ">= " + std::to_string(1u << (i - 1)) + " us"
+            : std::to_string(1u << (i - 1)) + "-" + std::to_string(1u << i) + " us";
+        std::cerr << "  " << range << std::string(20 - std::min<size_t>(range.size(), 19), ' ') << this->stats.pauses[i] << '\n';
+    }
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <concepts>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+struct LoxObject;
+
+// Called once for every counted reference an object holds
+struct GcVisitor {
+    virtual void visit(const LoxObject*) = 0;
+    virtual ~GcVisitor() = default;
+};
+
+
+// Header of every runtime object: strings, callables, instances and
+// environments. The reference count frees acyclic garbage as soon as it is
+// dropped; the heap's collector finds the cycles the count can't.
+//
+// An interpreter and everything it allocates stay on one thread, so the
+// count is a plain integer. LOX_ATOMIC_REFCOUNT makes the count atomic and
+// nothing else: the heap, its nursery and remembered set, and the symbol
+// table are unsynchronized, so objects still can't be shared between threads.
+struct LoxObject {
+#ifdef LOX_ATOMIC_REFCOUNT
+    mutable std::atomic<uint32_t> refs {0};
+#else
+    mutable uint32_t refs = 0;
+#endif
+    uint32_t size = 0;
+    LoxObject* gc_prev = nullptr;
+    LoxObject* gc_next = nullptr;
+    mutable int64_t gc_refs = 0;
+    mutable bool marked = false;
+    // Allocated since the last collection
+    bool young = true;
+    // Old, and in the heap's remembered set
+    bool remembered = false;
+    // In the set an incremental collection is about to free
+    mutable bool candidate = false;
+    // Position in the remembered set, so a freed object leaves it in O(1)
+    uint32_t remembered_index = 0;
+
+    LoxObject() = default;
+    LoxObject(const LoxObject&) = delete;
+    LoxObject& operator=(const LoxObject&) = delete;
+    virtual ~LoxObject();
+
+    static void* operator new(size_t size);
+    static void operator delete(void* memory, size_t size);
+    static void destroy(const LoxObject*);
+
+    // Reports every reference this object counts, and only those
+    virtual void trace(GcVisitor&) const {}
+    // Drops every reference this object counts, to break a dead cycle
+    virtual void clear() {}
+
+#ifdef LOX_ATOMIC_REFCOUNT
+    uint32_t ref_count() const {
+        return this->refs.load(std::memory_order_relaxed);
+    }
+
+    void retain() const {
+        this->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() const {
+        if (this->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            destroy(this);
+        }
+    }
+#else
+    uint32_t ref_count() const {
+        return this->refs;
+    }
+
+    void retain() const {
+        this->refs++;
+    }
+
+    void release() const {
+        if (--this->refs == 0) {
+            destroy(this);
+        }
+    }
+#endif
+};
+
+
+// Bump allocator for small objects. Memory comes in blocks that are carved
+// up in order; a freed object goes onto a free list for its size, which
+// allocation checks before bumping. Objects never move, so reusing the holes
+// they leave is what keeps a long-lived object from pinning the short-lived
+// garbage allocated around it. The buffers objects own (string text, fields,
+// argument lists) come from it too, through PoolAllocator. Blocks come from
+// the memory backend and double in size up to MAX_BLOCK; anything larger
+// than MAX_OBJECT gets its own allocation.
+class Nursery {
+public:
+    static constexpr size_t MIN_BLOCK = 32 << 10;
+    static constexpr size_t MAX_BLOCK = 2 << 20;
+    static constexpr size_t MAX_OBJECT = 1 << 10;
+    static constexpr size_t ALIGN = 16;
+    // Held back for when the backend has no block left, so the interpreter
+    // can get to the check that raises the error
+    static constexpr size_t RESERVE = 256 << 10;
+
+private:
+    struct FreeSlot {
+        FreeSlot* next;
+    };
+
+    char* cursor = nullptr;
+    char* limit = nullptr;
+    size_t block_size = MIN_BLOCK;
+    void* reserve = nullptr;
+    // One list per multiple of ALIGN
+    FreeSlot* free_lists[MAX_OBJECT / ALIGN] {};
+
+    static size_t rounded(size_t size) {
+        return (size + ALIGN - 1) & ~(ALIGN - 1);
+    }
+
+    void* refill(size_t size);
+
+public:
+    struct ClassStats {
+        size_t allocations = 0;
+        size_t live = 0;
+    };
+
+    size_t blocks = 0;
+    size_t reserved = 0;
+    // Bytes handed out and not yet freed, rounded to their size class
+    size_t live_bytes = 0;
+    // Per size class, then for everything above MAX_OBJECT
+    ClassStats classes[MAX_OBJECT / ALIGN] {};
+    ClassStats large {};
+
+    constexpr Nursery() = default;
+
+    // Bytes of the blocks carved so far
+    size_t carved() const {
+        return this->reserved - static_cast<size_t>(this->limit - this->cursor);
+    }
+
+    void* allocate(size_t size) {
+        size = rounded(size);
+        this->live_bytes += size;
+        if (size > MAX_OBJECT) [[unlikely]] {
+            this->large.allocations++;
+            this->large.live++;
+            return ::operator new(size);
+        }
+        ClassStats& stats = this->classes[size / ALIGN - 1];
+        stats.allocations++;
+        stats.live++;
+        if (FreeSlot*& slot = this->free_lists[size / ALIGN - 1]) {
+            return std::exchange(slot, slot->next);
+        }
+        if (static_cast<size_t>(this->limit - this->cursor) < size) [[unlikely]] {
+            return this->refill(size);
+        }
+        void* memory = this->cursor;
+        this->cursor += size;
+        return memory;
+    }
+
+    void free(void* memory, size_t size) {
+        size = rounded(size);
+        this->live_bytes -= size;
+        if (size > MAX_OBJECT) [[unlikely]] {
+            this->large.live--;
+            ::operator delete(memory);
+            return;
+        }
+        this->classes[size / ALIGN - 1].live--;
+        FreeSlot*& list = this->free_lists[size / ALIGN - 1];
+        list = new (memory) FreeSlot{list};
+    }
+};
+
+
+// Owns every LoxObject. Objects are linked into the young list when
+// allocated, move to the old list when they survive a collection, and are
+// unlinked when their count drops to zero.
+//
+// A collection finds the objects referenced from outside the heap (the
+// globals, the value stack, values on the C++ stack, AST literals) by
+// subtracting every reference the heap holds to itself from each count, marks
+// everything reachable from them and frees the rest, which can only be
+// cycles. A minor collection does this for the young objects alone, so its
+// cost follows the size of the nursery rather than the heap. References from
+// old objects are roots for it; the write barrier records the old objects
+// that were given one, and a missed barrier only means the young object is
+// kept by its count instead.
+//
+// With a pause budget, full collections are incremental: each phase walks
+// the old list a slice at a time between allocations. Objects allocated
+// while a cycle runs are black, and the write barrier greys what is stored
+// during marking. Counts and edges change between slices, so the unmarked
+// objects are only candidates: they are retained, and checked once more in
+// one step by subtracting the references among themselves alone. Whatever
+// is still referenced from outside the candidates survives; the rest can't
+// be reached and is freed over the following slices.
+class Heap {
+    enum class Phase : uint8_t {
+        IDLE,
+        INIT,
+        SUBTRACT,
+        ROOTS,
+        MARK,
+        GATHER,
+        CLEAR,
+        RELEASE,
+    };
+
+    LoxObject* young = nullptr;
+    LoxObject* old = nullptr;
+    std::vector<LoxObject*> remembered;
+    uint32_t stress_ticks = 0;
+
+    Phase phase = Phase::IDLE;
+    bool marking = false;
+    // Next object of the old list the current phase visits
+    LoxObject* cursor = nullptr;
+    std::vector<const LoxObject*> gray;
+    std::vector<const LoxObject*> candidates;
+    size_t candidate_index = 0;
+    size_t cycle_reclaimed = 0;
+    size_t objects_reclaimed = 0;
+    size_t since_slice = 0;
+    // Objects whose count dropped to zero while another one was being deleted
+    std::vector<const LoxObject*> dying;
+    bool destroying = false;
+
+    friend struct LoxObject;
+
+    void promote();
+    void reached_limit(size_t size);
+    void shade(const LoxObject*);
+    void start_cycle();
+    void validate_candidates();
+    void finish_cycle();
+    void record_pause(double us);
+
+public:
+    static constexpr size_t SLICE_BYTES = 32 << 10;
+    static constexpr size_t MIN_NURSERY = 16 << 10;
+    static constexpr size_t MAX_NURSERY = 256 << 10;
+    static constexpr size_t PAUSE_BUCKETS = 18;
+
+    Nursery nursery;
+    size_t bytes = 0;
+    size_t count = 0;
+    // Live bytes allocated since the last collection
+    size_t young_bytes = 0;
+    size_t nursery_size = MAX_NURSERY;
+    size_t threshold = 1 << 20;
+    // Longest an incremental slice should run; 0 collects stop-the-world
+    uint32_t pause_budget_us = 0;
+    // Most bytes the nursery may hold live, set with --max-heap
+    size_t max_heap = SIZE_MAX;
+    // Over max_heap even after a full collection, or the memory backend had
+    // no block for the nursery; the interpreter raises an error at the next
+    // call, concatenation or loop back-edge
+    bool exhausted = false;
+    // The backend failed, as opposed to the heap going over max_heap
+    bool backend_failed = false;
+    uint32_t cycles = 0;
+    uint32_t minor_cycles = 0;
+    bool stress = false;
+    bool log = false;
+
+    struct Stats {
+        // Objects and bytes allocated, and the part of those bytes still
+        // alive when a minor collection promoted them
+        size_t objects = 0;
+        size_t allocated = 0;
+        size_t promoted = 0;
+        size_t since_minor = 0;
+        double minor_pause_us = 0;
+        double max_minor_pause_us = 0;
+        double major_pause_us = 0;
+        uint32_t slices = 0;
+        double max_slice_us = 0;
+        // Every pause by power of two microseconds: < 1, 1-2, 2-4, ...
+        uint32_t pauses[PAUSE_BUCKETS] {};
+    } stats;
+
+    constexpr Heap() = default;
+
+    void allocating(size_t size) {
+        if (this->nursery.live_bytes + size > this->max_heap) [[unlikely]] {
+            this->reached_limit(size);
+        }
+        if (this->stress) [[unlikely]] {
+            // Alternate so minor collections also run with an old generation
+            if (this->stress_ticks++ % 2 == 0) {
+                this->collect_young();
+            } else if (this->pause_budget_us) {
+                this->collect_slice();
+            } else {
+                this->collect();
+            }
+            return;
+        }
+        if (this->young_bytes + size > this->nursery_size) {
+            this->collect_young();
+        }
+        if (this->phase != Phase::IDLE) {
+            this->since_slice += size;
+            if (this->since_slice > SLICE_BYTES) {
+                this->collect_slice();
+            }
+        } else if (this->bytes + size > this->threshold || this->nursery.carved() > this->threshold) {
+            // Dead cycles hold nursery slots until they are collected
+            if (this->pause_budget_us) {
+                this->collect_slice();
+            } else {
+                this->collect();
+            }
+        }
+    }
+
+    // Call when `holder` is given a reference to `target`
+    void write_barrier(LoxObject* holder, const LoxObject* target) {
+        if (!holder->young && target->young && !holder->remembered) {
+            holder->remembered = true;
+            holder->remembered_index = static_cast<uint32_t>(this->remembered.size());
+            this->remembered.push_back(holder);
+        }
+        if (this->marking && !target->marked) {
+            this->shade(target);
+        }
+    }
+
+    void add(LoxObject*, size_t size);
+    void remove(LoxObject*);
+    // Charges an object for a buffer that grew or shrank after allocation
+    void resize(LoxObject*, size_t size);
+    void collect_young();
+    void collect();
+    // Starts an incremental cycle, or runs the current one for a slice
+    void collect_slice();
+    // Whether the heap went over max_heap or ran out of blocks; clears it, as
+    // the caller raises the error
+    bool out_of_memory() {
+        if (!this->exhausted) [[likely]] {
+            return false;
+        }
+        this->exhausted = false;
+        return true;
+    }
+    void print_stats() const;
+};
+
+extern constinit Heap heap;
+
+
+inline LoxObject::~LoxObject() {
+    heap.remove(this);
+}
+
+inline void* LoxObject::operator new(size_t size) {
+    return heap.nursery.allocate(size);
+}
+
+inline void LoxObject::operator delete(void* memory, size_t size) {
+    heap.nursery.free(memory, size);
+}
+
+
+// Standard allocator over the heap's size classes, for the containers inside
+// runtime objects
+template<typename T>
+struct PoolAllocator {
+    static_assert(alignof(T) <= Nursery::ALIGN);
+    using value_type = T;
+
+    PoolAllocator() = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(heap.nursery.allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* memory, size_t n) {
+        heap.nursery.free(memory, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+};
+
+
+// Owning pointer to a LoxObject
+template<typename T>
+class Ref {
+    T* ptr = nullptr;
+
+public:
+    Ref() = default;
+    Ref(std::nullptr_t) {}
+    explicit Ref(T* ptr): ptr{ptr} {
+        if (this->ptr) this->ptr->retain();
+    }
+    Ref(const Ref& other): Ref(other.ptr) {}
+    Ref(Ref&& other) noexcept: ptr{std::exchange(other.ptr, nullptr)} {}
+    template<typename U> requires std::convertible_to<U*, T*>
+    Ref(const Ref<U>& other): Ref(other.get()) {}
+    template<typename U> requires std::convertible_to<U*, T*>
+    Ref(Ref<U>&& other) noexcept: ptr{other.detach()} {}
+    ~Ref() {
+        if (this->ptr) this->ptr->release();
+    }
+
+    Ref& operator=(Ref other) noexcept {
+        std::swap(this->ptr, other.ptr);
+        return *this;
+    }
+
+    // Gives up ownership without touching the count
+    T* detach() { return std::exchange(this->ptr, nullptr); }
+
+    T* get() const { return this->ptr; }
+    T* operator->() const { return this->ptr; }
+    T& operator*() const { return *this->ptr; }
+    explicit operator bool() const { return this->ptr != nullptr; }
+    bool operator==(std::nullptr_t) const { return this->ptr == nullptr; }
+};
+
+
+// Bytes an object is charged for; types owning a buffer add its capacity
+template<typename T>
+size_t allocation_size(const T&) {
+    return sizeof(T);
+}
+
+template<typename T, typename... Args>
+Ref<T> make_ref(Args&&... args) {
+    static_assert(alignof(T) <= Nursery::ALIGN);
+    heap.allocating(sizeof(T));
+    T* object = new T(std::forward<Args>(args)...);
+    heap.add(object, allocation_size(*object));
+    return Ref<T>(object);
+}
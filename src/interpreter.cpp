@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <optional>
 #include "interpreter.hpp"
 #include "lox_callable.hpp"
@@ -6,53 +7,122 @@
 #include "lox_builtins.hpp"
 #include "lox.hpp"
 
+#if defined(__unix__)
+#include <sys/resource.h>
+#endif
 
-std::string stringify(const Object& v) {
-    return std::visit([](const auto& vs) -> std::string {
-        using T = std::decay_t<decltype(vs)>;
 
-        if constexpr (std::is_same_v<T, None>) {
+std::string stringify(const Object& v) {
+    switch (v.type()) {
+        case ValueType::NIL:
             return "nil";
-        } else if constexpr (std::is_same_v<T, Number>) {
-            std::string text = std::to_string(vs);
+        case ValueType::NUMBER: {
+            std::string text = std::to_string(v.as_number());
             if (text.ends_with(".0")) {
                 text = text.substr(0, text.length() - 2);
             }
             return text;
-        } else if constexpr (std::is_same_v<T, bool>) {
-            return vs ? "true" : "false";
-        } else if constexpr (std::is_same_v<T, String>) {
-            return *vs;
-        } else if constexpr (std::is_same_v<T, std::shared_ptr<LoxCallable>>) {
-            return vs->to_string();
-        } else if constexpr (std::is_same_v<T, std::shared_ptr<LoxInstance>>) {
-            return vs->to_string();
-        } else {
-            return "STRINGIFY ERROR: Invalid Token Value!";
         }
-    }, v);
+        case ValueType::BOOL:
+            return v.as_bool() ? "true" : "false";
+        case ValueType::STRING:
+            return std::string(v.as_string());
+        case ValueType::CALLABLE:
+            return v.as<LoxCallable>()->to_string();
+        case ValueType::INSTANCE:
+            return v.as<LoxInstance>()->to_string();
+    }
+    return "STRINGIFY ERROR: Invalid Token Value!";
+}
+
+
+bool are_numbers(const Object& left, const Object& right) {
+    return left.is_number() && right.is_number();
+}
+
+
+// Operand types a binary node specializes on the first time it runs
+Specialization specialize_binary(TokenType oper, const Object& left, const Object& right) {
+    using enum Specialization;
+    if (left.is_number() && right.is_number()) {
+        switch (oper) {
+            case TokenType::PLUS: return NUMBER_ADD;
+            case TokenType::MINUS: return NUMBER_SUBTRACT;
+            case TokenType::STAR: return NUMBER_MULTIPLY;
+            case TokenType::SLASH: return NUMBER_DIVIDE;
+            case TokenType::LESS: return NUMBER_LESS;
+            case TokenType::LESS_EQUAL: return NUMBER_LESS_EQUAL;
+            case TokenType::GREATER: return NUMBER_GREATER;
+            case TokenType::GREATER_EQUAL: return NUMBER_GREATER_EQUAL;
+            case TokenType::EQUAL_EQUAL: return NUMBER_EQUAL;
+            case TokenType::BANG_EQUAL: return NUMBER_NOT_EQUAL;
+            default: return GENERIC;
+        }
+    }
+    if (oper == TokenType::PLUS && left.is_string() && right.is_string()) {
+        return STRING_CONCAT;
+    }
+    return GENERIC;
 }
 
 
-std::optional<InterpreterError> check_number_operand(const Token& oper, const Object& operand) {
-    if (std::holds_alternative<double>(operand)) return std::nullopt;
-    return InterpreterError(InterpreterErrorType::MustBeNumbers, oper, "Operand must be a number.");
+// Runs a specialized binary node, or returns nullopt when its guard fails
+std::optional<Object> specialized_binary(Specialization specialization, const Object& left, const Object& right) {
+    using enum Specialization;
+    if (specialization == STRING_CONCAT) {
+        if (!left.is_string() || !right.is_string()) return std::nullopt;
+        return concat_strings(left, right);
+    }
+    if (!left.is_number() || !right.is_number()) return std::nullopt;
+    Number l = left.as_number();
+    Number r = right.as_number();
+    switch (specialization) {
+        case NUMBER_ADD: return l + r;
+        case NUMBER_SUBTRACT: return l - r;
+        case NUMBER_MULTIPLY: return l * r;
+        case NUMBER_DIVIDE: return l / r;
+        case NUMBER_LESS: return l < r;
+        case NUMBER_LESS_EQUAL: return l <= r;
+        case NUMBER_GREATER: return l > r;
+        case NUMBER_GREATER_EQUAL: return l >= r;
+        case NUMBER_EQUAL: return l == r;
+        case NUMBER_NOT_EQUAL: return l != r;
+        default: return std::nullopt;
+    }
 }
 
-std::optional<InterpreterError> check_number_operands(const Token& oper, const Object& left, const Object& right) {
-    if (std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) return std::nullopt;
-    return InterpreterError(InterpreterErrorType::MustBeNumbers, oper, "Operands must be numbers.");
-}
 
+namespace {
 
-Interpreter::Interpreter(): Interpreter(false) {}
-Interpreter::Interpreter(bool repl_mode): repl_mode{repl_mode} {
-    this->global_env = std::make_shared<Environment>();
-    this->global_env->define("clock", std::make_shared<ClockCallable>());
-    this->environment = this->global_env;
+// The lowest address calls may reach on a native stack that starts at `base`
+const char* native_stack_limit(const char* base) {
+    size_t size = 8 << 20;
+#if defined(__unix__)
+    rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        size = limit.rlim_cur;
+    }
+#endif
+    return base - (size - std::min(size / 2, Interpreter::NATIVE_SLACK));
 }
 
-std::optional<InterpreterSignal> Interpreter::visit_statement_node(const StatementNode& stmt) {
+}
+
+
+Interpreter::Interpreter(): Interpreter(false) {}
+Interpreter::Interpreter(bool repl_mode):
+    stack{std::make_unique<Object[]>(STACK_SLOTS)},
+    cells{std::make_unique<Ref<Upvalue>[]>(STACK_SLOTS)},
+    frame{this->stack.get(), this->cells.get(), nullptr},
+    top{this->stack.get()},
+    native_limit{native_stack_limit(static_cast<const char*>(__builtin_frame_address(0)))},
+    repl_mode{repl_mode}
+{
+    this->global_env = make_ref<Environment>();
+    this->global_env->define(this->global_env->slot(symbols.intern("clock")), make_ref<ClockCallable>());
+}
+
+Status Interpreter::visit_statement_node(const StatementNode& stmt) {
     using enum StatementType;
     switch (stmt.get_type()) {
         case PRINT: return this->visit_print_statement_node(*stmt.get_print_statement_node());
@@ -66,346 +136,422 @@ std::optional<InterpreterSignal> Interpreter::visit_statement_node(const Stateme
         case FUNCTION: return this->visit_function_declaration_node(*stmt.get_function_declaration_node());
         case CLASS: return this->visit_class_declaration_node(*stmt.get_class_declaration_node());
     }
-    return InterpreterError(InterpreterErrorType::Unimplemented, "Statement type not implemented");
+    return this->raise(InterpreterError(InterpreterErrorType::UnimplementedStatement));
 }
 
 
-std::optional<InterpreterSignal> Interpreter::visit_block_statement_node(const BlockStatementNode& block_stmt) {
-    auto env = std::make_shared<Environment>(this->environment);
-    return this->execute_block(block_stmt, env);
+Status Interpreter::visit_block_statement_node(const BlockStatementNode& block_stmt) {
+    return this->execute_block(block_stmt);
 }
 
 
-std::optional<InterpreterSignal> Interpreter::execute_block(const BlockStatementNode& block_stmt, std::shared_ptr<Environment> env) {
-    std::shared_ptr<Environment> enclosing = this->environment;
-    this->environment = env;
-    for (const auto& stmt : *block_stmt.stmts) {
-        auto res = this->execute(*stmt);
-        if (res.has_value()) {
-            this->environment = enclosing;
-            return res;
+Status Interpreter::execute_block(const BlockStatementNode& block_stmt) {
+    for (const auto& stmt : block_stmt.stmts) {
+        if (Status status = this->execute(*stmt); status != Status::OK) {
+            return status;
         }
     }
-    this->environment = enclosing;
-    return std::nullopt;
+    return Status::OK;
 }
 
 
-std::optional<InterpreterSignal> Interpreter::visit_print_statement_node(const PrintStatementNode& stmt) {
+Status Interpreter::visit_print_statement_node(const PrintStatementNode& stmt) {
     return this->print_expression(*stmt.expr);
 }
 
-std::optional<InterpreterSignal> Interpreter::print_expression(const ExpressionNode& expr) {
-    auto res = this->evaluate(expr);
-    if (!res.has_value()) {
-        return res.error();
+Status Interpreter::print_expression(const ExpressionNode& expr) {
+    if (Status status = this->evaluate(expr); status != Status::OK) {
+        return status;
     }
-    std::cout << stringify(res.value()) << '\n';
-    return std::nullopt;
+    std::cout << stringify(this->result) << '\n';
+    return Status::OK;
 }
 
 
-std::optional<InterpreterSignal> Interpreter::visit_expression_statement_node(const ExpressionStatementNode& stmt) {
-    if (auto res = this->evaluate(*stmt.expr); !res.has_value()) {
-        return res.error();
-    }
-    return std::nullopt;
+Status Interpreter::visit_expression_statement_node(const ExpressionStatementNode& stmt) {
+    return this->evaluate(*stmt.expr);
 }
 
 
-std::optional<InterpreterSignal> Interpreter::visit_variable_declaration_node(const VariableDeclarationNode& stmt) {
-    Object value = None();
-    if (stmt.initializer) {
-        auto res = evaluate(*stmt.initializer);
-        if (!res.has_value()) {
-            return res.error();
-        }
-        value = res.value();
+Status Interpreter::visit_variable_declaration_node(const VariableDeclarationNode& stmt) {
+    if (!stmt.initializer) {
+        this->define(stmt.variable, None());
+        return Status::OK;
     }
-    this->environment->define(stmt.name->lexeme, value);
-    return std::nullopt;
+    if (Status status = this->evaluate(*stmt.initializer); status != Status::OK) {
+        return status;
+    }
+    this->define(stmt.variable, std::move(this->result));
+    return Status::OK;
 }
 
 
-std::optional<InterpreterSignal> Interpreter::visit_if_statement_node(const IfStatementNode& stmt) {
-    auto condition = this->evaluate(*stmt.condition);
-    if (!condition.has_value()) {
-        return condition.error();
+Status Interpreter::visit_if_statement_node(const IfStatementNode& stmt) {
+    if (Status status = this->evaluate(*stmt.condition); status != Status::OK) {
+        return status;
     }
-    if (this->is_truthy(condition.value())) {
+    if (this->is_truthy(this->result)) {
         return this->visit_statement_node(*stmt.then_branch);
     }
     if (stmt.else_branch) {
         return this->visit_statement_node(*stmt.else_branch);
     }
 
-    return std::nullopt;
+    return Status::OK;
 }
 
 
-std::optional<InterpreterSignal> Interpreter::visit_while_statement_node(const WhileStatementNode& stmt) {
+Status Interpreter::visit_while_statement_node(const WhileStatementNode& stmt) {
     while (true) {
-        {
-            auto res = this->evaluate(*stmt.condition);
-            if (!res.has_value()) {
-                return res.error();
-            }
-            if (!this->is_truthy(res.value())) {
-                return std::nullopt;
-            }
+        if (this->tracer && this->tracer->enter(stmt) == TraceResult::LOOP_EXIT) {
+            return Status::OK;
         }
-        if (auto res = this->visit_statement_node(*stmt.body); res.has_value()) {
-            if (std::holds_alternative<BreakSignal>(res.value())) {
-                return std::nullopt;
-            }
-            return res;
+        if (Status status = this->evaluate(*stmt.condition); status != Status::OK) {
+            return status;
+        }
+        if (!this->is_truthy(this->result)) {
+            return Status::OK;
+        }
+        if (Status status = this->visit_statement_node(*stmt.body); status != Status::OK) {
+            return status == Status::BREAK ? Status::OK : status;
+        }
+        if (heap.out_of_memory()) [[unlikely]] {
+            return this->raise(InterpreterError(InterpreterErrorType::OutOfMemory, stmt.tk));
         }
-    } 
+    }
 }
 
 
-BreakSignal Interpreter::visit_break_statement_node(const BreakStatementNode&) const {
-    return BreakSignal{};
+Status Interpreter::visit_break_statement_node(const BreakStatementNode&) const {
+    return Status::BREAK;
 }
 
-InterpreterSignal Interpreter::visit_return_statement_node(const ReturnStatementNode& stmt) {
+Status Interpreter::visit_return_statement_node(const ReturnStatementNode& stmt) {
     if (!stmt.expr) {
-        return ReturnSignal{None()};
+        this->result = None();
+        return Status::RETURN;
     }
-    auto res = this->evaluate(*stmt.expr);
-    if (!res.has_value()) {
-        return res.error();
+    if (Status status = this->evaluate(*stmt.expr); status != Status::OK) {
+        return status;
     }
-    return ReturnSignal{res.value()};
+    return Status::RETURN;
 }
 
-std::optional<InterpreterSignal> Interpreter::visit_function_declaration_node(const FunctionDeclarationNode& func) {
-    this->environment->define(func.name->lexeme, None());
-    this->environment->assign(*func.name, std::make_shared<LoxFunction>(func, this->environment, false));
-    return std::nullopt;
+Status Interpreter::visit_function_declaration_node(const FunctionDeclarationNode& func) {
+    this->define_recursive(func.variable, [&] {
+        return this->make_function(func, false);
+    });
+    return Status::OK;
 }
 
 
-std::optional<InterpreterSignal> Interpreter::visit_class_declaration_node(const ClassDeclarationNode& class_) {
-    this->environment->define(class_.name->lexeme, None());
-    std::unordered_map<std::string, std::shared_ptr<LoxFunction>, string_hash, std::equal_to<>> methods;
-    for (auto& method : *class_.methods) {
-        methods[std::string(method->name->lexeme)] = std::make_shared<LoxFunction>(*method, this->environment, method->name->lexeme == "init");
-    }
-    this->environment->assign(*class_.name, std::make_shared<LoxClass>(class_.name->lexeme, std::move(methods)));
-    return std::nullopt;
+Status Interpreter::visit_class_declaration_node(const ClassDeclarationNode& class_) {
+    this->define_recursive(class_.variable, [&] {
+        MethodTable methods;
+        for (auto& method : class_.methods) {
+            methods[method->name.symbol] = this->make_function(*method, method->name.symbol == names::INIT);
+        }
+        return make_ref<LoxClass>(symbols.name(class_.name.symbol), std::move(methods));
+    });
+    return Status::OK;
 }
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_unary_expr(const UnaryNode& expr) {
-    auto right_exp = this->evaluate(*expr.operand);
-    if (!right_exp.has_value()) {
-        return right_exp;
+Status Interpreter::visit_unary_expr(const UnaryNode& expr) {
+    if (Status status = this->evaluate(*expr.operand); status != Status::OK) {
+        return status;
     }
-    auto right = right_exp.value();
-    switch (expr.oper->type) {
+    Object& right = this->result;
+    if (expr.specialization == Specialization::NUMBER_NEGATE) {
+        if (right.is_number()) {
+            right = -right.as_number();
+            return Status::OK;
+        }
+        expr.specialization = Specialization::GENERIC;
+    } else if (expr.specialization == Specialization::BOOL_NOT) {
+        if (right.is_bool()) {
+            right = !right.as_bool();
+            return Status::OK;
+        }
+        expr.specialization = Specialization::GENERIC;
+    } else if (expr.specialization == Specialization::UNINITIALIZED) {
+        if (expr.oper.type == TokenType::MINUS && right.is_number()) {
+            expr.specialization = Specialization::NUMBER_NEGATE;
+        } else if (expr.oper.type == TokenType::BANG && right.is_bool()) {
+            expr.specialization = Specialization::BOOL_NOT;
+        } else {
+            expr.specialization = Specialization::GENERIC;
+        }
+    }
+    switch (expr.oper.type) {
         case TokenType::MINUS:
-            return -std::get<double>(right);
+            right = -right.checked_number();
+            return Status::OK;
         case TokenType::BANG:
-            return !is_truthy(right);
+            right = !is_truthy(right);
+            return Status::OK;
         default:
             break;
     }
-    return std::unexpected(InterpreterError(InterpreterErrorType::Unimplemented, *expr.oper, "Unary operator not implemented"));
+    return this->raise(InterpreterError(InterpreterErrorType::UnimplementedOperator, expr.oper));
 }
 
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_binary_expr(const BinaryNode& expr) {
-    auto left_exp = this->evaluate(*expr.left);
-    if (!left_exp.has_value()) {
-        return left_exp;
+Status Interpreter::visit_binary_expr(const BinaryNode& expr) {
+    if (Status status = this->evaluate(*expr.left); status != Status::OK) {
+        return status;
+    }
+    Object left = std::move(this->result);
+    if (Status status = this->evaluate(*expr.right); status != Status::OK) {
+        return status;
     }
-    auto right_exp = this->evaluate(*expr.right);
-    if (!right_exp.has_value()) {
-        return right_exp;
+    const Object& right = this->result;
+
+    if (expr.specialization != Specialization::GENERIC) {
+        if (auto res = specialized_binary(expr.specialization, left, right); res.has_value()) {
+            this->result = std::move(res.value());
+            if (expr.specialization == Specialization::STRING_CONCAT && heap.out_of_memory()) [[unlikely]] {
+                return this->raise(InterpreterError(InterpreterErrorType::OutOfMemory, expr.oper));
+            }
+            return Status::OK;
+        }
+        // First run, or the guard failed: rewrite the node
+        expr.specialization = expr.specialization == Specialization::UNINITIALIZED
+            ? specialize_binary(expr.oper.type, left, right)
+            : Specialization::GENERIC;
     }
-    auto& left = left_exp.value();
-    auto& right = right_exp.value();
 
-    switch (expr.oper->type) {
+    switch (expr.oper.type) {
         case TokenType::MINUS: {
-            if (auto err = check_number_operands(*expr.oper, left, right); err.has_value()) {
-                return std::unexpected(err.value());
+            if (!are_numbers(left, right)) {
+                return this->raise(InterpreterError(InterpreterErrorType::MustBeNumbers, expr.oper));
             }
-            return std::get<double>(left) - std::get<double>(right);
+            this->result = left.as_number() - right.as_number();
+            return Status::OK;
         }
     
         case TokenType::PLUS: {
-            if (std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
-                return std::get<double>(left) + std::get<double>(right);
+            if (left.is_number() && right.is_number()) {
+                this->result = left.as_number() + right.as_number();
+                return Status::OK;
             } 
 
-            if (std::holds_alternative<String>(left) && std::holds_alternative<String>(right)) {
-                return std::make_shared<std::string>(*std::get<String>(left) + *std::get<String>(right));
+            if (left.is_string() && right.is_string()) {
+                this->result = concat_strings(left, right);
+                if (heap.out_of_memory()) [[unlikely]] {
+                    return this->raise(InterpreterError(InterpreterErrorType::OutOfMemory, expr.oper));
+                }
+                return Status::OK;
             }
 
-            return std::unexpected(InterpreterError(InterpreterErrorType::BinOpValuesNotCompatible, *expr.oper, "Binary operator values not compatible"));
+            return this->raise(InterpreterError(InterpreterErrorType::BinOpValuesNotCompatible, expr.oper));
         }
 
         case TokenType::SLASH: {
-            if (auto err = check_number_operands(*expr.oper, left, right); err.has_value()) {
-                return std::unexpected(err.value());
+            if (!are_numbers(left, right)) {
+                return this->raise(InterpreterError(InterpreterErrorType::MustBeNumbers, expr.oper));
             }
-            return std::get<double>(left) / std::get<double>(right);
+            this->result = left.as_number() / right.as_number();
+            return Status::OK;
         }
         case TokenType::STAR: {
-            if (auto err = check_number_operands(*expr.oper, left, right); err.has_value()) {
-                return std::unexpected(err.value());
+            if (!are_numbers(left, right)) {
+                return this->raise(InterpreterError(InterpreterErrorType::MustBeNumbers, expr.oper));
             }
-            return std::get<double>(left) * std::get<double>(right);
+            this->result = left.as_number() * right.as_number();
+            return Status::OK;
         }
         case TokenType::GREATER: {
-            if (auto err = check_number_operands(*expr.oper, left, right); err.has_value()) {
-                return std::unexpected(err.value());
+            if (!are_numbers(left, right)) {
+                return this->raise(InterpreterError(InterpreterErrorType::MustBeNumbers, expr.oper));
             }
-            return std::get<double>(left) > std::get<double>(right);
+            this->result = left.as_number() > right.as_number();
+            return Status::OK;
         }
         case TokenType::GREATER_EQUAL: {
-            if (auto err = check_number_operands(*expr.oper, left, right); err.has_value()) {
-                return std::unexpected(err.value());
+            if (!are_numbers(left, right)) {
+                return this->raise(InterpreterError(InterpreterErrorType::MustBeNumbers, expr.oper));
             }
-            return std::get<double>(left) >= std::get<double>(right);
+            this->result = left.as_number() >= right.as_number();
+            return Status::OK;
         }
         case TokenType::LESS: {
-            if (auto err = check_number_operands(*expr.oper, left, right); err.has_value()) {
-                return std::unexpected(err.value());
+            if (!are_numbers(left, right)) {
+                return this->raise(InterpreterError(InterpreterErrorType::MustBeNumbers, expr.oper));
             }
-            return std::get<double>(left) < std::get<double>(right);
+            this->result = left.as_number() < right.as_number();
+            return Status::OK;
         }
         case TokenType::LESS_EQUAL: {
-            if (auto err = check_number_operands(*expr.oper, left, right); err.has_value()) {
-                return std::unexpected(err.value());
+            if (!are_numbers(left, right)) {
+                return this->raise(InterpreterError(InterpreterErrorType::MustBeNumbers, expr.oper));
             }
-            return std::get<double>(left) <= std::get<double>(right);
+            this->result = left.as_number() <= right.as_number();
+            return Status::OK;
         }
 
-        case TokenType::BANG_EQUAL: return !this->is_equal(left, right);
-        case TokenType::EQUAL_EQUAL: return this->is_equal(left, right);
+        case TokenType::BANG_EQUAL: this->result = !this->is_equal(left, right); return Status::OK;
+        case TokenType::EQUAL_EQUAL: this->result = this->is_equal(left, right); return Status::OK;
 
         default:
             break;
     }
 
-    return std::unexpected(InterpreterError(InterpreterErrorType::Unimplemented, *expr.oper, "Binary operator not implemented"));
+    return this->raise(InterpreterError(InterpreterErrorType::UnimplementedOperator, expr.oper));
 }
 
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_variable_expr(const ExpressionNode& expr) {
+Status Interpreter::visit_variable_expr(const ExpressionNode& expr) {
     VariableNode& var_expr = *expr.get_variable_node();
-    return this->look_up_variable(*var_expr.name, &expr);
-    // return this->environment->get(*expr.name);
+    return this->look_up_variable(var_expr.name, var_expr.variable);
 }
 
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_assignment_expr(const ExpressionNode& expr) {
+Status Interpreter::visit_assignment_expr(const ExpressionNode& expr) {
     AssignmentNode& assign_node = *expr.get_assignment_node();
-    auto value = this->evaluate(*assign_node.expr);
-    if (!value.has_value()) {
-        return value;
+    if (Status status = this->evaluate(*assign_node.expr); status != Status::OK) {
+        return status;
     }
-    if (auto l = this->locals.find(&expr); l != this->locals.end()) {
-        if (auto err = this->environment->assign_at(l->second.depth, l->second.index, value.value()); err.has_value()) {
-            return std::unexpected(err.value());
-        }
-    } else {
-        if (auto err = this->global_env->assign(*assign_node.name, value.value()); err.has_value()) {
-            return std::unexpected(err.value());
-        }
+    if (assign_node.variable.kind != VariableKind::GLOBAL) {
+        this->assign_local(assign_node.variable, this->result);
+    } else if (auto err = this->global_env->assign(assign_node.variable.index, assign_node.name, this->result); err.has_value()) {
+        return this->raise(std::move(err.value()));
     }
-
-    return value;
+    return Status::OK;
 }
 
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_logical_expr(const LogicalNode& expr) {
-    auto left = this->evaluate(*expr.left);
+Status Interpreter::visit_logical_expr(const LogicalNode& expr) {
+    if (Status status = this->evaluate(*expr.left); status != Status::OK) {
+        return status;
+    }
 
-    if (expr.oper->type == TokenType::OR) {
-      if (this->is_truthy(left.value())) return left;
+    if (expr.oper.type == TokenType::OR) {
+      if (this->is_truthy(this->result)) return Status::OK;
     } else {
-      if (!this->is_truthy(left.value())) return left;
+      if (!this->is_truthy(this->result)) return Status::OK;
     }
     return evaluate(*expr.right);
 }
 
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_call_expr(const CallNode& expr) {
-    auto callee = this->evaluate(*expr.callee);
-    if (!callee.has_value()) {
-        return callee;
+Status Interpreter::visit_call_expr(const CallNode& expr) {
+    if (Status status = this->evaluate(*expr.callee); status != Status::OK) {
+        return status;
     }
+    return this->call_value(std::move(this->result), expr);
+}
 
-    std::vector<Object> arguments;
-    if (expr.args) {
-        for (const ExpressionNode* argument : *expr.args) {
-            auto res = evaluate(*argument);
-            if (!res.has_value()) {
-                return res;
-            }
-            arguments.push_back(res.value());
+
+Status Interpreter::call_value(Object callee, const CallNode& expr) {
+    Arguments arguments;
+    for (const ExpressionNode* argument : expr.args) {
+        if (Status status = this->evaluate(*argument); status != Status::OK) {
+            return status;
         }
+        arguments.push_back(std::move(this->result));
     }
 
-    auto function = std::get_if<std::shared_ptr<LoxCallable>>(&callee.value());
-    if (!function) {
-        return std::unexpected(InterpreterError(InterpreterErrorType::NotCallable, *expr.paren, "Can only call functions and classes"));
+    if (!callee.is_callable()) {
+        return this->raise(InterpreterError(InterpreterErrorType::NotCallable, expr.paren));
     }
-    if (arguments.size() != (*function)->arity()) {
-        return std::unexpected(InterpreterError(InterpreterErrorType::Arity, *expr.paren,
-            std::format("Expected {} arguments but got {}.", (*function)->arity(), arguments.size())
-        ));
+    LoxCallable* function = callee.as<LoxCallable>();
+    if (arguments.size() != function->arity()) {
+        return this->raise(InterpreterError(InterpreterErrorType::Arity, expr.paren, function->arity(), arguments.size()));
     }
-    auto res = (*function)->call(*this, arguments);
-    if (res.has_value()) {
-        if (std::holds_alternative<ReturnSignal>(res.value())) {
-            return std::get<ReturnSignal>(res.value()).value;
-        }
-        return std::unexpected(res.value());
+    if (heap.out_of_memory()) [[unlikely]] {
+        return this->raise(InterpreterError(InterpreterErrorType::OutOfMemory, expr.paren));
     }
-    return None();
+    return function->call(*this, arguments);
 }
 
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_get_expr(const GetNode& expr) {
-    auto obj = this->evaluate(*expr.object);
-    if (!obj.has_value()) {
-        return std::unexpected(obj.error());
+Status Interpreter::visit_get_expr(const GetNode& expr) {
+    if (Status status = this->evaluate(*expr.object); status != Status::OK) {
+        return status;
+    }
+    if (expr.specialization == Specialization::INSTANCE_FIELD) {
+        if (this->result.is_instance()) {
+            LoxInstance* instance = this->result.as<LoxInstance>();
+            if (auto field = instance->fields.find(expr.name.symbol); field != instance->fields.end()) {
+                this->result = field->second;
+                return Status::OK;
+            }
+        }
+        expr.specialization = Specialization::GENERIC;
+    }
+    if (!this->result.is_instance()) {
+        expr.specialization = Specialization::GENERIC;
+        return this->raise(InterpreterError(InterpreterErrorType::NotInstance, expr.name));
+    }
+    LoxInstance* instance = this->result.as<LoxInstance>();
+    if (expr.specialization == Specialization::UNINITIALIZED) {
+        expr.specialization = instance->fields.contains(expr.name.symbol) ? Specialization::INSTANCE_FIELD : Specialization::GENERIC;
+    }
+    return this->get_property(*instance, expr.name);
+}
+
+Status Interpreter::visit_set_expr(const SetNode& expr) {
+    if (Status status = this->evaluate(*expr.object); status != Status::OK) {
+        return status;
+    }
+    if (!this->result.is_instance()) {
+        return this->raise(InterpreterError(InterpreterErrorType::NotInstanceSet, expr.name));
     }
-    if (!std::holds_alternative<std::shared_ptr<LoxInstance>>(obj.value())) {
-        return std::unexpected(InterpreterError{InterpreterErrorType::NotInstance, *expr.name, "Only instances have properties"});
+    Object object = std::move(this->result);
+    if (Status status = this->evaluate(*expr.value); status != Status::OK) {
+        return status;
     }
-    return std::get<std::shared_ptr<LoxInstance>>(obj.value())->get(*expr.name);
+    object.as<LoxInstance>()->set(expr.name, this->result);
+    return Status::OK;
+}
+
+Status Interpreter::visit_this_expr(const ExpressionNode& expr) {
+    return this->look_up_variable(expr.get_this_node()->tk, expr.get_this_node()->variable);
 }
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_set_expr(const SetNode& expr) {
-    auto obj = this->evaluate(*expr.object);
-    if (!obj.has_value()) {
-        return obj;
+
+// Fused nodes fall back to their original nodes whenever the fast path
+// doesn't apply, which also takes care of reporting errors.
+Status Interpreter::visit_local_less_const_expr(const LocalLessConstNode& expr) {
+    if (const Object& local = this->frame.slots[expr.slot]; local.is_number()) {
+        this->result = local.as_number() < expr.constant;
+        return Status::OK;
     }
-    if (!std::holds_alternative<std::shared_ptr<LoxInstance>>(obj.value())) {
-        return std::unexpected(InterpreterError{InterpreterErrorType::NotInstance, *expr.name, "Only instances have fields"});
+    return this->evaluate(*expr.original);
+}
+
+
+Status Interpreter::visit_increment_local_expr(const IncrementLocalNode& expr) {
+    if (Object& local = this->frame.slots[expr.slot]; local.is_number()) {
+        local = local.as_number() + expr.constant;
+        this->result = local;
+        return Status::OK;
     }
-    auto val = this->evaluate(*expr.value);
-    if (!val.has_value()) {
-        return val;
+    return this->evaluate(*expr.original);
+}
+
+
+Status Interpreter::visit_this_get_expr(const ThisGetNode& expr) {
+    if (const Object& local = this->frame.slots[expr.slot]; local.is_instance()) {
+        return this->get_property(*local.as<LoxInstance>(), expr.name);
     }
-    std::get<std::shared_ptr<LoxInstance>>(obj.value())->set(*expr.name, val.value()); 
-    return val.value();
+    return this->evaluate(*expr.original);
 }
 
-std::expected<Object, InterpreterSignal> Interpreter::visit_this_expr(const ExpressionNode& expr) {
-    return this->look_up_variable(*expr.get_this_node()->tk, &expr);
+
+Status Interpreter::visit_call_global_expr(const CallGlobalNode& expr) {
+    Object* callee = this->global_env->find(expr.global);
+    if (!callee) {
+        return this->evaluate(*expr.original);
+    }
+    return this->call_value(*callee, *expr.call);
 }
 
 
-std::expected<Object, InterpreterSignal> Interpreter::evaluate(const ExpressionNode& expr) {
+Status Interpreter::evaluate(const ExpressionNode& expr) {
     using enum ExpressionType;
     switch (expr.get_type()) {
-        case LITERAL: return expr.get_literal_node()->value;
+        case LITERAL: this->result = *expr.get_literal_node()->value; return Status::OK;
         case BINARYOP: return this->visit_binary_expr(*expr.get_binary_node());
         case UNARYOP: return this->visit_unary_expr(*expr.get_unary_node());
         case VARIABLE: return this->visit_variable_expr(expr);
@@ -415,70 +561,149 @@ std::expected<Object, InterpreterSignal> Interpreter::evaluate(const ExpressionN
         case GET: return this->visit_get_expr(*expr.get_get_node());
         case SET: return this->visit_set_expr(*expr.get_set_node());
         case THIS: return this->visit_this_expr(expr);
+        case LOCAL_LESS_CONST: return this->visit_local_less_const_expr(*expr.get_local_less_const_node());
+        case INCREMENT_LOCAL: return this->visit_increment_local_expr(*expr.get_increment_local_node());
+        case THIS_GET: return this->visit_this_get_expr(*expr.get_this_get_node());
+        case CALL_GLOBAL: return this->visit_call_global_expr(*expr.get_call_global_node());
     }
 
-    return std::unexpected(InterpreterError(InterpreterErrorType::Unimplemented, "Expression type not implemented"));
+    return this->raise(InterpreterError(InterpreterErrorType::UnimplementedExpression));
 }
 
 
 bool Interpreter::is_truthy(const Object& v) const {
-    if (std::holds_alternative<None>(v)) return false;
-    if (std::holds_alternative<bool>(v)) return std::get<bool>(v);
-    if (std::holds_alternative<Number>(v)) return bool(std::get<Number>(v));
+    if (v.is_nil()) return false;
+    if (v.is_bool()) return v.as_bool();
+    if (v.is_number()) return bool(v.as_number());
     return true;
 }
 
 
 bool Interpreter::is_equal(const Object& a, const Object& b) const {
-    return std::visit([](const auto& lhs, const auto& rhs) -> bool {
-        using L = std::decay_t<decltype(lhs)>;
-        using R = std::decay_t<decltype(rhs)>;
-        if constexpr (std::is_same_v<L, R>) {
-            return lhs == rhs;
-        } else {
-            return false;
-        }
-    }, a, b);
+    return a.equals(b);
 }
 
 
 void Interpreter::interpret(const std::span<StatementNode*>& stmts) {
     for (const auto& stmt : stmts) {
-        if (repl_mode && stmt->get_type() == StatementType::EXPRESSION) {
-            if (auto res = this->print_expression(*stmt->get_expression_statement_node()->expr); res.has_value()) {
-                std::visit([](const auto& v) {
-                    using L = std::decay_t<decltype(v)>;
-                    if constexpr (std::is_same_v<L, InterpreterError>) {
-                        Lox::runtime_error(v);
-                    }
-                }, res.value());
-            }
-            continue;
-        }
-        auto res = this->execute(*stmt);
-        if (res.has_value()) {
-            std::visit([](const auto& v) {
-                using L = std::decay_t<decltype(v)>;
-                if constexpr (std::is_same_v<L, InterpreterError>) {
-                    Lox::runtime_error(v);
-                }
-            }, res.value());
+        Status status = repl_mode && stmt->get_type() == StatementType::EXPRESSION
+            ? this->print_expression(*stmt->get_expression_statement_node()->expr)
+            : this->execute(*stmt);
+        if (status == Status::ERROR) {
+            Lox::runtime_error(this->take_error());
         }
     }
 }
 
 
-std::optional<InterpreterSignal> Interpreter::execute(const StatementNode& stmt) {
+Status Interpreter::execute(const StatementNode& stmt) {
     return this->visit_statement_node(stmt);
 }
 
-void Interpreter::resolve(ExpressionNode* expr, int depth, int index) {
-    this->locals[expr] = LocalInfo{depth, index};
+
+InterpreterError Interpreter::take_error() {
+    InterpreterError error = std::move(this->error.value());
+    this->error.reset();
+    return error;
+}
+
+
+// Sets the result to a property of `instance`
+Status Interpreter::get_property(LoxInstance& instance, const Token& name) {
+    auto res = instance.get(name);
+    if (!res.has_value()) {
+        return this->raise(std::move(res.error()));
+    }
+    this->result = std::move(res.value());
+    return Status::OK;
 }
 
-std::expected<Object, InterpreterSignal> Interpreter::look_up_variable(Token& tk, const ExpressionNode * expr) {
-    if (auto l = this->locals.find(expr); l != this->locals.end()) {
-        return this->environment->get_at(l->second.depth, l->second.index);
+void Interpreter::reserve_script_slots(uint32_t slots) {
+    this->top = std::max(this->top, this->stack.get() + slots);
+}
+
+Status Interpreter::look_up_variable(const Token& tk, Resolution variable) {
+    if (variable.kind != VariableKind::GLOBAL) {
+        this->result = this->local(variable);
+        return Status::OK;
+    }
+    auto res = this->global_env->get(variable.index, tk);
+    if (!res.has_value()) {
+        return this->raise(std::move(res.error()));
+    }
+    this->result = std::move(res.value());
+    return Status::OK;
+}
+
+
+void Interpreter::define(Resolution variable, Object value) {
+    if (variable.kind == VariableKind::GLOBAL) {
+        this->global_env->define(variable.index, std::move(value));
+        return;
+    }
+    this->define_local(variable, std::move(value));
+}
+
+
+void Interpreter::define_local(Resolution variable, Object value) {
+    if (variable.kind == VariableKind::CELL) {
+        this->frame.cells[variable.index] = make_ref<Upvalue>(std::move(value));
+        return;
+    }
+    this->frame.slots[variable.index] = std::move(value);
+}
+
+
+void Interpreter::assign_local(Resolution variable, Object value) {
+    switch (variable.kind) {
+        case VariableKind::SLOT: this->frame.slots[variable.index] = std::move(value); break;
+        case VariableKind::CELL: this->frame.cells[variable.index]->set(std::move(value)); break;
+        default: this->frame.upvalues[variable.index]->set(std::move(value)); break;
+    }
+}
+
+
+Ref<LoxFunction> Interpreter::make_function(const FunctionDeclarationNode& declaration, bool is_initializer) {
+    Upvalues upvalues;
+    upvalues.reserve(declaration.captures.size());
+    for (const Capture& capture : declaration.captures) {
+        upvalues.push_back(capture.local ? this->frame.cells[capture.index] : this->frame.upvalues[capture.index]);
+    }
+    return make_ref<LoxFunction>(declaration, std::move(upvalues), is_initializer);
+}
+
+
+std::expected<Frame, InterpreterError> Interpreter::push_frame(const LoxFunction& function, std::span<Object> arguments) {
+    const FunctionDeclarationNode& declaration = *function.declaration;
+    if (this->depth == MAX_DEPTH || static_cast<const char*>(__builtin_frame_address(0)) < this->native_limit
+        || declaration.slots > static_cast<size_t>(this->stack.get() + STACK_SLOTS - this->top)) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::StackOverflow, declaration.name));
+    }
+    Frame caller = this->frame;
+    const size_t base = this->top - this->stack.get();
+    this->frame = Frame{this->top, this->cells.get() + base, function.upvalues.data()};
+    this->top += declaration.slots;
+    this->depth++;
+
+    auto binding = declaration.arguments.begin();
+    if (declaration.arguments.size() > arguments.size()) {
+        this->define_local(*binding++, function.receiver);
+    }
+    for (Object& argument : arguments) {
+        this->define_local(*binding++, std::move(argument));
+    }
+    return caller;
+}
+
+
+void Interpreter::pop_frame(const Frame& caller) {
+    const size_t base = this->frame.slots - this->stack.get();
+    const size_t end = this->top - this->stack.get();
+    for (size_t i = base; i < end; i++) {
+        this->stack[i] = None();
+        this->cells[i] = nullptr;
     }
-    return this->global_env->get(tk);
+    this->top = this->frame.slots;
+    this->frame = caller;
+    this->depth--;
 }
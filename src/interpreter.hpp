@@ -2,6 +2,7 @@
 
 #include <optional>
 #include <expected>
+#include <memory>
 #include <span>
 #include "node.hpp"
 #include "token.hpp"
@@ -15,57 +16,143 @@ struct ReturnSignal {
 
 using InterpreterSignal = std::variant<InterpreterError, BreakSignal, ReturnSignal>;
 
-struct LocalInfo {
-    int depth;
-    int index;
+// How the tree-walker finished running a statement or evaluating an
+// expression. Nothing else travels on the return path: the value of an
+// expression, or of a `return` being unwound, is left in Interpreter::result,
+// and an error is only built when one is raised, into Interpreter::error.
+enum class Status : uint8_t {
+    OK,
+    BREAK,
+    RETURN,
+    ERROR,
 };
 
-struct Interpreter {
-    std::shared_ptr<Environment> global_env;
-    std::shared_ptr<Environment> environment;
+std::string stringify(const Object&);
+
+struct Jit;
+struct Tracer;
+struct LoxInstance;
+class LoxFunction;
+
+// A call's window onto the value stack: its locals, the cells of those that
+// are captured, and the upvalues of the function running in it
+struct Frame {
+    Object* slots = nullptr;
+    Ref<Upvalue>* cells = nullptr;
+    const Ref<Upvalue>* upvalues = nullptr;
+};
 
-    std::unordered_map<const ExpressionNode*, LocalInfo> locals;
+struct Interpreter {
+    static constexpr size_t STACK_SLOTS = 1 << 16;
+    // Every engine recurses on the native stack for each Lox call, so calls
+    // nest at most MAX_DEPTH deep, and never past `native_limit`, which
+    // leaves room below it for the expressions the last call evaluates
+    static constexpr size_t MAX_DEPTH = 1 << 11;
+    static constexpr size_t NATIVE_SLACK = 512 << 10;
+
+    Ref<Environment> global_env;
+    // Frames sit one after another; `top` is the first slot past the current
+    // one. The script's own frame sits at the bottom.
+    std::unique_ptr<Object[]> stack;
+    std::unique_ptr<Ref<Upvalue>[]> cells;
+    Frame frame;
+    Object* top;
+    // Calls currently running
+    size_t depth = 0;
+    const char* native_limit;
+
+    // The value of the expression just evaluated, or of the `return` being
+    // unwound
+    Object result;
+    // Set when an error is raised, until it is reported or taken
+    std::optional<InterpreterError> error;
 
     bool repl_mode = false;
+    Jit* jit = nullptr;
+    Tracer* tracer = nullptr;
 
     Interpreter();
     explicit Interpreter(bool);
 
-    [[nodiscard]] std::optional<InterpreterSignal> execute(const StatementNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> execute_block(const BlockStatementNode&, std::shared_ptr<Environment>);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> evaluate(const ExpressionNode&);
-
-    [[nodiscard]] std::optional<InterpreterSignal> visit_statement_node(const StatementNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_print_statement_node(const PrintStatementNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_expression_statement_node(const ExpressionStatementNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_variable_declaration_node(const VariableDeclarationNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_block_statement_node(const BlockStatementNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_if_statement_node(const IfStatementNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_while_statement_node(const WhileStatementNode&);
-    [[nodiscard]] BreakSignal visit_break_statement_node(const BreakStatementNode&) const;
-    [[nodiscard]] InterpreterSignal visit_return_statement_node(const ReturnStatementNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_function_declaration_node(const FunctionDeclarationNode&);
-    [[nodiscard]] std::optional<InterpreterSignal> visit_class_declaration_node(const ClassDeclarationNode&);
-
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_unary_expr(const UnaryNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_binary_expr(const BinaryNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_variable_expr(const ExpressionNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_assignment_expr(const ExpressionNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_logical_expr(const LogicalNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_call_expr(const CallNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_get_expr(const GetNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_set_expr(const SetNode&);
-    [[nodiscard]] std::expected<Object, InterpreterSignal> visit_this_expr(const ExpressionNode&);
-
-    [[nodiscard]] std::optional<InterpreterSignal> print_expression(const ExpressionNode&);
+    [[nodiscard]] Status execute(const StatementNode&);
+    [[nodiscard]] Status execute_block(const BlockStatementNode&);
+    [[nodiscard]] Status evaluate(const ExpressionNode&);
+
+    [[nodiscard]] Status visit_statement_node(const StatementNode&);
+    [[nodiscard]] Status visit_print_statement_node(const PrintStatementNode&);
+    [[nodiscard]] Status visit_expression_statement_node(const ExpressionStatementNode&);
+    [[nodiscard]] Status visit_variable_declaration_node(const VariableDeclarationNode&);
+    [[nodiscard]] Status visit_block_statement_node(const BlockStatementNode&);
+    [[nodiscard]] Status visit_if_statement_node(const IfStatementNode&);
+    [[nodiscard]] Status visit_while_statement_node(const WhileStatementNode&);
+    [[nodiscard]] Status visit_break_statement_node(const BreakStatementNode&) const;
+    [[nodiscard]] Status visit_return_statement_node(const ReturnStatementNode&);
+    [[nodiscard]] Status visit_function_declaration_node(const FunctionDeclarationNode&);
+    [[nodiscard]] Status visit_class_declaration_node(const ClassDeclarationNode&);
+
+    [[nodiscard]] Status visit_unary_expr(const UnaryNode&);
+    [[nodiscard]] Status visit_binary_expr(const BinaryNode&);
+    [[nodiscard]] Status visit_variable_expr(const ExpressionNode&);
+    [[nodiscard]] Status visit_assignment_expr(const ExpressionNode&);
+    [[nodiscard]] Status visit_logical_expr(const LogicalNode&);
+    [[nodiscard]] Status visit_call_expr(const CallNode&);
+    [[nodiscard]] Status visit_get_expr(const GetNode&);
+    [[nodiscard]] Status visit_set_expr(const SetNode&);
+    [[nodiscard]] Status visit_this_expr(const ExpressionNode&);
+    [[nodiscard]] Status visit_local_less_const_expr(const LocalLessConstNode&);
+    [[nodiscard]] Status visit_increment_local_expr(const IncrementLocalNode&);
+    [[nodiscard]] Status visit_this_get_expr(const ThisGetNode&);
+    [[nodiscard]] Status visit_call_global_expr(const CallGlobalNode&);
+
+    [[nodiscard]] Status call_value(Object callee, const CallNode&);
+
+    [[nodiscard]] Status print_expression(const ExpressionNode&);
 
     bool is_truthy(const Object&) const;
     bool is_equal(const Object&, const Object&) const;
 
     void interpret(const std::span<StatementNode*>&);
 
-    void resolve(ExpressionNode*, int, int);
-
-    std::expected<Object, InterpreterSignal> look_up_variable(Token&, const ExpressionNode*);
+    Status raise(InterpreterError error) {
+        this->error.emplace(std::move(error));
+        return Status::ERROR;
+    }
+    InterpreterError take_error();
+
+    void reserve_script_slots(uint32_t);
+
+    [[nodiscard]] Status look_up_variable(const Token&, Resolution);
+    [[nodiscard]] Status get_property(LoxInstance&, const Token&);
+
+    // A local of the current frame, or one of its function's upvalues
+    Object& local(Resolution variable) const {
+        switch (variable.kind) {
+            case VariableKind::SLOT: return this->frame.slots[variable.index];
+            case VariableKind::CELL: return this->frame.cells[variable.index]->value;
+            default: return this->frame.upvalues[variable.index]->value;
+        }
+    }
+
+    void define(Resolution, Object);
+    void define_local(Resolution, Object);
+    void assign_local(Resolution, Object);
+    Ref<LoxFunction> make_function(const FunctionDeclarationNode&, bool is_initializer);
+
+    // Defines a function or class. If a closure inside it captures its name,
+    // the cell has to exist before `make` creates that closure.
+    template <typename Make>
+    void define_recursive(Resolution variable, Make&& make) {
+        if (variable.kind != VariableKind::CELL) {
+            this->define(variable, make());
+            return;
+        }
+        this->define_local(variable, None());
+        this->frame.cells[variable.index]->set(make());
+    }
+
+    // Enters a frame for `function` with its receiver and arguments bound,
+    // returning the caller's frame to hand back to pop_frame
+    std::expected<Frame, InterpreterError> push_frame(const LoxFunction&, std::span<Object> arguments);
+    void pop_frame(const Frame& caller);
 
 };
@@ -0,0 +1,416 @@
+#include <cstring>
+#include "jit.hpp"
+#include "lox_callable.hpp"
+
+#if defined(__x86_64__) && defined(__unix__)
+#define LOX_JIT_AVAILABLE
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+enum class Cond : uint8_t {
+    B = 0x82,
+    AE = 0x83,
+    E = 0x84,
+    NE = 0x85,
+    BE = 0x86,
+    A = 0x87,
+    P = 0x8a,
+};
+
+
+// Just enough of an x86-64 encoder for scalar double arithmetic. rdi holds
+// the slot array and rsi the result pointer for the whole function.
+struct X64Assembler {
+    std::vector<uint8_t> code;
+    std::vector<int64_t> labels;
+    std::vector<std::pair<size_t, size_t>> fixups; // (rel32 offset, label)
+
+    void bytes(std::initializer_list<uint8_t> bs) { this->code.insert(this->code.end(), bs); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) this->code.push_back(static_cast<uint8_t>(v >> (8 * i))); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; i++) this->code.push_back(static_cast<uint8_t>(v >> (8 * i))); }
+
+    size_t new_label() {
+        this->labels.push_back(-1);
+        return this->labels.size() - 1;
+    }
+    void bind(size_t label) { this->labels[label] = static_cast<int64_t>(this->code.size()); }
+
+    void jmp(size_t label) {
+        this->bytes({0xe9});
+        this->fixups.emplace_back(this->code.size(), label);
+        this->u32(0);
+    }
+    void jcc(Cond cond, size_t label) {
+        this->bytes({0x0f, std::to_underlying(cond)});
+        this->fixups.emplace_back(this->code.size(), label);
+        this->u32(0);
+    }
+
+    // movsd xmm0, [rdi + 8 * slot]
+    void load_slot(uint32_t slot) { this->bytes({0xf2, 0x0f, 0x10, 0x87}); this->u32(slot * 8); }
+    // movsd [rdi + 8 * slot], xmm0
+    void store_slot(uint32_t slot) { this->bytes({0xf2, 0x0f, 0x11, 0x87}); this->u32(slot * 8); }
+    // mov rax, imm64; movq xmm0, rax
+    void load_constant(double v) {
+        uint64_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        this->bytes({0x48, 0xb8});
+        this->u64(bits);
+        this->bytes({0x66, 0x48, 0x0f, 0x6e, 0xc0});
+    }
+    // sub rsp, 8; movsd [rsp], xmm0
+    void push_xmm0() { this->bytes({0x48, 0x83, 0xec, 0x08, 0xf2, 0x0f, 0x11, 0x04, 0x24}); }
+    // movapd xmm1, xmm0; movsd xmm0, [rsp]; add rsp, 8
+    void pop_left() { this->bytes({0x66, 0x0f, 0x28, 0xc8, 0xf2, 0x0f, 0x10, 0x04, 0x24, 0x48, 0x83, 0xc4, 0x08}); }
+
+    void addsd() { this->bytes({0xf2, 0x0f, 0x58, 0xc1}); }
+    void subsd() { this->bytes({0xf2, 0x0f, 0x5c, 0xc1}); }
+    void mulsd() { this->bytes({0xf2, 0x0f, 0x59, 0xc1}); }
+    void divsd() { this->bytes({0xf2, 0x0f, 0x5e, 0xc1}); }
+    // mov rax, sign bit; movq xmm1, rax; xorpd xmm0, xmm1
+    void negate() {
+        this->bytes({0x48, 0xb8});
+        this->u64(0x8000000000000000ull);
+        this->bytes({0x66, 0x48, 0x0f, 0x6e, 0xc8, 0x66, 0x0f, 0x57, 0xc1});
+    }
+    // xorpd xmm1, xmm1
+    void zero_xmm1() { this->bytes({0x66, 0x0f, 0x57, 0xc9}); }
+    // ucomisd xmm0, xmm1
+    void compare_left_right() { this->bytes({0x66, 0x0f, 0x2e, 0xc1}); }
+    // ucomisd xmm1, xmm0
+    void compare_right_left() { this->bytes({0x66, 0x0f, 0x2e, 0xc8}); }
+
+    // movsd [rsi], xmm0; mov eax, 1; ret
+    void return_value() { this->bytes({0xf2, 0x0f, 0x11, 0x06, 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3}); }
+    // xor eax, eax; ret
+    void return_nil() { this->bytes({0x31, 0xc0, 0xc3}); }
+
+    void finish() {
+        for (auto [offset, label] : this->fixups) {
+            auto rel = static_cast<int32_t>(this->labels[label] - static_cast<int64_t>(offset + 4));
+            std::memcpy(this->code.data() + offset, &rel, sizeof(rel));
+        }
+    }
+};
+
+
+struct JitCompiler {
+    X64Assembler as;
+    std::vector<size_t> loop_exits;
+
+    // Native slots mirror the frame slots the resolver assigned. Anything
+    // else is a global or lives in a cell, which native code can't reach.
+    std::optional<uint32_t> slot_of(const ExpressionNode& expr) const {
+        Resolution variable = expr.get_variable();
+        if (variable.kind != VariableKind::SLOT) {
+            return std::nullopt;
+        }
+        return variable.index;
+    }
+
+    bool statements(std::span<StatementNode* const> stmts) {
+        for (const auto& stmt : stmts) {
+            if (!this->statement(*stmt)) return false;
+        }
+        return true;
+    }
+
+    bool statement(const StatementNode& stmt) {
+        switch (stmt.get_type()) {
+            case StatementType::EXPRESSION:
+                return this->number(*stmt.get_expression_statement_node()->expr);
+            case StatementType::VARIABLE: {
+                const VariableDeclarationNode& var_dec = *stmt.get_variable_statement_node();
+                // Without an initializer the variable would hold nil
+                if (!var_dec.initializer || var_dec.variable.kind != VariableKind::SLOT || !this->number(*var_dec.initializer)) return false;
+                this->as.store_slot(var_dec.variable.index);
+                return true;
+            }
+            case StatementType::BLOCK:
+                return this->statements(stmt.get_block_statement_node()->stmts);
+            case StatementType::IF: {
+                const IfStatementNode& if_stmt = *stmt.get_if_statement_node();
+                size_t else_label = this->as.new_label();
+                size_t end_label = this->as.new_label();
+                if (!this->condition(*if_stmt.condition, false, else_label)) return false;
+                if (!this->statement(*if_stmt.then_branch)) return false;
+                this->as.jmp(end_label);
+                this->as.bind(else_label);
+                if (if_stmt.else_branch && !this->statement(*if_stmt.else_branch)) return false;
+                this->as.bind(end_label);
+                return true;
+            }
+            case StatementType::WHILE: {
+                const WhileStatementNode& while_stmt = *stmt.get_while_statement_node();
+                size_t start_label = this->as.new_label();
+                size_t end_label = this->as.new_label();
+                this->as.bind(start_label);
+                if (!this->condition(*while_stmt.condition, false, end_label)) return false;
+                this->loop_exits.push_back(end_label);
+                bool ok = this->statement(*while_stmt.body);
+                this->loop_exits.pop_back();
+                if (!ok) return false;
+                this->as.jmp(start_label);
+                this->as.bind(end_label);
+                return true;
+            }
+            case StatementType::BREAK: {
+                if (this->loop_exits.empty()) return false;
+                this->as.jmp(this->loop_exits.back());
+                return true;
+            }
+            case StatementType::RETURN: {
+                const ReturnStatementNode& ret = *stmt.get_return_statement_node();
+                if (!ret.expr) {
+                    this->as.return_nil();
+                    return true;
+                }
+                if (!this->number(*ret.expr)) return false;
+                this->as.return_value();
+                return true;
+            }
+            case StatementType::PRINT:
+            case StatementType::FUNCTION:
+            case StatementType::CLASS:
+                return false;
+        }
+        return false;
+    }
+
+    // Emits code leaving a number in xmm0
+    bool number(const ExpressionNode& expr) {
+        if (auto original = expr.get_original()) {
+            return this->number(*original);
+        }
+        switch (expr.get_type()) {
+            case ExpressionType::LITERAL: {
+                const Object& n = *expr.get_literal_node()->value;
+                if (!n.is_number()) return false;
+                this->as.load_constant(n.as_number());
+                return true;
+            }
+            case ExpressionType::VARIABLE: {
+                auto slot = this->slot_of(expr);
+                if (!slot.has_value()) return false;
+                this->as.load_slot(slot.value());
+                return true;
+            }
+            case ExpressionType::ASSIGNMENT: {
+                auto slot = this->slot_of(expr);
+                if (!slot.has_value() || !this->number(*expr.get_assignment_node()->expr)) return false;
+                this->as.store_slot(slot.value());
+                return true;
+            }
+            case ExpressionType::UNARYOP: {
+                const UnaryNode& unary = *expr.get_unary_node();
+                if (unary.oper.type != TokenType::MINUS || !this->number(*unary.operand)) return false;
+                this->as.negate();
+                return true;
+            }
+            case ExpressionType::BINARYOP: {
+                const BinaryNode& bin = *expr.get_binary_node();
+                switch (bin.oper.type) {
+                    case TokenType::PLUS:
+                    case TokenType::MINUS:
+                    case TokenType::STAR:
+                    case TokenType::SLASH:
+                        break;
+                    default:
+                        return false;
+                }
+                if (!this->operands(bin)) return false;
+                switch (bin.oper.type) {
+                    case TokenType::PLUS: this->as.addsd(); break;
+                    case TokenType::MINUS: this->as.subsd(); break;
+                    case TokenType::STAR: this->as.mulsd(); break;
+                    default: this->as.divsd(); break;
+                }
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+    // Leaves the left operand in xmm0 and the right one in xmm1
+    bool operands(const BinaryNode& bin) {
+        if (!this->number(*bin.left)) return false;
+        this->as.push_xmm0();
+        if (!this->number(*bin.right)) return false;
+        this->as.pop_left();
+        return true;
+    }
+
+    // Jumps to `label` when the truthiness of `expr` equals `jump_if`
+    bool condition(const ExpressionNode& expr, bool jump_if, size_t label) {
+        if (auto original = expr.get_original()) {
+            return this->condition(*original, jump_if, label);
+        }
+        switch (expr.get_type()) {
+            case ExpressionType::LITERAL: {
+                const Object& value = *expr.get_literal_node()->value;
+                if (value.is_bool()) {
+                    if (value.as_bool() == jump_if) this->as.jmp(label);
+                    return true;
+                }
+                if (value.is_nil()) {
+                    if (!jump_if) this->as.jmp(label);
+                    return true;
+                }
+                break;
+            }
+            case ExpressionType::UNARYOP: {
+                const UnaryNode& unary = *expr.get_unary_node();
+                if (unary.oper.type == TokenType::BANG) {
+                    return this->condition(*unary.operand, !jump_if, label);
+                }
+                break;
+            }
+            case ExpressionType::LOGICAL: {
+                const LogicalNode& logical = *expr.get_logical_node();
+                bool is_or = logical.oper.type == TokenType::OR;
+                // `a or b` jumps on true as soon as a is true, `a and b` jumps on false as soon as a is false
+                if (jump_if == is_or) {
+                    return this->condition(*logical.left, jump_if, label) && this->condition(*logical.right, jump_if, label);
+                }
+                size_t skip = this->as.new_label();
+                if (!this->condition(*logical.left, is_or, skip)) return false;
+                if (!this->condition(*logical.right, jump_if, label)) return false;
+                this->as.bind(skip);
+                return true;
+            }
+            case ExpressionType::BINARYOP: {
+                const BinaryNode& bin = *expr.get_binary_node();
+                switch (bin.oper.type) {
+                    case TokenType::LESS:
+                    case TokenType::LESS_EQUAL:
+                        if (!this->operands(bin)) return false;
+                        this->as.compare_right_left();
+                        this->as.jcc(bin.oper.type == TokenType::LESS ? (jump_if ? Cond::A : Cond::BE) : (jump_if ? Cond::AE : Cond::B), label);
+                        return true;
+                    case TokenType::GREATER:
+                    case TokenType::GREATER_EQUAL:
+                        if (!this->operands(bin)) return false;
+                        this->as.compare_left_right();
+                        this->as.jcc(bin.oper.type == TokenType::GREATER ? (jump_if ? Cond::A : Cond::BE) : (jump_if ? Cond::AE : Cond::B), label);
+                        return true;
+                    case TokenType::EQUAL_EQUAL:
+                    case TokenType::BANG_EQUAL:
+                        if (!this->operands(bin)) return false;
+                        this->not_equal(bin.oper.type == TokenType::BANG_EQUAL ? jump_if : !jump_if, label);
+                        return true;
+                    default:
+                        break;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        // Any other number is truthy unless it is zero
+        if (!this->number(expr)) return false;
+        this->as.zero_xmm1();
+        this->not_equal(jump_if, label);
+        return true;
+    }
+
+    // After comparing xmm0 with xmm1, jump when (xmm0 != xmm1) == jump_if.
+    // Unordered operands compare not equal, like `double` in the interpreter.
+    void not_equal(bool jump_if, size_t label) {
+        this->as.compare_left_right();
+        if (jump_if) {
+            this->as.jcc(Cond::P, label);
+            this->as.jcc(Cond::NE, label);
+        } else {
+            size_t skip = this->as.new_label();
+            this->as.jcc(Cond::P, skip);
+            this->as.jcc(Cond::E, label);
+            this->as.bind(skip);
+        }
+    }
+};
+
+}
+
+
+Jit::~Jit() {
+#ifdef LOX_JIT_AVAILABLE
+    for (auto& [_, function] : this->functions) {
+        if (function.region) {
+            munmap(function.region, function.region_size);
+        }
+    }
+#endif
+}
+
+
+std::optional<Object> Jit::call(const LoxFunction& function, const Arguments& arguments) {
+    if (function.is_initializer) {
+        return std::nullopt;
+    }
+    JitFunction& entry = this->functions[function.declaration];
+    if (entry.state == JitState::COUNTING) {
+        if (++entry.calls < this->threshold) {
+            return std::nullopt;
+        }
+        entry.state = this->compile(*function.declaration, entry) ? JitState::COMPILED : JitState::UNSUPPORTED;
+    }
+    if (entry.state != JitState::COMPILED) {
+        return std::nullopt;
+    }
+
+    // Compiled code assumes every parameter is a number
+    std::vector<double> slots(entry.slots);
+    for (size_t i = 0; i < arguments.size(); i++) {
+        if (!arguments[i].is_number()) {
+            return std::nullopt;
+        }
+        slots[i] = arguments[i].as_number();
+    }
+    double result = 0;
+    if (entry.code(slots.data(), &result)) {
+        return result;
+    }
+    return None();
+}
+
+
+bool Jit::compile([[maybe_unused]] const FunctionDeclarationNode& func, [[maybe_unused]] JitFunction& entry) {
+#ifdef LOX_JIT_AVAILABLE
+    // Methods take `this` ahead of the parameters, which can't be a number
+    if (func.arguments.size() != func.params.size()) {
+        return false;
+    }
+    JitCompiler compiler {};
+    if (!compiler.statements(func.body->stmts)) {
+        return false;
+    }
+    compiler.as.return_nil();
+    compiler.as.finish();
+
+    const auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (compiler.as.code.size() + page - 1) / page * page;
+    void* region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return false;
+    }
+    std::memcpy(region, compiler.as.code.data(), compiler.as.code.size());
+    if (mprotect(region, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(region, size);
+        return false;
+    }
+
+    entry.region = region;
+    entry.region_size = size;
+    entry.code = reinterpret_cast<JitCode>(region);
+    entry.slots = std::max<size_t>(func.slots, 1);
+    return true;
+#else
+    return false;
+#endif
+}
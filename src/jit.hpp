@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <unordered_map>
+#include "node.hpp"
+#include "interpreter.hpp"
+
+class LoxFunction;
+
+// Native entry point: slots holds parameters followed by locals, result
+// receives the return value. Returns 1 when a value was returned, 0 for nil.
+using JitCode = int (*)(double* slots, double* result);
+
+enum class JitState {
+    COUNTING,
+    COMPILED,
+    UNSUPPORTED,
+};
+
+struct JitFunction {
+    uint32_t calls = 0;
+    JitState state = JitState::COUNTING;
+    JitCode code = nullptr;
+    size_t slots = 0;
+    void* region = nullptr;
+    size_t region_size = 0;
+};
+
+// Baseline template JIT for the tree-walker. Once a function declaration has
+// been called `threshold` times its body is translated to x86-64 machine code,
+// provided every value in it is a number: parameters, locals, literals and
+// arithmetic, with comparisons only used as conditions. Anything else (calls,
+// globals, strings, closures, printing) leaves the function interpreted.
+struct Jit {
+    uint32_t threshold = 100;
+    std::unordered_map<const FunctionDeclarationNode*, JitFunction> functions;
+
+    Jit() = default;
+    ~Jit();
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // Runs the native version of the function, or returns nullopt if the
+    // caller should interpret it.
+    [[nodiscard]] std::optional<Object> call(const LoxFunction&, const Arguments&);
+
+    [[nodiscard]] bool compile(const FunctionDeclarationNode&, JitFunction&);
+};
@@ -5,11 +5,19 @@
 #include <fstream>
 #include <cstdint>
 #include <optional>
+#include <charconv>
+#include <format>
 #include "lox.hpp"
 #include "scanner.hpp"
 #include "parser.hpp"
 #include "interpreter.hpp"
 #include "resolver.hpp"
+#include "specialization.hpp"
+#include "fuser.hpp"
+#include "node_pairs.hpp"
+#include "cpp_emitter.hpp"
+#include "gc.hpp"
+#include "memory.hpp"
 
 std::optional<std::string> read_file_to_string(const std::string& filename) {
     std::ifstream file(filename, std::ios::in | std::ios::binary);  // binary avoids newline conversion on Windows
@@ -35,40 +43,121 @@ void Lox::error(int line, std::string_view message) {
 
 void Lox::error(const Token& token, std::string_view message) {
     Lox::had_error = true;
+    uint32_t line = Lox::program->line(token);
     if (token.type == TokenType::END_OF_FILE) {
-        report(token.line, " at end", message);
+        report(line, " at end", message);
     } else {
         std::string where = " at '";
-        where += token.lexeme;
+        where += Lox::program->text(token);
         where += "'";
-        report(token.line, where, message);
+        report(line, where, message);
     }
 }
 
+std::string error_message(const InterpreterError& error) {
+    using enum InterpreterErrorType;
+    switch (error.type) {
+        case UnimplementedStatement: return "Statement type not implemented";
+        case UnimplementedExpression: return "Expression type not implemented";
+        case UnimplementedOperator: return "Operator not implemented";
+        case NotCompiled: return "Function was not compiled";
+        case BinOpValuesNotCompatible: return "Binary operator values not compatible";
+        case MustBeNumbers: return "Operands must be numbers.";
+        case UndefinedVariable: return std::format("Undefined variable '{}'.", symbols.name(error.operand));
+        case NotCallable: return "Can only call functions and classes";
+        case Arity: return std::format("Expected {} arguments but got {}.", error.operand, error.count);
+        case NotInstance: return "Only instances have properties";
+        case NotInstanceSet: return "Only instances have fields";
+        case UndefinedProperty: return std::format("Undefined property '{}'.", symbols.name(error.operand));
+        case StackOverflow: return "Stack overflow.";
+        case OutOfMemory:
+            if (heap.backend_failed) return "Out of memory.";
+            return std::format("Out of memory: over {} bytes live.", heap.max_heap);
+    }
+    return "Unknown error";
+}
+
 void Lox::runtime_error(const InterpreterError& error) {
     Lox::had_runtime_error = true;
-    std::cout << error.msg << "\n[line " << error.where.line << "]\n";
+    std::cout << error_message(error) << "\n[line " << Lox::program->line(error.where) << "]\n";
 }
 
 
 void Lox::run(std::string source) const {
-    Program program;
+    auto owner = std::make_unique<Program>();
+    Program& program = *owner;
     program.source = std::move(source);
-    Scanner scanner {program.source, program.tokens};
-    program.tokens = scanner.scan();
+    Lox::program = &program;
+    Scanner scanner {program};
+    scanner.scan();
+#ifdef LOX_FLAT_AST
+    if (this->engine == Engine::TREE) {
+        this->run_flat(program);
+        return;
+    }
+#endif
     Parser parser {program};
     parser.parse();
+    program.release_tokens();
 
     // Stop if there was a syntax error.
     if (had_error) return;
 
-    Resolver resolver {Lox::interpreter};
+    Resolver resolver {Lox::interpreter, program.allocator};
     resolver.resolve(program.statements);
 
     // Stop if there was a resolution error.
     if (had_error) return;
 
-    Lox::interpreter.interpret(program.statements);
+    // Functions and classes declared on one REPL line are called from later
+    // ones, so every line's AST stays alive for the session
+    if (Lox::interpreter.repl_mode) {
+        Lox::repl_lines.push_back(std::move(owner));
+    }
+
+    switch (this->engine) {
+        case Engine::TREE:
+            Fuser{program.allocator}.fuse(program.statements);
+            Lox::interpreter.interpret(program.statements);
+            break;
+        case Engine::VM: Lox::vm.interpret(program.statements); break;
+        case Engine::CLOSURE: Lox::closure_compiler.interpret(program.statements); break;
+    }
+
+    if (this->dump_specializations) {
+        ::dump_specializations(program, std::cerr);
+    }
+}
+
+
+// The flat core never holds the whole pointer tree: each top-level statement
+// is parsed, resolved and flattened on its own, and the arena is reset before
+// the next one, so only the flat program is left by the time the script runs.
+// Statements after a syntax error are still parsed, to report every syntax
+// error, but no longer resolved.
+void Lox::run_flat(Program& program) const {
+    Parser parser {program};
+    Resolver resolver {Lox::interpreter, program.allocator};
+    FlatBuilder builder {Lox::flat_interpreter.program};
+    std::vector<uint32_t> statements;
+    bool parsed = true;
+    while (!parser.is_at_end()) {
+        StatementNode* stmt = parser.parse_declaration();
+        parsed = parsed && stmt;
+        if (parsed) {
+            resolver.resolve(*stmt);
+            if (!had_error) {
+                statements.push_back(builder.flatten(*stmt));
+            }
+        }
+        program.allocator.reset();
+    }
+    program.release_tokens();
+
+    // Stop if there was a syntax or resolution error.
+    if (had_error) return;
+
+    Lox::flat_interpreter.interpret(statements);
 }
 
 
@@ -86,6 +175,67 @@ int Lox::run_file(const std::string& file) const {
 }
 
 
+int Lox::count_node_pairs(const std::vector<std::string>& files) const {
+    NodePairCounter counter;
+    for (const auto& file : files) {
+        auto file_content = read_file_to_string(file);
+        if (!file_content.has_value()) {
+            std::cout << "Could not open file " << file << '\n';
+            return 60;
+        }
+        Program program;
+        program.source = std::move(file_content.value());
+        Lox::program = &program;
+        Scanner scanner {program};
+        scanner.scan();
+        Parser parser {program};
+        parser.parse();
+        program.release_tokens();
+        if (had_error) return 65;
+
+        Resolver resolver {Lox::interpreter, program.allocator};
+        resolver.resolve(program.statements);
+        if (had_error) return 65;
+
+        counter.count(program);
+    }
+    counter.print(std::cout);
+    return 0;
+}
+
+
+int Lox::emit_cpp(const std::string& file, const std::string& out) const {
+    auto file_content = read_file_to_string(file);
+    if (!file_content.has_value()) {
+        std::cout << "Could not open file " << file << '\n';
+        return 60;
+    }
+    Program program;
+    program.source = std::move(file_content.value());
+    Lox::program = &program;
+    Scanner scanner {program};
+    scanner.scan();
+    Parser parser {program};
+    parser.parse();
+    program.release_tokens();
+    if (had_error) return 65;
+
+    Resolver resolver {Lox::interpreter, program.allocator};
+    resolver.resolve(program.statements);
+    if (had_error) return 65;
+
+    auto code = CppEmitter{Lox::interpreter}.emit(program.statements);
+    if (!code.has_value()) return 65;
+
+    std::ofstream output(out, std::ios::out | std::ios::binary);
+    if (!(output << code.value())) {
+        std::cout << "Could not write file " << out << '\n';
+        return 74;
+    }
+    return 0;
+}
+
+
 void Lox::run_prompt() const {
     Lox::interpreter.repl_mode = true;
     std::string line;
@@ -96,6 +246,7 @@ void Lox::run_prompt() const {
             break; // EOF or error
         }
         run(line);
+        Lox::tracer.loops.clear();
         Lox::had_error = false;
         Lox::had_runtime_error = false;
         std::cout << '\n';
@@ -103,21 +254,144 @@ void Lox::run_prompt() const {
 }
 
 
+std::optional<Engine> parse_engine(std::string_view name) {
+    if (name == "tree") return Engine::TREE;
+    if (name == "vm") return Engine::VM;
+    if (name == "closure") return Engine::CLOSURE;
+    return std::nullopt;
+}
+
+
+// A byte count with an optional K, M or G suffix
+std::optional<size_t> parse_size(std::string_view text) {
+    size_t size = 0;
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), size);
+    if (ec != std::errc() || size == 0) return std::nullopt;
+    std::string_view suffix(ptr, text.data() + text.size());
+    int shift = suffix == "" ? 0 : suffix == "K" ? 10 : suffix == "M" ? 20 : suffix == "G" ? 30 : -1;
+    if (shift < 0 || size > (SIZE_MAX >> shift)) return std::nullopt;
+    return size << shift;
+}
+
+
 int main(int argc, char** argv) {
-    if (argc > 2) {
-        std::cout << "usage: " << argv[0] << " [script]\n";
+    Lox lox {};
+    std::vector<std::string> scripts;
+    bool trace_stats = false;
+    bool gc_stats = false;
+    bool node_pairs = false;
+    bool usage = false;
+    std::optional<std::string> emit_cpp;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--engine=")) {
+            auto engine = parse_engine(arg.substr(std::string_view("--engine=").size()));
+            if (!engine.has_value()) {
+                std::cout << "Unknown engine '" << arg.substr(std::string_view("--engine=").size()) << "'\n";
+                return -1;
+            }
+            lox.engine = engine.value();
+        } else if (arg == "--jit") {
+            Lox::interpreter.jit = &Lox::jit;
+        } else if (arg == "--gc-stress") {
+            heap.stress = true;
+        } else if (arg == "--gc-log") {
+            heap.log = true;
+        } else if (arg == "--gc-stats") {
+            gc_stats = true;
+        } else if (arg == "--node-pairs") {
+            node_pairs = true;
+        } else if (arg == "--emit-cpp") {
+            if (i + 1 == argc) {
+                usage = true;
+                break;
+            }
+            emit_cpp = argv[++i];
+        } else if (arg == "--dump-specializations") {
+            lox.dump_specializations = true;
+        } else if (arg == "--trace" || arg == "--trace-stats") {
+            Lox::interpreter.tracer = &Lox::tracer;
+            trace_stats = trace_stats || arg == "--trace-stats";
+        } else if (arg.starts_with("--gc-pause-budget-us=")) {
+            auto value = arg.substr(std::string_view("--gc-pause-budget-us=").size());
+            uint32_t budget = 0;
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), budget);
+            if (ec != std::errc() || ptr != value.data() + value.size() || budget == 0) {
+                std::cout << "Invalid GC pause budget '" << value << "'\n";
+                return -1;
+            }
+            heap.pause_budget_us = budget;
+        } else if (arg.starts_with("--max-heap=")) {
+            auto value = arg.substr(std::string_view("--max-heap=").size());
+            auto size = parse_size(value);
+            if (!size.has_value()) {
+                std::cout << "Invalid heap size '" << value << "'\n";
+                return -1;
+            }
+            heap.max_heap = size.value();
+        } else if (arg.starts_with("--memory=")) {
+            auto value = arg.substr(std::string_view("--memory=").size());
+            if (!memory.use(value)) {
+                std::cout << "Unknown memory backend '" << value << "'\n";
+                return -1;
+            }
+        } else if (arg.starts_with("--jit-threshold=")) {
+            auto value = arg.substr(std::string_view("--jit-threshold=").size());
+            uint32_t threshold = 0;
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), threshold);
+            if (ec != std::errc() || ptr != value.data() + value.size() || threshold == 0) {
+                std::cout << "Invalid JIT threshold '" << value << "'\n";
+                return -1;
+            }
+            Lox::jit.threshold = threshold;
+        } else if (!arg.starts_with("--")) {
+            scripts.emplace_back(arg);
+        } else {
+            usage = true;
+        }
+    }
+    // --node-pairs takes any number of scripts, --emit-cpp exactly one,
+    // everything else at most one
+    if (usage || (node_pairs ? scripts.empty() : scripts.size() > 1) || (emit_cpp && (node_pairs || scripts.empty()))) {
+        std::cout << "usage: " << argv[0] << " [--engine=tree|vm|closure] [--jit] [--jit-threshold=N] [--trace] [--trace-stats] [--dump-specializations] [--gc-stress] [--gc-log] [--gc-stats] [--gc-pause-budget-us=N] [--max-heap=SIZE] [--memory=mmap|malloc] [script]\n"
+                  << "       " << argv[0] << " --node-pairs script...\n"
+                  << "       " << argv[0] << " --emit-cpp out.cpp script\n";
         return -1;
     }
-    Lox lox {};
-    if (argc == 2) {
-        return lox.run_file(argv[1]);
+#ifdef LOX_FLAT_AST
+    // The flat core has no JIT, tracer or self-specializing nodes
+    if (lox.engine == Engine::TREE && (Lox::interpreter.jit || Lox::interpreter.tracer || lox.dump_specializations)) {
+        std::cout << "--jit, --trace and --dump-specializations need the pointer tree, and this build runs the tree engine on the flat AST\n";
+        return -1;
+    }
+#endif
+    int status = 0;
+    if (node_pairs) {
+        status = lox.count_node_pairs(scripts);
+    } else if (emit_cpp) {
+        status = lox.emit_cpp(scripts.front(), emit_cpp.value());
+    } else if (!scripts.empty()) {
+        status = lox.run_file(scripts.front());
     } else {
         lox.run_prompt();
     }
-    return 0;
+    if (trace_stats) {
+        Lox::tracer.print_stats();
+    }
+    if (gc_stats) {
+        heap.print_stats();
+    }
+    return status;
 }
 
 
 bool Lox::had_error = false;
 bool Lox::had_runtime_error = false;
 Interpreter Lox::interpreter {};
+std::vector<std::unique_ptr<Program>> Lox::repl_lines {};
+const Program* Lox::program = nullptr;
+VM Lox::vm {Lox::interpreter};
+ClosureCompiler Lox::closure_compiler {Lox::interpreter};
+FlatInterpreter Lox::flat_interpreter {Lox::interpreter};
+Jit Lox::jit {};
+Tracer Lox::tracer {Lox::interpreter};
@@ -2,11 +2,33 @@
 
 #include <string>
 #include <string_view>
+#include <memory>
+#include <vector>
 #include "token.hpp"
 #include "interpreter.hpp"
+#include "vm.hpp"
+#include "closure_compiler.hpp"
+#include "flat_interpreter.hpp"
+#include "jit.hpp"
+#include "tracer.hpp"
+
+enum class Engine {
+    TREE,
+    VM,
+    CLOSURE,
+};
 
 struct Lox {
     static Interpreter interpreter;
+    static VM vm;
+    static ClosureCompiler closure_compiler;
+    static FlatInterpreter flat_interpreter;
+    static Jit jit;
+    static Tracer tracer;
+    static std::vector<std::unique_ptr<Program>> repl_lines;
+    // The program being compiled or run, whose source and line table errors
+    // are reported against
+    static const Program* program;
     static bool had_error;
     static bool had_runtime_error;
 
@@ -14,9 +36,17 @@ struct Lox {
     static void error(const Token& token, std::string_view message);
     static void runtime_error(const InterpreterError& error);
 
+    Engine engine = Engine::TREE;
+    bool dump_specializations = false;
+
     void run(std::string program) const;
+    void run_flat(Program&) const;
 
     int run_file(const std::string& file) const;
 
+    int count_node_pairs(const std::vector<std::string>& files) const;
+
+    int emit_cpp(const std::string& file, const std::string& out) const;
+
     void run_prompt() const;
 };
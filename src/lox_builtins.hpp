@@ -9,9 +9,10 @@ class ClockCallable: public LoxCallable {
 public:
     size_t arity() { return 0; }
 
-    std::optional<InterpreterSignal> call(Interpreter&, std::vector<Object>&) {
+    Status call(Interpreter& interpreter, Arguments&) {
         auto t = std::chrono::system_clock::now();
-        return ReturnSignal(Object{std::chrono::duration_cast<std::chrono::duration<double>>(t.time_since_epoch()).count()});
+        interpreter.result = Object(std::chrono::duration_cast<std::chrono::duration<double>>(t.time_since_epoch()).count());
+        return Status::OK;
     }
 
     std::string to_string() { return "<native fn>"; }
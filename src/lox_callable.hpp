@@ -1,58 +1,80 @@
 #pragma once
 
+#include <format>
 #include "node.hpp"
 #include "interpreter.hpp"
+#include "jit.hpp"
 
 
-class LoxCallable {
+class LoxCallable: public LoxObject {
 public:
     virtual size_t arity() = 0;
-    virtual std::optional<InterpreterSignal> call(Interpreter&, std::vector<Object>&) = 0;
+    // Leaves the return value in interpreter.result
+    virtual Status call(Interpreter&, Arguments&) = 0;
     virtual std::string to_string() = 0;
     virtual ~LoxCallable() = default;
 };
 
 
+// The cells a closure captured, in a buffer from the heap's size classes
+using Upvalues = std::vector<Ref<Upvalue>, PoolAllocator<Ref<Upvalue>>>;
+
+
 class LoxFunction: public LoxCallable {
 public:
     const FunctionDeclarationNode* declaration;
-    std::shared_ptr<Environment> closure;
+    Upvalues upvalues;
+    Object receiver;  // `this`, once bound
     bool is_initializer;
-    LoxFunction(const FunctionDeclarationNode& declaration, std::shared_ptr<Environment> closure, bool is_initializer):
-        declaration{&declaration}, closure{closure}, is_initializer{is_initializer} {}
+    LoxFunction(const FunctionDeclarationNode& declaration, Upvalues upvalues, bool is_initializer, Object receiver = None()):
+        declaration{&declaration}, upvalues{std::move(upvalues)}, receiver{std::move(receiver)}, is_initializer{is_initializer} {}
 
     size_t arity() {
-        return this->declaration->params->size();
+        return this->declaration->params.size();
     }
 
-    std::optional<InterpreterSignal> call(Interpreter& interpreter, std::vector<Object>& arguments) {
-        auto environment = std::make_shared<Environment>(this->closure);
-        for (size_t i = 0; i < this->declaration->params->size(); i++) {
-            environment->define(this->declaration->params->at(i)->lexeme, arguments[i]);
+    Status call(Interpreter& interpreter, Arguments& arguments) {
+        if (interpreter.jit) {
+            if (auto value = interpreter.jit->call(*this, arguments); value.has_value()) {
+                interpreter.result = std::move(value.value());
+                return Status::OK;
+            }
         }
-
-        auto ret = interpreter.execute_block(*this->declaration->body, environment);
-        if (ret.has_value() && std::holds_alternative<InterpreterError>(ret.value())) {
-            return ret.value();
+        auto caller = interpreter.push_frame(*this, arguments);
+        if (!caller.has_value()) {
+            return interpreter.raise(std::move(caller.error()));
+        }
+        Status status = interpreter.execute_block(*this->declaration->body);
+        interpreter.pop_frame(caller.value());
+        if (status == Status::ERROR) {
+            return status;
         }
         if (this->is_initializer) {
-            auto res = this->closure->get_at(0, 0);
-            if (!res.has_value()) {
-                return res.error();
-            }
-            return ReturnSignal{res.value()};
+            interpreter.result = this->receiver;
+        } else if (status != Status::RETURN) {
+            interpreter.result = None();
         }
-        return ret;
+        return Status::OK;
     }
 
     std::string to_string() {
-        return "<fn " + std::string(this->declaration->name->lexeme) + ">";
+        return std::format("<fn {}>", symbols.name(this->declaration->name.symbol));
+    }
+
+    Ref<LoxFunction> bind(Object instance) {
+        return make_ref<LoxFunction>(*this->declaration, this->upvalues, this->is_initializer, std::move(instance));
+    }
+
+    void trace(GcVisitor& visitor) const override {
+        for (const auto& upvalue : this->upvalues) {
+            visitor.visit(upvalue.get());
+        }
+        ::trace(visitor, this->receiver);
     }
 
-    std::shared_ptr<LoxFunction> bind(std::shared_ptr<LoxInstance> instance) {
-        auto env = std::make_shared<Environment>(this->closure);
-        env->define("this", instance);
-        return std::make_shared<LoxFunction>(*this->declaration, env, this->is_initializer);
+    void clear() override {
+        this->upvalues.clear();
+        this->receiver = None();
     }
 
 };
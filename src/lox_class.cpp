@@ -1,33 +1,46 @@
 #include "lox_class.hpp"
 #include "lox_instance.hpp"
 
-LoxClass::LoxClass(std::string_view name, std::unordered_map<std::string, std::shared_ptr<LoxFunction>, string_hash, std::equal_to<>> methods): name{name}, methods{std::move(methods)} {}
+LoxClass::LoxClass(std::string_view name, MethodTable methods): name{name}, methods{std::move(methods)} {}
 
 std::string LoxClass::to_string() {
     return std::string(this->name);
 }
 
-std::optional<InterpreterSignal> LoxClass::call(Interpreter& interpreter, std::vector<Object>& arguments) {
-    auto inst = std::make_shared<LoxInstance>(this);
-    auto x = this->find_method("init");
+Status LoxClass::call(Interpreter& interpreter, Arguments& arguments) {
+    auto inst = make_ref<LoxInstance>(this);
+    auto x = this->find_method(names::INIT);
     if (x) {
         return x->bind(inst)->call(interpreter, arguments);
     }
-    return ReturnSignal{inst};
+    interpreter.result = std::move(inst);
+    return Status::OK;
 }
 
 size_t LoxClass::arity() {
-    auto x = this->find_method("init");
+    auto x = this->find_method(names::INIT);
     if (x) {
         return x->arity();
     }
     return 0;
 }
 
-std::shared_ptr<LoxFunction> LoxClass::find_method(std::string_view name) {
+Ref<LoxFunction> LoxClass::find_method(Symbol name) {
     auto method = this->methods.find(name);
     if (method == this->methods.end()) {
         return nullptr;
     }
     return method->second;
 }
+
+
+void LoxClass::trace(GcVisitor& visitor) const {
+    for (const auto& [_, method] : this->methods) {
+        visitor.visit(method.get());
+    }
+}
+
+
+void LoxClass::clear() {
+    this->methods.clear();
+}
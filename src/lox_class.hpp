@@ -5,21 +5,26 @@
 #include <string>
 #include <string_view>
 #include "lox_callable.hpp"
-#include "string_hash.hpp"
 
 struct LoxInstance;
 
+using MethodTable = std::unordered_map<Symbol, Ref<LoxFunction>, std::hash<Symbol>, std::equal_to<Symbol>,
+                                       PoolAllocator<std::pair<const Symbol, Ref<LoxFunction>>>>;
+
 struct LoxClass: public LoxCallable {
     std::string_view name;
-    std::unordered_map<std::string, std::shared_ptr<LoxFunction>, string_hash, std::equal_to<>> methods;
+    MethodTable methods;
 
-    LoxClass(std::string_view, std::unordered_map<std::string, std::shared_ptr<LoxFunction>, string_hash, std::equal_to<>>);
+    LoxClass(std::string_view, MethodTable);
 
     std::string to_string();
 
-    std::optional<InterpreterSignal> call(Interpreter&, std::vector<Object>&);
+    Status call(Interpreter&, Arguments&);
 
     size_t arity();
 
-    std::shared_ptr<LoxFunction> find_method(std::string_view);
+    Ref<LoxFunction> find_method(Symbol);
+
+    void trace(GcVisitor&) const override;
+    void clear() override;
 };
@@ -2,11 +2,13 @@
 
 #include <string>
 #include "lox_class.hpp"
-#include "string_hash.hpp"
 
-struct LoxInstance: std::enable_shared_from_this<LoxInstance> {
-    LoxClass* class_;
-    std::unordered_map<std::string, Object, string_hash, std::equal_to<>> fields;
+using FieldTable = std::unordered_map<Symbol, Object, std::hash<Symbol>, std::equal_to<Symbol>,
+                                      PoolAllocator<std::pair<const Symbol, Object>>>;
+
+struct LoxInstance: LoxObject {
+    Ref<LoxClass> class_;
+    FieldTable fields;
 
     LoxInstance(LoxClass* class_): class_{class_} {}
 
@@ -15,21 +17,29 @@ struct LoxInstance: std::enable_shared_from_this<LoxInstance> {
     }
 
     std::expected<Object, InterpreterError> get(const Token& name) {
-        if (auto val = this->fields.find(name.lexeme); val != this->fields.end()) {
+        if (auto val = this->fields.find(name.symbol); val != this->fields.end()) {
             return val->second;
         }
-        if (auto method = this->class_->find_method(name.lexeme); method != nullptr) {
-            return method->bind(this->shared_from_this());
+        if (auto method = this->class_->find_method(name.symbol); method != nullptr) {
+            return method->bind(Object(this));
         }
-        return std::unexpected(InterpreterError{InterpreterErrorType::UndefinedProperty, name, "Undefined property '" + std::string(name.lexeme) + "'."});
+        return std::unexpected(InterpreterError(InterpreterErrorType::UndefinedProperty, name));
     }
 
-    void set(const Token& name, Object value) {
-        auto val = this->fields.find(name.lexeme);
-        if (val == this->fields.end()) {
-            this->fields[std::string(name.lexeme)] = std::move(value);
-        } else {
-            val->second = std::move(value);
+    void trace(GcVisitor& visitor) const override {
+        if (this->class_) visitor.visit(this->class_.get());
+        for (const auto& [_, value] : this->fields) {
+            ::trace(visitor, value);
         }
     }
+
+    void clear() override {
+        this->class_ = nullptr;
+        this->fields.clear();
+    }
+
+    void set(const Token& name, Object value) {
+        write_barrier(*this, value);
+        this->fields[name.symbol] = std::move(value);
+    }
 };
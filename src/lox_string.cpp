@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <vector>
+#include "value.hpp"
+
+
+LoxString::LoxString(Ref<LoxString> left, Ref<LoxString> right):
+    left{std::move(left)}, right{std::move(right)},
+    length{this->left->length + this->right->length},
+    height{std::max(this->left->height, this->right->height) + 1} {}
+
+
+void LoxString::flatten() const {
+    Text text;
+    text.reserve(this->length);
+    // Iterative, so a rope left unbalanced by flattening parts of it can't
+    // overflow the stack
+    std::vector<const LoxString*> stack {this};
+    while (!stack.empty()) {
+        const LoxString* s = stack.back();
+        stack.pop_back();
+        if (s->height == 0) {
+            text += s->value;
+        } else {
+            stack.push_back(s->right.get());
+            stack.push_back(s->left.get());
+        }
+    }
+    this->value = std::move(text);
+    this->height = 0;
+    this->left = nullptr;
+    this->right = nullptr;
+    heap.resize(const_cast<LoxString*>(this), allocation_size(*this));
+}
+
+
+namespace {
+
+uint32_t height(const Ref<LoxString>& s) {
+    return s->height;
+}
+
+Ref<LoxString> node(Ref<LoxString> left, Ref<LoxString> right) {
+    return make_ref<LoxString>(std::move(left), std::move(right));
+}
+
+// Joins two ropes whose heights differ by at most two, rotating once if
+// needed so they end up differing by at most one
+Ref<LoxString> balanced(Ref<LoxString> left, Ref<LoxString> right) {
+    if (height(right) > height(left) + 1) {
+        if (height(right->left) <= height(right->right)) {
+            return node(node(std::move(left), right->left), right->right);
+        }
+        const Ref<LoxString>& middle = right->left;
+        return node(node(std::move(left), middle->left), node(middle->right, right->right));
+    }
+    if (height(left) > height(right) + 1) {
+        if (height(left->right) <= height(left->left)) {
+            return node(left->left, node(left->right, std::move(right)));
+        }
+        const Ref<LoxString>& middle = left->right;
+        return node(node(left->left, middle->left), node(middle->right, std::move(right)));
+    }
+    return node(std::move(left), std::move(right));
+}
+
+// AVL join: descend the taller rope's inner spine to a subtree the shorter
+// one can be paired with, and rebalance on the way back up
+Ref<LoxString> join(const Ref<LoxString>& a, const Ref<LoxString>& b) {
+    if (height(a) > height(b) + 1) {
+        return balanced(a->left, join(a->right, b));
+    }
+    if (height(b) > height(a) + 1) {
+        return balanced(join(a, b->left), b->right);
+    }
+    return node(a, b);
+}
+
+}
+
+
+Value concat_strings(const Value& a, const Value& b) {
+    const LoxString* left = a.as<LoxString>();
+    const LoxString* right = b.as<LoxString>();
+    if (left->length + right->length < LoxString::SHORT) {
+        LoxString::Text text;
+        text.reserve(left->length + right->length);
+        text += left->text();
+        text += right->text();
+        return make_string(std::move(text));
+    }
+    return join(Ref<LoxString>(const_cast<LoxString*>(left)), Ref<LoxString>(const_cast<LoxString*>(right)));
+}
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include "memory.hpp"
+
+#if defined(__unix__)
+#define LOX_MMAP_AVAILABLE
+#include <sys/mman.h>
+#endif
+
+
+namespace {
+
+constinit MallocBackend malloc_backend;
+#ifdef LOX_MMAP_AVAILABLE
+constinit MmapBackend mmap_backend;
+#endif
+
+}
+
+#ifdef LOX_MMAP_AVAILABLE
+constinit Memory memory {&mmap_backend, "mmap"};
+#else
+constinit Memory memory {&malloc_backend, "malloc"};
+#endif
+
+
+void* MallocBackend::map(size_t size) {
+    return std::aligned_alloc(Memory::PAGE, Memory::pages(size));
+}
+
+
+void MallocBackend::unmap(void* block, size_t) {
+    std::free(block);
+}
+
+
+#ifdef LOX_MMAP_AVAILABLE
+void* MmapBackend::map(size_t size) {
+    if (size < HUGE_PAGE) {
+        void* block = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return block == MAP_FAILED ? nullptr : block;
+    }
+    // Over-map by a huge page and trim both ends, so the block starts on a
+    // huge page boundary the kernel can back with one
+    size_t span = size + HUGE_PAGE;
+    void* region = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return nullptr;
+    }
+    auto start = reinterpret_cast<uintptr_t>(region);
+    uintptr_t aligned = (start + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    size_t end = Memory::pages(size);
+    if (aligned > start) {
+        munmap(region, aligned - start);
+    }
+    if (start + span > aligned + end) {
+        munmap(reinterpret_cast<void*>(aligned + end), start + span - aligned - end);
+    }
+    void* block = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(block, end, MADV_HUGEPAGE);
+#endif
+    return block;
+}
+
+
+void MmapBackend::unmap(void* block, size_t size) {
+    munmap(block, size);
+}
+#endif
+
+
+void* Memory::map(size_t size) {
+    void* block = this->backend->map(size);
+    if (!block) {
+        return nullptr;
+    }
+    this->mapped += size;
+    this->peak = std::max(this->peak, this->mapped);
+    this->blocks++;
+    return block;
+}
+
+
+void Memory::unmap(void* block, size_t size) {
+    this->backend->unmap(block, size);
+    this->mapped -= size;
+    this->blocks--;
+}
+
+
+bool Memory::use(std::string_view name) {
+    if (name == "malloc") {
+        this->backend = &malloc_backend;
+        this->backend_name = "malloc";
+        return true;
+    }
+#ifdef LOX_MMAP_AVAILABLE
+    if (name == "mmap") {
+        this->backend = &mmap_backend;
+        this->backend_name = "mmap";
+        return true;
+    }
+#endif
+    return false;
+}
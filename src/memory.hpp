@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+
+// Where the AST arena and the heap's nursery get their blocks from. Both
+// carve their blocks up themselves, so a backend only sees a few large
+// requests, and is told the size again when a block is returned.
+class MemoryBackend {
+public:
+    virtual void* map(size_t size) = 0;
+    virtual void unmap(void* block, size_t size) = 0;
+    virtual ~MemoryBackend() = default;
+};
+
+
+// std::malloc, for platforms without mmap
+class MallocBackend final: public MemoryBackend {
+public:
+    constexpr MallocBackend() = default;
+
+    void* map(size_t size) override;
+    void unmap(void* block, size_t size) override;
+};
+
+
+// Anonymous mappings straight from the kernel. Blocks of HUGE_PAGE or more
+// are aligned to it and advised as transparent huge pages, so a large heap
+// takes a fraction of the TLB entries 4 KB pages would. Only on Unix.
+class MmapBackend final: public MemoryBackend {
+public:
+    static constexpr size_t HUGE_PAGE = 2 << 20;
+
+    constexpr MmapBackend() = default;
+
+    void* map(size_t size) override;
+    void unmap(void* block, size_t size) override;
+};
+
+
+// The current backend, and every byte it has handed out
+class Memory {
+    MemoryBackend* backend;
+
+public:
+    static constexpr size_t PAGE = 4 << 10;
+
+    const char* backend_name;
+    size_t mapped = 0;
+    size_t peak = 0;
+    size_t blocks = 0;
+
+    constexpr Memory(MemoryBackend* backend, const char* name): backend{backend}, backend_name{name} {}
+
+    static size_t pages(size_t size) {
+        return (size + PAGE - 1) & ~(PAGE - 1);
+    }
+
+    // Returns nullptr when the backend has nothing left
+    void* map(size_t size);
+    void unmap(void* block, size_t size);
+    // Switches to the backend called `name`. A block must go back to the
+    // backend that mapped it, so switch before the first program is parsed;
+    // the nursery never returns its blocks.
+    bool use(std::string_view name);
+};
+
+extern constinit Memory memory;
@@ -4,45 +4,99 @@
 #include <cstdint>
 #include <memory>
 #include <vector>
+#include <span>
+#include <algorithm>
+#include <string>
+#include <string_view>
 #include "token.hpp"
 #include "tagged_ptr.hpp"
 #include "allocator.hpp"
 
 constexpr uint64_t EXPRESSION_NODE_ALIGNMENT_REQ = 16;
 
+// Where the resolver placed a variable. Locals live in slots of their
+// function's frame on the interpreter's value stack; a local that a closure
+// captures lives in a heap cell held by its slot instead, and the closure
+// reaches it through one of its upvalues.
+enum class VariableKind : uint8_t {
+    GLOBAL,
+    SLOT,
+    CELL,
+    UPVALUE,
+};
+
+struct Resolution {
+    VariableKind kind = VariableKind::GLOBAL;
+    uint32_t index = 0;
+};
+
+// Where a new closure takes one of its upvalues from: a cell in the frame it
+// is created in, or one of that frame's own upvalues
+struct Capture {
+    bool local;
+    uint32_t index;
+};
+
 class ExpressionNode;
 
+// Which version of an operator a node has rewritten itself into. Nodes start
+// UNINITIALIZED, specialize on the operand types seen the first time they
+// run, and fall back to GENERIC for good once a guard fails.
+enum class Specialization : uint8_t {
+    UNINITIALIZED,
+    GENERIC,
+    NUMBER_ADD,
+    NUMBER_SUBTRACT,
+    NUMBER_MULTIPLY,
+    NUMBER_DIVIDE,
+    NUMBER_LESS,
+    NUMBER_LESS_EQUAL,
+    NUMBER_GREATER,
+    NUMBER_GREATER_EQUAL,
+    NUMBER_EQUAL,
+    NUMBER_NOT_EQUAL,
+    STRING_CONCAT,
+    NUMBER_NEGATE,
+    BOOL_NOT,
+    INSTANCE_FIELD,
+};
+
+// The value lives in the program's constant table
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) LiteralNode {
-    Object value;
+    const Object* value;
 };
 
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) UnaryNode {
-    Token* oper;
+    Token oper;
     ExpressionNode* operand {};
+    mutable Specialization specialization {};
 };
 
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) BinaryNode {
-    Token* oper;
+    Token oper;
     ExpressionNode* left {};
     ExpressionNode* right {};
+    mutable Specialization specialization {};
 };
 
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) VariableNode {
-    Token* name;
+    Token name;
+    Resolution variable {};
 };
 
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) AssignmentNode {
-    Token* name;
+    Token name;
     ExpressionNode* expr {};
+    Resolution variable {};
 };
 
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) LogicalNode {
-    Token* oper;
+    Token oper;
     ExpressionNode* left {};
     ExpressionNode* right {};
 };
@@ -50,25 +104,63 @@ struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) LogicalNode {
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) CallNode {
     ExpressionNode* callee {};
-    Token* paren;
-    std::vector<ExpressionNode*>* args {};
+    Token paren;
+    std::span<ExpressionNode*> args {};
 };
 
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) GetNode {
     ExpressionNode* object {};
-    Token* name {};
+    Token name;
+    mutable Specialization specialization {};
 };
 
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) SetNode {
     ExpressionNode* object {};
-    Token* name {};
+    Token name;
     ExpressionNode* value {};
 };
 
 struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) ThisNode {
-    Token* tk {};
+    Token tk;
+    Resolution variable {};
+};
+
+
+// Fused nodes replace a common multi-node shape with a single step. Each keeps
+// the node it replaced in `original` so passes that don't know about fusion
+// can look through it.
+
+// `local < number`
+struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) LocalLessConstNode {
+    ExpressionNode* original;
+    uint32_t slot;
+    Number constant;
+};
+
+
+// `local = local + number`
+struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) IncrementLocalNode {
+    ExpressionNode* original;
+    uint32_t slot;
+    Number constant;
+};
+
+
+// `this.name`
+struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) ThisGetNode {
+    ExpressionNode* original;
+    uint32_t slot;
+    Token name;
+};
+
+
+// `global(args...)`
+struct alignas(EXPRESSION_NODE_ALIGNMENT_REQ) CallGlobalNode {
+    ExpressionNode* original;
+    uint32_t global;
+    CallNode* call;
 };
 
 constexpr uint8_t expression_mask = 0b1111;
@@ -83,8 +175,12 @@ enum class ExpressionType : uint8_t {
     GET,
     SET,
     THIS,
+    LOCAL_LESS_CONST,
+    INCREMENT_LOCAL,
+    THIS_GET,
+    CALL_GLOBAL,
 
-    _LAST = THIS
+    _LAST = CALL_GLOBAL
 };
 static_assert(std::to_underlying(ExpressionType::_LAST) <= expression_mask);
 
@@ -103,6 +199,10 @@ public:
     explicit ExpressionNode(GetNode* v) { this->set_<GetNode>(v); }
     explicit ExpressionNode(SetNode* v) { this->set_<SetNode>(v); }
     explicit ExpressionNode(ThisNode* v) { this->set_<ThisNode>(v); }
+    explicit ExpressionNode(LocalLessConstNode* v) { this->set_<LocalLessConstNode>(v); }
+    explicit ExpressionNode(IncrementLocalNode* v) { this->set_<IncrementLocalNode>(v); }
+    explicit ExpressionNode(ThisGetNode* v) { this->set_<ThisGetNode>(v); }
+    explicit ExpressionNode(CallGlobalNode* v) { this->set_<CallGlobalNode>(v); }
 
     ExpressionType get_type() const { return tagged.get_tag(); }
 
@@ -116,6 +216,17 @@ public:
     GetNode* get_get_node() const { return this->get<GetNode>(); }
     SetNode* get_set_node() const { return this->get<SetNode>(); }
     ThisNode* get_this_node() const { return this->get<ThisNode>(); }
+    LocalLessConstNode* get_local_less_const_node() const { return this->get<LocalLessConstNode>(); }
+    IncrementLocalNode* get_increment_local_node() const { return this->get<IncrementLocalNode>(); }
+    ThisGetNode* get_this_get_node() const { return this->get<ThisGetNode>(); }
+    CallGlobalNode* get_call_global_node() const { return this->get<CallGlobalNode>(); }
+
+    // The unfused node behind a fused one, nullptr for every other node
+    ExpressionNode* get_original() const;
+
+    // Where the resolver put the variable a variable, assignment or `this`
+    // node refers to
+    Resolution& get_variable() const;
 
     void set(BinaryNode* v) { return this->set_<BinaryNode>(v); }
     void set(UnaryNode* v) { return this->set_<UnaryNode>(v); }
@@ -127,6 +238,10 @@ public:
     void set(GetNode* v) { return this->set_<GetNode>(v); }
     void set(SetNode* v) { return this->set_<SetNode>(v); }
     void set(ThisNode* v) { return this->set_<ThisNode>(v); }
+    void set(LocalLessConstNode* v) { return this->set_<LocalLessConstNode>(v); }
+    void set(IncrementLocalNode* v) { return this->set_<IncrementLocalNode>(v); }
+    void set(ThisGetNode* v) { return this->set_<ThisGetNode>(v); }
+    void set(CallGlobalNode* v) { return this->set_<CallGlobalNode>(v); }
 
 private:
     template<typename T>
@@ -153,6 +268,28 @@ template<> constexpr ExpressionType ExpressionNode::get_type_for<CallNode>() { r
 template<> constexpr ExpressionType ExpressionNode::get_type_for<GetNode>() { return ExpressionType::GET; }
 template<> constexpr ExpressionType ExpressionNode::get_type_for<SetNode>() { return ExpressionType::SET; }
 template<> constexpr ExpressionType ExpressionNode::get_type_for<ThisNode>() { return ExpressionType::THIS; }
+template<> constexpr ExpressionType ExpressionNode::get_type_for<LocalLessConstNode>() { return ExpressionType::LOCAL_LESS_CONST; }
+template<> constexpr ExpressionType ExpressionNode::get_type_for<IncrementLocalNode>() { return ExpressionType::INCREMENT_LOCAL; }
+template<> constexpr ExpressionType ExpressionNode::get_type_for<ThisGetNode>() { return ExpressionType::THIS_GET; }
+template<> constexpr ExpressionType ExpressionNode::get_type_for<CallGlobalNode>() { return ExpressionType::CALL_GLOBAL; }
+
+inline ExpressionNode* ExpressionNode::get_original() const {
+    switch (this->get_type()) {
+        case ExpressionType::LOCAL_LESS_CONST: return this->get_local_less_const_node()->original;
+        case ExpressionType::INCREMENT_LOCAL: return this->get_increment_local_node()->original;
+        case ExpressionType::THIS_GET: return this->get_this_get_node()->original;
+        case ExpressionType::CALL_GLOBAL: return this->get_call_global_node()->original;
+        default: return nullptr;
+    }
+}
+
+inline Resolution& ExpressionNode::get_variable() const {
+    switch (this->get_type()) {
+        case ExpressionType::VARIABLE: return this->get_variable_node()->variable;
+        case ExpressionType::ASSIGNMENT: return this->get_assignment_node()->variable;
+        default: return this->get_this_node()->variable;
+    }
+}
 
 
 constexpr uint64_t STATEMENT_NODE_ALIGNMENT_REQ = 16;
@@ -170,13 +307,14 @@ struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) ExpressionStatementNode {
 
 
 struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) VariableDeclarationNode {
-    Token* name;
+    Token name;
     ExpressionNode* initializer {};
+    Resolution variable {};
 };
 
 
 struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) BlockStatementNode {
-    std::vector<StatementNode*>* stmts;
+    std::span<StatementNode*> stmts;
 
 };
 
@@ -189,32 +327,40 @@ struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) IfStatementNode {
 
 
 struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) WhileStatementNode {
+    // `while`, or the `for` the loop was desugared from
+    Token tk;
     ExpressionNode* condition {};
     StatementNode* body {};
 };
 
 
 struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) BreakStatementNode {
-    Token* tk;
+    Token tk;
 };
 
 
 struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) ReturnStatementNode {
-    Token* rt;
+    Token rt;
     ExpressionNode* expr;
 };
 
 
 struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) FunctionDeclarationNode {
-    Token* name;
-    std::vector<Token*>* params;
+    Token name;
+    std::span<Token> params;
     BlockStatementNode* body;
+    // Filled in by the resolver
+    Resolution variable {};
+    uint32_t slots = 0;                  // frame size
+    std::span<Resolution> arguments {};  // `this` first for methods, then params
+    std::span<Capture> captures {};      // one per upvalue
 };
 
 
 struct alignas(STATEMENT_NODE_ALIGNMENT_REQ) ClassDeclarationNode {
-    Token* name;
-    std::vector<FunctionDeclarationNode*>* methods;
+    Token name;
+    std::span<FunctionDeclarationNode*> methods;
+    Resolution variable {};
 };
 
 
@@ -304,10 +450,40 @@ template<> constexpr StatementType StatementNode::get_type_for<ClassDeclarationN
 
 struct Program {
     std::string source;
+    // Only needed while parsing; the AST keeps its own copies of the tokens
+    // it refers to
     std::vector<Token> tokens;
+    // Offset in the source of the start of each line
+    std::vector<uint32_t> lines;
+    // Values of the literals. The scanner fills it in and it never grows
+    // after that, since literal nodes point into it.
+    std::vector<Object> constants {None(), false, true};
     std::vector<StatementNode*> statements;
     ASTAllocator allocator;
 
     Program() = default;
     Program(Program&&) = default;
+
+    std::string_view text(const Token& token) const {
+        return std::string_view(this->source).substr(token.span.start, token.span.length);
+    }
+
+    // Line of the source offset, counting from 1
+    uint32_t line(uint32_t offset) const {
+        return static_cast<uint32_t>(std::ranges::upper_bound(this->lines, offset) - this->lines.begin());
+    }
+
+    uint32_t line(const Token& token) const {
+        return this->line(token.span.start);
+    }
+
+    // Where nil, false and true sit in the constant table
+    static constexpr uint32_t NIL_CONSTANT = 0;
+    static constexpr uint32_t FALSE_CONSTANT = 1;
+    static constexpr uint32_t TRUE_CONSTANT = 2;
+
+    // The token vector is only needed by the parser
+    void release_tokens() {
+        std::vector<Token>().swap(this->tokens);
+    }
 };
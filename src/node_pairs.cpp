@@ -0,0 +1,148 @@
+#include <algorithm>
+#include "node_pairs.hpp"
+
+
+void NodePairCounter::count(const Program& program) {
+    this->program = &program;
+    for (const auto& stmt : program.statements) {
+        this->pair("program", "stmt", *stmt);
+    }
+}
+
+
+void NodePairCounter::print(std::ostream& out) const {
+    std::vector<std::pair<uint64_t, const std::pair<std::string, std::string>*>> sorted;
+    for (const auto& [pair, n] : this->counts) {
+        sorted.emplace_back(n, &pair);
+    }
+    std::ranges::stable_sort(sorted, [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (const auto& [n, pair] : sorted) {
+        out << n << '\t' << pair->first << " -> " << pair->second << '\n';
+    }
+}
+
+
+std::string NodePairCounter::label(const StatementNode& stmt) const {
+    switch (stmt.get_type()) {
+        case StatementType::PRINT: return "print";
+        case StatementType::EXPRESSION: return "expr-stmt";
+        case StatementType::VARIABLE: return "var";
+        case StatementType::BLOCK: return "block";
+        case StatementType::IF: return "if";
+        case StatementType::WHILE: return "while";
+        case StatementType::BREAK: return "break";
+        case StatementType::RETURN: return "return";
+        case StatementType::FUNCTION: return "fun";
+        case StatementType::CLASS: return "class";
+    }
+    return "?";
+}
+
+
+std::string NodePairCounter::label(const ExpressionNode& expr) const {
+    if (auto original = expr.get_original()) {
+        return this->label(*original);
+    }
+    switch (expr.get_type()) {
+        case ExpressionType::BINARYOP: return "binary(" + std::string(this->program->text(expr.get_binary_node()->oper)) + ")";
+        case ExpressionType::UNARYOP: return "unary(" + std::string(this->program->text(expr.get_unary_node()->oper)) + ")";
+        case ExpressionType::LITERAL: {
+            const Object& value = *expr.get_literal_node()->value;
+            if (value.is_number()) return "number";
+            if (value.is_string()) return "string";
+            if (value.is_bool()) return "bool";
+            return "nil";
+        }
+        case ExpressionType::VARIABLE: return expr.get_variable().kind != VariableKind::GLOBAL ? "local" : "global";
+        case ExpressionType::ASSIGNMENT: return expr.get_variable().kind != VariableKind::GLOBAL ? "assign-local" : "assign-global";
+        case ExpressionType::LOGICAL: return "logical(" + std::string(this->program->text(expr.get_logical_node()->oper)) + ")";
+        case ExpressionType::CALL: return "call";
+        case ExpressionType::GET: return "get";
+        case ExpressionType::SET: return "set";
+        case ExpressionType::THIS: return "this";
+        default: return "?";
+    }
+}
+
+
+void NodePairCounter::pair(const std::string& parent, std::string_view role, const StatementNode& child) {
+    this->counts[{parent + "." + std::string(role), this->label(child)}]++;
+    this->statement(child);
+}
+
+
+void NodePairCounter::pair(const std::string& parent, std::string_view role, const ExpressionNode& child) {
+    this->counts[{parent + "." + std::string(role), this->label(child)}]++;
+    this->expression(child);
+}
+
+
+void NodePairCounter::statement(const StatementNode& stmt) {
+    std::string parent = this->label(stmt);
+    switch (stmt.get_type()) {
+        case StatementType::PRINT: this->pair(parent, "expr", *stmt.get_print_statement_node()->expr); break;
+        case StatementType::EXPRESSION: this->pair(parent, "expr", *stmt.get_expression_statement_node()->expr); break;
+        case StatementType::VARIABLE:
+            if (auto init = stmt.get_variable_statement_node()->initializer) this->pair(parent, "init", *init);
+            break;
+        case StatementType::BLOCK:
+            for (const auto& s : stmt.get_block_statement_node()->stmts) this->pair(parent, "stmt", *s);
+            break;
+        case StatementType::IF: {
+            const IfStatementNode& if_stmt = *stmt.get_if_statement_node();
+            this->pair(parent, "cond", *if_stmt.condition);
+            this->pair(parent, "then", *if_stmt.then_branch);
+            if (if_stmt.else_branch) this->pair(parent, "else", *if_stmt.else_branch);
+            break;
+        }
+        case StatementType::WHILE:
+            this->pair(parent, "cond", *stmt.get_while_statement_node()->condition);
+            this->pair(parent, "body", *stmt.get_while_statement_node()->body);
+            break;
+        case StatementType::BREAK: break;
+        case StatementType::RETURN:
+            if (auto expr = stmt.get_return_statement_node()->expr) this->pair(parent, "value", *expr);
+            break;
+        case StatementType::FUNCTION:
+            for (const auto& s : stmt.get_function_declaration_node()->body->stmts) this->pair(parent, "stmt", *s);
+            break;
+        case StatementType::CLASS:
+            for (const auto& method : stmt.get_class_declaration_node()->methods) {
+                for (const auto& s : method->body->stmts) this->pair("method", "stmt", *s);
+            }
+            break;
+    }
+}
+
+
+void NodePairCounter::expression(const ExpressionNode& expr) {
+    if (auto original = expr.get_original()) {
+        return this->expression(*original);
+    }
+    std::string parent = this->label(expr);
+    switch (expr.get_type()) {
+        case ExpressionType::BINARYOP:
+            this->pair(parent, "left", *expr.get_binary_node()->left);
+            this->pair(parent, "right", *expr.get_binary_node()->right);
+            break;
+        case ExpressionType::UNARYOP: this->pair(parent, "operand", *expr.get_unary_node()->operand); break;
+        case ExpressionType::ASSIGNMENT: this->pair(parent, "value", *expr.get_assignment_node()->expr); break;
+        case ExpressionType::LOGICAL:
+            this->pair(parent, "left", *expr.get_logical_node()->left);
+            this->pair(parent, "right", *expr.get_logical_node()->right);
+            break;
+        case ExpressionType::CALL: {
+            const CallNode& call = *expr.get_call_node();
+            this->pair(parent, "callee", *call.callee);
+            for (const ExpressionNode* argument : call.args) this->pair(parent, "arg", *argument);
+            break;
+        }
+        case ExpressionType::GET: this->pair(parent, "object", *expr.get_get_node()->object); break;
+        case ExpressionType::SET:
+            this->pair(parent, "object", *expr.get_set_node()->object);
+            this->pair(parent, "value", *expr.get_set_node()->value);
+            break;
+        default:
+            break;
+    }
+}
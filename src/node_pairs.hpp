@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "node.hpp"
+
+// Counts how often each parent/child node pair occurs in resolved programs,
+// labelling children by the role they play in their parent (e.g.
+// "binary(<).left -> local"). Used to choose which shapes to fuse next.
+struct NodePairCounter {
+    std::map<std::pair<std::string, std::string>, uint64_t> counts;
+
+    void count(const Program&);
+
+    // Most frequent pairs first
+    void print(std::ostream&) const;
+
+private:
+    // The program being counted, for operator text
+    const Program* program = nullptr;
+
+    std::string label(const StatementNode&) const;
+    std::string label(const ExpressionNode&) const;
+    void statement(const StatementNode&);
+    void expression(const ExpressionNode&);
+    void pair(const std::string&, std::string_view, const StatementNode&);
+    void pair(const std::string&, std::string_view, const ExpressionNode&);
+};
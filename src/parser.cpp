@@ -6,7 +6,7 @@
 using enum TokenType;
 
 
-Parser::Parser(Program& program): tokens{program.tokens}, allocator{program.allocator}, statements{program.statements} {}
+Parser::Parser(Program& program): program{program}, tokens{program.tokens}, allocator{program.allocator}, statements{program.statements} {}
 
 
 void Parser::parse() {
@@ -19,8 +19,17 @@ void Parser::parse() {
 
 
 StatementNode* Parser::parse_declaration() {
+    size_t statements = this->statement_stack.size();
+    size_t arguments = this->argument_stack.size();
+    size_t parameters = this->parameter_stack.size();
+    size_t methods = this->method_stack.size();
     std::expected<StatementNode*, ParserError> res = this->parse_declaration2();
     if (!res.has_value()) {
+        // Drop whatever the failed declaration left half gathered
+        this->statement_stack.resize(statements);
+        this->argument_stack.resize(arguments);
+        this->parameter_stack.resize(parameters);
+        this->method_stack.resize(methods);
         this->synchronize();
         Lox::had_error = true;
         return nullptr;
@@ -66,7 +75,7 @@ std::expected<VariableDeclarationNode*, ParserError> Parser::parse_variable_decl
 
     this->consume(SEMICOLON, "Expect ';' after variable declaration.");
 
-    return this->allocator.create<VariableDeclarationNode>(name.value(), initializer);
+    return this->allocator.create<VariableDeclarationNode>(*name.value(), initializer);
 }
 
 
@@ -79,10 +88,10 @@ std::expected<FunctionDeclarationNode*, ParserError> Parser::parse_function_decl
         return std::unexpected(name.error());
     }
 
-    std::vector<Token*>* params = this->allocator.create<std::vector<Token*>>();
+    size_t params = this->parameter_stack.size();
     if (!this->check_next_token(RIGHT_PAREN)) {
         do {
-            if (params->size() >= 255) {
+            if (this->parameter_stack.size() - params >= 255) {
                 error(peek(), "Can't have more than 255 parameters.");
             }
 
@@ -90,12 +99,13 @@ std::expected<FunctionDeclarationNode*, ParserError> Parser::parse_function_decl
             if (!param.has_value()) {
                 return std::unexpected(param.error());
             }
-            params->push_back(param.value());
+            this->parameter_stack.push_back(*param.value());
         } while (this->match_token({{COMMA}}));
     }
     if (auto res = consume(RIGHT_PAREN, "Expect ')' after parameters."); !res.has_value()) {
         return std::unexpected(res.error());
     }
+    auto parameters = this->take(this->parameter_stack, params);
 
     if (auto res = consume(LEFT_BRACE, std::format("Expect '{{' before {} body.", kind)); !res.has_value()) {
         return std::unexpected(res.error());
@@ -105,7 +115,7 @@ std::expected<FunctionDeclarationNode*, ParserError> Parser::parse_function_decl
     if (!body.has_value()) {
         return std::unexpected(body.error());
     }
-    return this->allocator.create<FunctionDeclarationNode>(name.value(), params, body.value());
+    return this->allocator.create<FunctionDeclarationNode>(*name.value(), parameters, body.value());
 }
 
 
@@ -118,20 +128,20 @@ std::expected<ClassDeclarationNode*, ParserError> Parser::parse_class_declaratio
         return std::unexpected(res.error());
     }
 
-    auto methods = this->allocator.create<std::vector<FunctionDeclarationNode*>>();
+    size_t methods = this->method_stack.size();
     while (!this->check_next_token(RIGHT_BRACE) && !this->is_at_end()) {
         auto method = this->parse_function_declaration("method");
         if (!method.has_value()) {
             return std::unexpected(method.error());
         }
-        methods->push_back(method.value());
+        this->method_stack.push_back(method.value());
     }
 
     if (auto res = consume(RIGHT_BRACE, "Expect '}' after class body."); !res.has_value()) {
         return std::unexpected(res.error());
     }
 
-    return this->allocator.create<ClassDeclarationNode>(name.value(), methods);
+    return this->allocator.create<ClassDeclarationNode>(*name.value(), this->take(this->method_stack, methods));
 }
 
 std::expected<StatementNode*, ParserError> Parser::parse_statement() {
@@ -178,10 +188,10 @@ std::expected<StatementNode*, ParserError> Parser::parse_statement() {
 
 
 std::expected<BlockStatementNode*, ParserError> Parser::parse_block() {
-    auto statements = this->allocator.create<std::vector<StatementNode*>>();
+    size_t statements = this->statement_stack.size();
     while (!this->check_next_token(RIGHT_BRACE) && !this->is_at_end()) {
         if (auto res = this->parse_declaration()) {
-            statements->push_back(res);
+            this->statement_stack.push_back(res);
         } else {
             return std::unexpected(ParserError());
         }
@@ -190,7 +200,7 @@ std::expected<BlockStatementNode*, ParserError> Parser::parse_block() {
         return std::unexpected(res.error());
     }
 
-    return this->allocator.create<BlockStatementNode>(statements);
+    return this->allocator.create<BlockStatementNode>(this->take(this->statement_stack, statements));
 }
 
 
@@ -246,6 +256,7 @@ std::expected<IfStatementNode*, ParserError> Parser::parse_if_statement() {
 }
 
 std::expected<WhileStatementNode*, ParserError> Parser::parse_while_statement() {
+    Token& tk = this->previous();
     if (auto res = this->consume(LEFT_PAREN, "Expect '(' after 'while'."); !res.has_value()) {
         return std::unexpected(res.error());
     }
@@ -261,11 +272,12 @@ std::expected<WhileStatementNode*, ParserError> Parser::parse_while_statement()
         return std::unexpected(body.error());
     }
 
-    return this->allocator.create<WhileStatementNode>(condition.value(), body.value());
+    return this->allocator.create<WhileStatementNode>(tk, condition.value(), body.value());
 }
 
 
 std::expected<BlockStatementNode*, ParserError> Parser::parse_for_statement() {
+    Token& tk = this->previous();
     if (auto res = this->consume(LEFT_PAREN, "Expect '(' after 'for'."); !res.has_value()) {
         return std::unexpected(res.error());
     }
@@ -319,29 +331,30 @@ std::expected<BlockStatementNode*, ParserError> Parser::parse_for_statement() {
     StatementNode* body = body_exp.value();
     if (increment) {
         auto increment_stmt = this->allocator.create<StatementNode>(this->allocator.create<ExpressionStatementNode>(increment));
-        auto st_list = this->allocator.create<std::vector<StatementNode*>>(std::vector<StatementNode*>({{body, increment_stmt}}));
-        body = this->allocator.create<StatementNode>(this->allocator.create<BlockStatementNode>(st_list));
+        StatementNode* st_list[] {body, increment_stmt};
+        body = this->allocator.create<StatementNode>(this->allocator.create<BlockStatementNode>(this->allocator.copy<StatementNode*>(st_list)));
     }
 
     if (!condition) {
-        condition = this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(true));
+        condition = this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(&this->program.constants[Program::TRUE_CONSTANT]));
     }
-    auto while_stmt = this->allocator.create<StatementNode>(this->allocator.create<WhileStatementNode>(condition, body));
+    auto while_stmt = this->allocator.create<StatementNode>(this->allocator.create<WhileStatementNode>(tk, condition, body));
 
-    std::vector<StatementNode*> st_list {};
+    size_t statements = this->statement_stack.size();
     if (initializer) {
-        st_list.push_back(initializer);
+        this->statement_stack.push_back(initializer);
     }
-    st_list.push_back(while_stmt);
-    return this->allocator.create<BlockStatementNode>(this->allocator.create<std::vector<StatementNode*>>(std::move(st_list)));
+    this->statement_stack.push_back(while_stmt);
+    return this->allocator.create<BlockStatementNode>(this->take(this->statement_stack, statements));
 }
 
 
 std::expected<BreakStatementNode*, ParserError> Parser::parse_break_statement() {
+    Token& tk = this->previous();
     if (auto res = this->consume(SEMICOLON, "Expect ';' after 'break'."); !res.has_value()) {
         return std::unexpected(res.error());
     }
-    return this->allocator.create<BreakStatementNode>();
+    return this->allocator.create<BreakStatementNode>(tk);
 }
 
 
@@ -358,7 +371,7 @@ std::expected<ReturnStatementNode*, ParserError> Parser::parse_return_statement(
     if (auto res = this->consume(SEMICOLON, "Expect ';' after return."); !res.has_value()) {
         return std::unexpected(res.error());
     }
-    return this->allocator.create<ReturnStatementNode>(&rt, rt_exp);
+    return this->allocator.create<ReturnStatementNode>(rt, rt_exp);
 }
 
 
@@ -379,11 +392,11 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_assignment() {
             return value;
 
         if (expr.value()->get_type() == ExpressionType::VARIABLE) {
-            Token* name = expr.value()->get_variable_node()->name;
+            const Token& name = expr.value()->get_variable_node()->name;
             return this->allocator.create<ExpressionNode>(this->allocator.create<AssignmentNode>(name, value.value()));
         } else if (expr.value()->get_type() == ExpressionType::GET) {
             auto get_node = expr.value()->get_get_node();
-            Token* name = get_node->name;
+            const Token& name = get_node->name;
             return this->allocator.create<ExpressionNode>(this->allocator.create<SetNode>(get_node->object, name, value.value()));
         }
 
@@ -406,7 +419,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_logical_or() {
         if (!right.has_value()) {
             return right;
         }
-        expr = this->allocator.create<ExpressionNode>(this->allocator.create<LogicalNode>(&oper, expr, right.value()));
+        expr = this->allocator.create<ExpressionNode>(this->allocator.create<LogicalNode>(oper, expr, right.value()));
     }
 
     return expr;
@@ -425,7 +438,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_logical_and() {
         if (!right.has_value()) {
             return right;
         }
-        expr = this->allocator.create<ExpressionNode>(this->allocator.create<LogicalNode>(&oper, expr, right.value()));
+        expr = this->allocator.create<ExpressionNode>(this->allocator.create<LogicalNode>(oper, expr, right.value()));
     }
 
     return expr;
@@ -443,7 +456,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_equality() {
         if (!right.has_value())
             return right;
 
-        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(&oper, *expr, *right));
+        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(oper, *expr, *right));
     }
 
     return expr;
@@ -461,7 +474,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_comparison() {
         if (!right.has_value())
             return right;
 
-        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(&oper, *expr, *right));
+        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(oper, *expr, *right));
     }
 
     return expr;
@@ -479,7 +492,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_term() {
         if (!right.has_value())
             return right;   
  
-        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(&oper, *expr, *right));
+        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(oper, *expr, *right));
     }
 
     return expr;
@@ -498,7 +511,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_factor() {
         if (!right.has_value())
             return right;
 
-        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(&oper, expr, *right));
+        expr = this->allocator.create<ExpressionNode>(this->allocator.create<BinaryNode>(oper, expr, *right));
     }
 
     return expr;
@@ -512,7 +525,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_unary() {
         if (!right.has_value())
             return right;
 
-        return this->allocator.create<ExpressionNode>(this->allocator.create<UnaryNode>(&oper, *right));
+        return this->allocator.create<ExpressionNode>(this->allocator.create<UnaryNode>(oper, *right));
     }
   
     return this->parse_call();
@@ -539,7 +552,7 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_call() {
             if (!name.has_value()) {
                 return std::unexpected(name.error());
             }
-            expr = this->allocator.create<ExpressionNode>(this->allocator.create<GetNode>(expr, name.value()));
+            expr = this->allocator.create<ExpressionNode>(this->allocator.create<GetNode>(expr, *name.value()));
         }
         else {
             break;
@@ -550,17 +563,17 @@ std::expected<ExpressionNode*, ParserError> Parser::parse_call() {
 }
 
 std::expected<ExpressionNode*, ParserError> Parser::finish_call(ExpressionNode& callee) {
-    auto arguments = this->allocator.create<std::vector<ExpressionNode*>>();
+    size_t arguments = this->argument_stack.size();
     if (!this->check_next_token(RIGHT_PAREN)) {
         do {
-            if (arguments->size() >= 255) {
+            if (this->argument_stack.size() - arguments >= 255) {
                 this->error(this->peek(), "Can't have more than 255 arguments.");
             }
             auto expr = this->parse_expression();
             if (!expr.has_value()) {
                 return expr;
             }
-            arguments->push_back(expr.value());
+            this->argument_stack.push_back(expr.value());
         } while (this->match_token({{COMMA}}));
     }
 
@@ -569,27 +582,27 @@ std::expected<ExpressionNode*, ParserError> Parser::finish_call(ExpressionNode&
         return std::unexpected(paren_exp.error());
     }
 
-    return this->allocator.create<ExpressionNode>(this->allocator.create<CallNode>(&callee, paren_exp.value(), arguments));
+    return this->allocator.create<ExpressionNode>(this->allocator.create<CallNode>(&callee, *paren_exp.value(), this->take(this->argument_stack, arguments)));
 }
 
 
 std::expected<ExpressionNode*, ParserError> Parser::parse_primary() {
     if (this->match_token({{FALSE}}))
-        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(false));
+        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(&this->program.constants[Program::FALSE_CONSTANT]));
     if (this->match_token({{TRUE}}))
-        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(true));
+        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(&this->program.constants[Program::TRUE_CONSTANT]));
     if (this->match_token({{NIL}}))
-        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(None()));
+        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(&this->program.constants[Program::NIL_CONSTANT]));
 
     if (this->match_token({{NUMBER, STRING}})) {
-        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(this->previous().val));
+        return this->allocator.create<ExpressionNode>(this->allocator.create<LiteralNode>(&this->program.constants[this->previous().symbol]));
     }
     if (this->match_token({{THIS}})) {
-        return this->allocator.create<ExpressionNode>(this->allocator.create<ThisNode>(&this->previous()));
+        return this->allocator.create<ExpressionNode>(this->allocator.create<ThisNode>(this->previous()));
     }
 
     if (this->match_token({{IDENTIFIER}})) {
-        return this->allocator.create<ExpressionNode>(this->allocator.create<VariableNode>(&this->previous()));
+        return this->allocator.create<ExpressionNode>(this->allocator.create<VariableNode>(this->previous()));
     }
 
     if (this->match_token({{LEFT_PAREN}})) {
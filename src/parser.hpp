@@ -11,11 +11,19 @@
 struct ParserError {};
 
 struct Parser {
+    const Program& program;
     std::vector<Token>& tokens;
     ASTAllocator& allocator;
     std::vector<StatementNode*>& statements;
     size_t current = 0;
 
+    // Child lists are gathered here while they're parsed, then copied into
+    // the arena in one piece (Parser::take)
+    std::vector<StatementNode*> statement_stack;
+    std::vector<ExpressionNode*> argument_stack;
+    std::vector<Token> parameter_stack;
+    std::vector<FunctionDeclarationNode*> method_stack;
+
     Parser(Program&);
 
     void parse();
@@ -62,6 +70,13 @@ struct Parser {
     Token& peek() const;
     Token& previous() const;
 
+    template <typename T>
+    std::span<T> take(std::vector<T>& stack, size_t base) {
+        auto items = this->allocator.copy<T>(std::span(stack).subspan(base));
+        stack.resize(base);
+        return items;
+    }
+
     void synchronize();
     ParserError error(const Token&, std::string_view) const;
 };
@@ -1,34 +1,46 @@
 #include "resolver.hpp"
 #include "lox.hpp"
+#include <algorithm>
 #include <stdexcept>
 
-Resolver::Resolver(Interpreter& inter): interpreter{inter} {}
+Resolver::Resolver(Interpreter& inter, ASTAllocator& allocator): interpreter{inter}, allocator{allocator} {}
 
 
 void Resolver::visit_block(BlockStatementNode& block) {
     this->begin_scope();
-    this->resolve(*block.stmts);
+    this->resolve(block.stmts);
     this->end_scope();
 }
 
 
 void Resolver::begin_scope() {
-    this->scopes.emplace_back();
+    this->scopes.push_back(Scope{{}, this->functions.back().next_slot});
 }
 
 void Resolver::end_scope() {
     auto& s = this->scopes.back();
-    for (auto& v : s) {
+    for (auto& v : s.variables) {
         // tk might not be set, 'this' keyword
         if (v.second.tk && !v.second.used) {
             Lox::error(*v.second.tk, "Unused variable");
         }
+        Resolution variable {v.second.captured ? VariableKind::CELL : VariableKind::SLOT, v.second.slot};
+        if (v.second.declaration) {
+            *v.second.declaration = variable;
+        }
+        for (Resolution* reference : v.second.references) {
+            *reference = variable;
+        }
     }
+    this->functions.back().next_slot = s.first_slot;
     this->scopes.pop_back();
+    if (this->functions.size() == 1) {
+        this->interpreter.reserve_script_slots(this->functions.back().slots);
+    }
 }
 
 
-void Resolver::resolve(std::vector<StatementNode*>& stmts) {
+void Resolver::resolve(std::span<StatementNode*> stmts) {
     for (auto stmt : stmts) {
         this->resolve(*stmt);
     }
@@ -63,30 +75,41 @@ void Resolver::resolve(ExpressionNode& expr) {
         case ExpressionType::GET: { this->visit_get_expr(*expr.get_get_node()); break;}
         case ExpressionType::SET: { this->visit_set_expr(*expr.get_set_node()); break;}
         case ExpressionType::THIS: { this->visit_this_expr(expr); break;}
+        case ExpressionType::LOCAL_LESS_CONST:
+        case ExpressionType::INCREMENT_LOCAL:
+        case ExpressionType::THIS_GET:
+        case ExpressionType::CALL_GLOBAL: { this->resolve(*expr.get_original()); break;}
     }
 }
 
 
 void Resolver::visit_var_dec_node(VariableDeclarationNode& var_dec) {
-    this->declare(*var_dec.name);
+    this->declare(var_dec.name, &var_dec.variable);
     if (var_dec.initializer) {
         this->resolve(*var_dec.initializer);
     }
-    this->define(*var_dec.name);
+    this->define(var_dec.name);
 }
 
 
-void Resolver::declare(Token& tk) {
+void Resolver::declare(Token& tk, Resolution* declaration) {
     if (this->scopes.empty()) {
+        if (declaration) {
+            *declaration = Resolution{VariableKind::GLOBAL, this->interpreter.global_env->slot(tk.symbol)};
+        }
+        return;
+    }
+    auto& scope = this->scopes.back().variables;
+    auto& function = this->functions.back();
+    if (function.next_slot == UINT16_MAX) {
+        Lox::error(tk, "Too many local variables in function.");
         return;
     }
-    auto& scope = this->scopes.back();
-    bool contains = scope.contains(tk.lexeme);
-    auto& v = scope[std::string(tk.lexeme)] = VarInfo{false, false, &tk, 0};
+    bool contains = scope.contains(tk.symbol);
+    scope[tk.symbol] = VarInfo{false, false, &tk, function.next_slot++, false, declaration, {}};
+    function.slots = std::max(function.slots, function.next_slot);
     if (contains) {
         Lox::error(tk, "Already a variable with this name in this scope.");
-    } else {
-        v.index = scope.size() - 1;
     }
 }
 
@@ -94,8 +117,8 @@ void Resolver::declare(Token& tk) {
 void Resolver::define(Token& tk) {
     if (this->scopes.empty()) return;
 
-    auto& s = this->scopes.back();
-    auto d = s.find(tk.lexeme);
+    auto& s = this->scopes.back().variables;
+    auto d = s.find(tk.symbol);
     if (d == s.end()) {
         throw std::runtime_error("Variable defined but not declared");
     }
@@ -106,40 +129,70 @@ void Resolver::define(Token& tk) {
 void Resolver::visit_var_expr(ExpressionNode& expr) {
     VariableNode& var_expr = *expr.get_variable_node();
     if (!this->scopes.empty()) {
-        auto& s = this->scopes.back();
-        auto d = s.find(var_expr.name->lexeme);
+        auto& s = this->scopes.back().variables;
+        auto d = s.find(var_expr.name.symbol);
         if (d != s.end()) {
             if (d->second.defined == false) {
-                Lox::error(*var_expr.name, "Can't read local variable in its own initializer.");
+                Lox::error(var_expr.name, "Can't read local variable in its own initializer.");
             } else {
                 d->second.used = true;
             }
         }
     }
 
-    this->resolve_local(expr, *var_expr.name);
+    this->resolve_local(expr, var_expr.name);
 }
 
 
 void Resolver::resolve_local(ExpressionNode& expr, Token& name) {
-    for (int i = this->scopes.size() - 1; i >= 0; i--) {
-        if (auto v = this->scopes[i].find(name.lexeme); v != this->scopes[i].end()) {
-            this->interpreter.resolve(&expr, this->scopes.size() - 1 - i, v->second.index);
+    for (size_t i = this->scopes.size(); i-- > 0;) {
+        auto& variables = this->scopes[i].variables;
+        auto v = variables.find(name.symbol);
+        if (v == variables.end()) {
+            continue;
+        }
+        size_t owner = this->functions.size() - 1;
+        while (this->functions[owner].first_scope > i) {
+            owner--;
+        }
+        if (owner == this->functions.size() - 1) {
+            v->second.references.push_back(&expr.get_variable());
             return;
         }
+        v->second.captured = true;
+        expr.get_variable() = Resolution{VariableKind::UPVALUE, this->add_upvalue(this->functions.size() - 1, owner, v->second)};
+        return;
     }
+    expr.get_variable() = Resolution{VariableKind::GLOBAL, this->interpreter.global_env->slot(name.symbol)};
+}
+
+
+// Threads a local of `owner` through the upvalues of every function between
+// it and `function`, like clox, and returns its index in `function`'s.
+uint32_t Resolver::add_upvalue(size_t function, size_t owner, const VarInfo& variable) {
+    Capture capture = function == owner + 1
+        ? Capture{true, variable.slot}
+        : Capture{false, this->add_upvalue(function - 1, owner, variable)};
+    auto& captures = this->functions[function].captures;
+    for (uint32_t i = 0; i < captures.size(); i++) {
+        if (captures[i].local == capture.local && captures[i].index == capture.index) {
+            return i;
+        }
+    }
+    captures.push_back(capture);
+    return captures.size() - 1;
 }
 
 void Resolver::visit_assign_expr(ExpressionNode& expr) {
     AssignmentNode& assign_expr = *expr.get_assignment_node();
     this->resolve(*assign_expr.expr);
-    this->resolve_local(expr, *assign_expr.name);
+    this->resolve_local(expr, assign_expr.name);
 }
 
 void Resolver::visit_function_dec(StatementNode& stmt) {
     FunctionDeclarationNode& func_dec = *stmt.get_function_declaration_node();
-    this->declare(*func_dec.name);
-    this->define(*func_dec.name);
+    this->declare(func_dec.name, &func_dec.variable);
+    this->define(func_dec.name);
     FunctionType f_type = FunctionType::FUNCTION;
 
     this->resolve_function(func_dec, f_type);
@@ -148,36 +201,42 @@ void Resolver::visit_function_dec(StatementNode& stmt) {
 void Resolver::visit_class_dec(ClassDeclarationNode& stmt) {
     ClassType enclosing_class_type = this->current_class;
     this->current_class = ClassType::CLASS;
-    this->declare(*stmt.name);
-    this->define(*stmt.name);
-
-    this->begin_scope();
-    this->scopes.back()["this"] = VarInfo{true, false, nullptr, 0};
+    this->declare(stmt.name, &stmt.variable);
+    this->define(stmt.name);
 
-    for (auto& method : *stmt.methods) {
+    for (auto& method : stmt.methods) {
         FunctionType f_type = FunctionType::METHOD;
-        if (method->name->lexeme == "init") {
+        if (method->name.symbol == names::INIT) {
             f_type = FunctionType::INITIALIZER;
         }
         this->resolve_function(*method, f_type);
     }
 
-    this->end_scope();
     this->current_class = enclosing_class_type;
 }
 
 void Resolver::resolve_function(FunctionDeclarationNode& func_dec, FunctionType type) {
     FunctionType enclosing_func = this->current_function;
     this->current_function = type;
+    this->functions.push_back(FunctionInfo{&func_dec, this->scopes.size()});
     this->begin_scope();
-    if (func_dec.params){
-        for (auto& p : *func_dec.params) {
-            this->declare(*p);
-            this->define(*p);
-        }
+    // Methods take `this` in slot 0, ahead of the parameters
+    bool method = type == FunctionType::METHOD || type == FunctionType::INITIALIZER;
+    func_dec.arguments = this->allocator.array<Resolution>(func_dec.params.size() + method);
+    if (method) {
+        auto& function = this->functions.back();
+        this->scopes.back().variables[names::THIS] = VarInfo{true, false, nullptr, function.next_slot++, false, &func_dec.arguments[0], {}};
+        function.slots = function.next_slot;
     }
-    this->resolve(*func_dec.body->stmts);
+    for (size_t i = 0; i < func_dec.params.size(); i++) {
+        this->declare(func_dec.params[i], &func_dec.arguments[i + method]);
+        this->define(func_dec.params[i]);
+    }
+    this->resolve(func_dec.body->stmts);
     this->end_scope();
+    func_dec.slots = this->functions.back().slots;
+    func_dec.captures = this->allocator.copy<Capture>(this->functions.back().captures);
+    this->functions.pop_back();
     this->current_function = enclosing_func;
 }
 
@@ -203,11 +262,11 @@ void Resolver::visit_print_stmt(PrintStatementNode& stmt) {
 
 void Resolver::visit_return_stmt(ReturnStatementNode& stmt) {
     if (this->current_function == FunctionType::NONE) {
-        Lox::error(*stmt.rt, "Can't return from top-level code.");
+        Lox::error(stmt.rt, "Can't return from top-level code.");
     }
     if (stmt.expr) {
         if (this->current_function == FunctionType::INITIALIZER) {
-            Lox::error(*stmt.rt, "Can't return a value from an initializer.");
+            Lox::error(stmt.rt, "Can't return a value from an initializer.");
         }
         this->resolve(*stmt.expr);
     }
@@ -217,7 +276,7 @@ void Resolver::visit_return_stmt(ReturnStatementNode& stmt) {
 
 void Resolver::visit_break_stmt(BreakStatementNode& br) {
     if (this->loop_depth == 0) {
-        Lox::error(*br.tk, "Can't use 'break' outside of loop");
+        Lox::error(br.tk, "Can't use 'break' outside of loop");
     }
 }
 
@@ -239,10 +298,8 @@ void Resolver::visit_bin_expr(BinaryNode& expr) {
 
 void Resolver::visit_call_expr(CallNode& expr) {
     this->resolve(*expr.callee);
-    if (expr.args) {
-        for (auto v : *expr.args) {
-            this->resolve(*v);
-        }
+    for (auto v : expr.args) {
+        this->resolve(*v);
     }
 }
 
@@ -257,10 +314,10 @@ void Resolver::visit_set_expr(SetNode& expr) {
 
 void Resolver::visit_this_expr(ExpressionNode& expr) {
     if (this->current_class == ClassType::NONE) {
-        Lox::error(*expr.get_this_node()->tk, "Can't use 'this' outside of a class.");
+        Lox::error(expr.get_this_node()->tk, "Can't use 'this' outside of a class.");
         return;
     }
-    this->resolve_local(expr, *expr.get_this_node()->tk);
+    this->resolve_local(expr, expr.get_this_node()->tk);
 }
 
 
@@ -6,7 +6,7 @@
 #include <functional>
 #include "interpreter.hpp"
 #include "node.hpp"
-#include "string_hash.hpp"
+#include "allocator.hpp"
 
 enum class FunctionType {
     NONE,
@@ -25,22 +25,45 @@ struct VarInfo {
     bool defined;
     bool used;
     Token* tk;
-    size_t index;
+    uint32_t slot;
+    bool captured = false;
+    // Whether a local ends up in its slot or in a cell is only known once its
+    // scope ends, so the declaration and the references from its own function
+    // are filled in then
+    Resolution* declaration = nullptr;
+    std::vector<Resolution*> references;
+};
+
+struct Scope {
+    std::unordered_map<Symbol, VarInfo> variables;
+    uint32_t first_slot;
+};
+
+// A function being resolved; the script is the outermost one
+struct FunctionInfo {
+    FunctionDeclarationNode* declaration;
+    size_t first_scope;
+    uint32_t next_slot = 0;
+    uint32_t slots = 0;
+    // Copied into the arena with the declaration once it's resolved
+    std::vector<Capture> captures {};
 };
 
 struct Resolver {
     Interpreter& interpreter;
-    std::vector<std::unordered_map<std::string, VarInfo, string_hash, std::equal_to<>>> scopes;
+    ASTAllocator& allocator;
+    std::vector<Scope> scopes;
+    std::vector<FunctionInfo> functions {{nullptr, 0}};
     FunctionType current_function = FunctionType::NONE;
     ClassType current_class = ClassType::NONE;
     uint32_t loop_depth = 0;
 
-    Resolver(Interpreter&);
+    Resolver(Interpreter&, ASTAllocator&);
 
     void visit_block(BlockStatementNode&);
     void begin_scope();
     void end_scope();
-    void resolve(std::vector<StatementNode*>&);
+    void resolve(std::span<StatementNode*>);
     void resolve(StatementNode&);
     void resolve(ExpressionNode&);
 
@@ -64,11 +87,12 @@ struct Resolver {
     void visit_logical_expr(LogicalNode&);
     void visit_unary_expr(UnaryNode&);
 
-    void declare(Token&);
+    void declare(Token&, Resolution* declaration = nullptr);
     void define(Token&);
 
     void visit_var_expr(ExpressionNode&);
 
     void resolve_local(ExpressionNode& expr, Token& name);
     void resolve_function(FunctionDeclarationNode&, FunctionType);
+    uint32_t add_upvalue(size_t function, size_t owner, const VarInfo&);
 };
@@ -24,17 +24,18 @@ bool is_alpha_numeric(char c) {
 }
 
 
-Scanner::Scanner(const std::string& program, std::vector<Token>& tokens): program_{program}, program{this->program_}, tokens{tokens} {}
+Scanner::Scanner(Program& program):
+    program{program.source}, tokens{program.tokens}, lines{program.lines}, constants{program.constants} {}
 
 
-std::vector<Token> Scanner::scan() {
+void Scanner::scan() {
+    this->lines.push_back(0);
     while (!this->check_at_end()) {
         this->start = this->current;
         this->scan_next();
     }
     this->start = this->current;
-    tokens.emplace_back(TokenType::END_OF_FILE, "EOF", None(), this->line);
-    return tokens;
+    this->add_token(TokenType::END_OF_FILE);
 }
 
 
@@ -79,7 +80,7 @@ void Scanner::scan_next() {
             break;
     
         case '\n':
-            line++;
+            this->new_line();
             break;
         default:
             if (is_digit(c)) {
@@ -97,8 +98,8 @@ void Scanner::scan_next() {
 
 void Scanner::handle_string() {
     while (this->peek() != '"' && !this->check_at_end()) {
-        if (this->peek() == '\n') line++;
         this->advance();
+        if (this->program[this->current - 1] == '\n') this->new_line();
     }
 
     if (this->check_at_end()) {
@@ -112,7 +113,8 @@ void Scanner::handle_string() {
     // Trim the surrounding quotes.
     auto size = (this->current - 1) - (this->start + 1);
     std::string_view v = this->program.substr(start + 1, size);
-    this->add_token(STRING, std::make_shared<std::string>(v));
+    this->add_token(STRING, static_cast<Symbol>(this->constants.size()));
+    this->constants.push_back(symbols.string(symbols.intern(v)));
 }
 
 void Scanner::handle_number() {
@@ -127,7 +129,8 @@ void Scanner::handle_number() {
     }
     uint32_t len = this->current - this->start;
     double num = std::stod(std::string(this->program.substr(this->start, len)));
-    this->add_token(NUMBER, num);
+    this->add_token(NUMBER, static_cast<Symbol>(this->constants.size()));
+    this->constants.push_back(num);
 }
 
 
@@ -176,13 +179,22 @@ char Scanner::advance() {
 
 
 void Scanner::add_token(TokenType type) {
-    add_token(type, None());
+    Symbol symbol = 0;
+    if (type == IDENTIFIER || type == THIS || type == SUPER) {
+        symbol = symbols.intern(this->program.substr(this->start, this->current - this->start));
+    }
+    this->add_token(type, symbol);
+}
+
+
+void Scanner::add_token(TokenType type, Symbol symbol) {
+    this->tokens.push_back(Token {type, Span {this->start, this->current - this->start}, symbol});
 }
 
 
-void Scanner::add_token(TokenType type, Object literal) {
-    auto lexeme = program.substr(start, current - start);
-    tokens.emplace_back(type, lexeme, std::move(literal), line);
+void Scanner::new_line() {
+    this->line++;
+    this->lines.push_back(this->current);
 }
 
 
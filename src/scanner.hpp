@@ -8,23 +8,26 @@
 #include <string_view>
 
 #include "token.hpp"
+#include "node.hpp"
 
 struct Scanner {
 
     static const std::unordered_map<std::string_view, TokenType> keywords;
 
-    const std::string& program_;
     const std::string_view program;
 
     std::vector<Token>& tokens;
+    std::vector<uint32_t>& lines;
+    std::vector<Object>& constants;
 
     uint32_t start = 0;
     uint32_t current = 0;
     uint32_t line = 1;
 
-    explicit Scanner(const std::string&, std::vector<Token>&);
+    explicit Scanner(Program&);
 
-    std::vector<Token> scan();
+    // Fills in the program's tokens, line table and constants
+    void scan();
 
     void scan_next();
 
@@ -43,7 +46,9 @@ struct Scanner {
 
     void add_token(TokenType type);
 
-    void add_token(TokenType type, Object literal);
+    void add_token(TokenType type, Symbol symbol);
+
+    void new_line();
 
     bool check_at_end() const;
 
@@ -0,0 +1,148 @@
+#include "specialization.hpp"
+
+
+std::string_view specialization_name(Specialization specialization) {
+    switch (specialization) {
+        using enum Specialization;
+        case UNINITIALIZED: return "uninitialized";
+        case GENERIC: return "generic";
+        case NUMBER_ADD: return "number-add";
+        case NUMBER_SUBTRACT: return "number-subtract";
+        case NUMBER_MULTIPLY: return "number-multiply";
+        case NUMBER_DIVIDE: return "number-divide";
+        case NUMBER_LESS: return "number-less";
+        case NUMBER_LESS_EQUAL: return "number-less-equal";
+        case NUMBER_GREATER: return "number-greater";
+        case NUMBER_GREATER_EQUAL: return "number-greater-equal";
+        case NUMBER_EQUAL: return "number-equal";
+        case NUMBER_NOT_EQUAL: return "number-not-equal";
+        case STRING_CONCAT: return "string-concat";
+        case NUMBER_NEGATE: return "number-negate";
+        case BOOL_NOT: return "bool-not";
+        case INSTANCE_FIELD: return "instance-field";
+    }
+    return "unknown";
+}
+
+
+namespace {
+
+struct SpecializationDumper {
+    const Program& program;
+    std::ostream& out;
+
+    void site(const Token& tk, std::string_view prefix, std::string_view state) {
+        this->out << "[line " << this->program.line(tk) << "] " << prefix << this->program.text(tk) << ' ' << state << '\n';
+    }
+
+    void site(const Token& tk, std::string_view prefix, Specialization specialization) {
+        this->site(tk, prefix, specialization_name(specialization));
+    }
+
+    void statements(std::span<StatementNode* const> stmts) {
+        for (const auto& stmt : stmts) {
+            this->statement(*stmt);
+        }
+    }
+
+    void function(const FunctionDeclarationNode& func) {
+        this->statements(func.body->stmts);
+    }
+
+    void statement(const StatementNode& stmt) {
+        switch (stmt.get_type()) {
+            case StatementType::PRINT: this->expression(*stmt.get_print_statement_node()->expr); break;
+            case StatementType::EXPRESSION: this->expression(*stmt.get_expression_statement_node()->expr); break;
+            case StatementType::VARIABLE:
+                if (auto init = stmt.get_variable_statement_node()->initializer) this->expression(*init);
+                break;
+            case StatementType::BLOCK: this->statements(stmt.get_block_statement_node()->stmts); break;
+            case StatementType::IF: {
+                const IfStatementNode& if_stmt = *stmt.get_if_statement_node();
+                this->expression(*if_stmt.condition);
+                this->statement(*if_stmt.then_branch);
+                if (if_stmt.else_branch) this->statement(*if_stmt.else_branch);
+                break;
+            }
+            case StatementType::WHILE:
+                this->expression(*stmt.get_while_statement_node()->condition);
+                this->statement(*stmt.get_while_statement_node()->body);
+                break;
+            case StatementType::BREAK: break;
+            case StatementType::RETURN:
+                if (auto expr = stmt.get_return_statement_node()->expr) this->expression(*expr);
+                break;
+            case StatementType::FUNCTION: this->function(*stmt.get_function_declaration_node()); break;
+            case StatementType::CLASS:
+                for (const auto& method : stmt.get_class_declaration_node()->methods) {
+                    this->function(*method);
+                }
+                break;
+        }
+    }
+
+    void expression(const ExpressionNode& expr) {
+        switch (expr.get_type()) {
+            case ExpressionType::BINARYOP: {
+                const BinaryNode& bin = *expr.get_binary_node();
+                this->expression(*bin.left);
+                this->site(bin.oper, "", bin.specialization);
+                this->expression(*bin.right);
+                break;
+            }
+            case ExpressionType::UNARYOP: {
+                const UnaryNode& unary = *expr.get_unary_node();
+                this->site(unary.oper, "", unary.specialization);
+                this->expression(*unary.operand);
+                break;
+            }
+            case ExpressionType::GET: {
+                const GetNode& get = *expr.get_get_node();
+                this->expression(*get.object);
+                this->site(get.name, ".", get.specialization);
+                break;
+            }
+            case ExpressionType::ASSIGNMENT: this->expression(*expr.get_assignment_node()->expr); break;
+            case ExpressionType::LOGICAL:
+                this->expression(*expr.get_logical_node()->left);
+                this->expression(*expr.get_logical_node()->right);
+                break;
+            case ExpressionType::CALL: {
+                const CallNode& call = *expr.get_call_node();
+                this->expression(*call.callee);
+                for (const ExpressionNode* argument : call.args) this->expression(*argument);
+                break;
+            }
+            case ExpressionType::SET:
+                this->expression(*expr.get_set_node()->object);
+                this->expression(*expr.get_set_node()->value);
+                break;
+            case ExpressionType::LOCAL_LESS_CONST:
+                this->site(expr.get_original()->get_binary_node()->oper, "", "fused-local-less-const");
+                break;
+            case ExpressionType::INCREMENT_LOCAL:
+                this->site(expr.get_original()->get_assignment_node()->expr->get_binary_node()->oper, "", "fused-increment-local");
+                break;
+            case ExpressionType::THIS_GET:
+                this->site(expr.get_this_get_node()->name, ".", "fused-this-get");
+                break;
+            case ExpressionType::CALL_GLOBAL:
+                this->expression(*expr.get_original());
+                break;
+            case ExpressionType::LITERAL:
+            case ExpressionType::VARIABLE:
+            case ExpressionType::THIS:
+                break;
+        }
+    }
+};
+
+}
+
+
+void dump_specializations(const Program& program, std::ostream& out) {
+    SpecializationDumper dumper {program, out};
+    for (const auto& stmt : program.statements) {
+        dumper.statement(*stmt);
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <ostream>
+#include <span>
+#include <string_view>
+#include "node.hpp"
+
+std::string_view specialization_name(Specialization);
+
+// Prints the current specialization of every binary, unary and property
+// access site in the program, in source order.
+void dump_specializations(const Program&, std::ostream&);
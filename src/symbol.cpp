@@ -0,0 +1,44 @@
+#include <functional>
+#include "symbol.hpp"
+
+
+constinit SymbolTable symbols {};
+
+
+// Slot holding `text`, or the empty slot where it belongs
+size_t SymbolTable::slot_of(std::string_view text) const {
+    size_t mask = this->slots.size() - 1;
+    for (size_t i = std::hash<std::string_view>{}(text) & mask;; i = (i + 1) & mask) {
+        Symbol entry = this->slots[i];
+        if (entry == 0 || this->strings[entry - 1]->value == text) {
+            return i;
+        }
+    }
+}
+
+
+void SymbolTable::grow() {
+    std::vector<Symbol> old = std::move(this->slots);
+    this->slots.assign(old.empty() ? 64 : old.size() * 2, 0);
+    for (Symbol entry : old) {
+        if (entry != 0) {
+            this->slots[this->slot_of(this->strings[entry - 1]->value)] = entry;
+        }
+    }
+}
+
+
+Symbol SymbolTable::intern(std::string_view text) {
+    // Keep the table at most half full
+    if ((this->strings.size() + 1) * 2 > this->slots.size()) {
+        this->grow();
+    }
+    size_t slot = this->slot_of(text);
+    if (this->slots[slot] != 0) {
+        return this->slots[slot] - 1;
+    }
+    Ref<LoxString> string = make_ref<LoxString>(LoxString::Text(text));
+    this->strings.push_back(string.detach());
+    this->slots[slot] = static_cast<Symbol>(this->strings.size());
+    return this->slots[slot] - 1;
+}
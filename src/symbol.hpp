@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "value.hpp"
+
+
+// Index of an interned name or string constant
+using Symbol = uint32_t;
+
+
+// Interns identifiers and string literals. Each distinct text gets one
+// stable Symbol and one canonical LoxString, so runtime lookups key on a
+// small integer instead of hashing the text again, and equal literals are
+// the same object. Interned strings live until the program exits.
+class SymbolTable {
+    std::vector<LoxString*> strings;
+    // Open addressing over symbol + 1, with 0 for an empty slot
+    std::vector<Symbol> slots;
+
+    size_t slot_of(std::string_view) const;
+    void grow();
+
+public:
+    constexpr SymbolTable() = default;
+
+    Symbol intern(std::string_view);
+
+    std::string_view name(Symbol symbol) const {
+        return this->strings[symbol]->value;
+    }
+
+    Value string(Symbol symbol) const {
+        return Value(this->strings[symbol]);
+    }
+
+    size_t size() const {
+        return this->strings.size();
+    }
+};
+
+extern constinit SymbolTable symbols;
+
+
+// Names the runtime looks up itself
+namespace names {
+    inline const Symbol INIT = symbols.intern("init");
+    inline const Symbol THIS = symbols.intern("this");
+}
@@ -1,20 +1,17 @@
 #include "token.hpp"
 
 std::ostream& operator<<(std::ostream& os, const Token& t) {
-    return os << "[" << t.line << "] " << t.lexeme << " -> [type: " << t.type << "] " << t.val;
-}
-
-
-std::ostream& operator<<(std::ostream& os, const None&) {
-    return os << "None";
+    return os << "[" << t.span.start << ", " << t.span.length << "] -> [type: " << t.type << "] " << t.symbol;
 }
 
 
 std::ostream& operator<<(std::ostream& os, const Object& v) {
-    std::visit([&os](auto&& arg) {
-        os << arg;  // dispatches to correct overload
-    }, v);
-    return os;
+    switch (v.type()) {
+        case ValueType::NIL: return os << "None";
+        case ValueType::NUMBER: return os << v.as_number();
+        case ValueType::BOOL: return os << v.as_bool();
+        default: return os << v.object();
+    }
 }
 
 std::ostream& operator<<(std::ostream& os, const TokenType& v) {
@@ -4,11 +4,11 @@
 #include <compare>
 #include <array>
 #include <utility>
-#include <variant>
 #include <memory>
 #include <string_view>
 #include <string>
 #include <iostream>
+#include "symbol.hpp"
 
 
 enum class TokenType: uint8_t {
@@ -57,28 +57,29 @@ enum class TokenType: uint8_t {
     _COUNT
 };
 
-struct None {
-    constexpr auto operator<=>(const None&) const = default;
-};
-
-using Number = double;
-using String = std::shared_ptr<std::string>;
+using Object = Value;
 
-class LoxCallable;
-struct LoxInstance;
-
-using Object = std::variant<None, Number, String, bool, std::shared_ptr<LoxCallable>, std::shared_ptr<LoxInstance>>;
+// Where a token's text sits in its program's source
+struct Span {
+    uint32_t start = 0;
+    uint32_t length = 0;
+};
 
+// 16 bytes, so the AST holds tokens by value and the scanner's vector of them
+// can go once parsing is done. The line a token is on comes from the
+// program's line table (Program::line), and the value of a literal from its
+// constant table.
 struct Token {
     TokenType type = TokenType::AND;
-    std::string_view lexeme {};
-    Object val = None();
-    uint32_t line = 0;
+    Span span {};
+    // Interned lexeme of identifiers, `this` and `super`. For number and
+    // string literals, the index of the value in Program::constants.
+    Symbol symbol = 0;
 };
+static_assert(sizeof(Token) == 16);
 
 
 std::ostream& operator<<(std::ostream& os, const Token& t);
-std::ostream& operator<<(std::ostream& os, const None& t);
 std::ostream& operator<<(std::ostream& os, const Object& v);
 std::ostream& operator<<(std::ostream& os, const TokenType& v);
 
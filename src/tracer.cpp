@@ -0,0 +1,565 @@
+#include <iostream>
+#include "tracer.hpp"
+#include "lox_instance.hpp"
+
+
+namespace {
+
+struct TraceValue {
+    TraceKind kind;
+    uint32_t reg;
+    Object value;
+};
+
+struct RecordedVariable {
+    TraceValue value;
+    bool assigned;
+};
+
+struct RecordedField {
+    LoxInstance* instance;
+    Symbol name;
+    TraceValue value;
+};
+
+enum class Flow {
+    NEXT,
+    BREAK,
+    ABORT,
+};
+
+TraceKind kind_of(const Object& value) {
+    if (value.is_number()) return TraceKind::NUMBER;
+    if (value.is_bool()) return TraceKind::BOOL;
+    return TraceKind::OBJECT;
+}
+
+
+// Records one loop iteration by evaluating it against a private copy of
+// every value it touches, so nothing becomes visible until the trace runs.
+struct TraceRecorder {
+    Interpreter& interpreter;
+    Trace trace;
+    // Slots the loop body declares, by the scope declaring them
+    std::vector<std::vector<uint32_t>> scopes;
+    std::unordered_map<uint32_t, TraceValue> locals;
+    std::vector<RecordedVariable> variables;
+    std::vector<RecordedField> fields;
+
+    explicit TraceRecorder(Interpreter& interpreter): interpreter{interpreter} {}
+
+    TraceValue fresh(const Object& value) {
+        TraceKind kind = kind_of(value);
+        uint32_t reg = kind == TraceKind::OBJECT ? this->trace.object_registers++ : this->trace.number_registers++;
+        return TraceValue{kind, reg, value};
+    }
+
+    void emit(TraceOp op, TraceKind kind, uint32_t dst, uint32_t a = 0, uint32_t b = 0, uint8_t type = 0) {
+        this->trace.code.push_back(TraceInstruction{op, kind, type, dst, a, b});
+    }
+
+    TraceValue constant(const Object& value) {
+        TraceValue v = this->fresh(value);
+        if (v.kind == TraceKind::OBJECT) {
+            this->trace.constants.push_back(value);
+            this->emit(TraceOp::CONSTANT, v.kind, v.reg, static_cast<uint32_t>(this->trace.constants.size() - 1));
+        } else {
+            this->trace.numbers.push_back(v.kind == TraceKind::NUMBER ? value.as_number() : double(value.as_bool()));
+            this->emit(TraceOp::CONSTANT, v.kind, v.reg, static_cast<uint32_t>(this->trace.numbers.size() - 1));
+        }
+        return v;
+    }
+
+    uint32_t name(const Token& tk) {
+        this->trace.names.push_back(&tk);
+        return static_cast<uint32_t>(this->trace.names.size() - 1);
+    }
+
+    uint32_t commit() {
+        std::vector<TraceStore> stores;
+        for (size_t i = 0; i < this->variables.size(); i++) {
+            if (this->variables[i].assigned) {
+                const TraceValue& v = this->variables[i].value;
+                stores.push_back(TraceStore{static_cast<uint32_t>(i), v.kind, v.reg});
+            }
+        }
+        this->trace.commits.push_back(std::move(stores));
+        return static_cast<uint32_t>(this->trace.commits.size() - 1);
+    }
+
+    // Finds the variable outside the loop body `expr` refers to, or a
+    // variable declared in the body if `local` is set.
+    std::optional<uint32_t> outer_variable(const ExpressionNode& expr, TraceValue*& local) {
+        local = nullptr;
+        Resolution variable = expr.get_variable();
+        Object* slot;
+        if (variable.kind == VariableKind::GLOBAL) {
+            slot = this->interpreter.global_env->find(variable.index);
+        } else {
+            // Captured variables live in cells; leave those to the tree-walker
+            if (variable.kind != VariableKind::SLOT) {
+                return std::nullopt;
+            }
+            if (auto body = this->locals.find(variable.index); body != this->locals.end()) {
+                local = &body->second;
+                return 0;
+            }
+            slot = &this->interpreter.frame.slots[variable.index];
+        }
+        if (!slot) {
+            return std::nullopt;
+        }
+
+        for (size_t i = 0; i < this->trace.variables.size(); i++) {
+            const Resolution& other = this->trace.variables[i];
+            if (other.kind == variable.kind && other.index == variable.index) {
+                return static_cast<uint32_t>(i);
+            }
+        }
+        this->trace.variables.push_back(variable);
+        // Loaded lazily on first read
+        this->variables.push_back(RecordedVariable{TraceValue{kind_of(*slot), UINT32_MAX, *slot}, false});
+        return static_cast<uint32_t>(this->trace.variables.size() - 1);
+    }
+
+    std::optional<TraceValue> read(const ExpressionNode& expr) {
+        TraceValue* local;
+        auto index = this->outer_variable(expr, local);
+        if (!index.has_value()) return std::nullopt;
+        if (local) return *local;
+
+        TraceValue& v = this->variables[index.value()].value;
+        if (v.reg == UINT32_MAX) {
+            v = this->fresh(v.value);
+            this->emit(TraceOp::LOAD, v.kind, v.reg, index.value(), 0, static_cast<uint8_t>(v.value.type()));
+        }
+        return v;
+    }
+
+    bool write(const ExpressionNode& expr, const TraceValue& value) {
+        TraceValue* local;
+        auto index = this->outer_variable(expr, local);
+        if (!index.has_value()) return false;
+        if (local) {
+            *local = value;
+        } else {
+            this->variables[index.value()] = RecordedVariable{value, true};
+        }
+        return true;
+    }
+
+    // Guards that later iterations see the same truthiness as this one
+    bool truthy(const TraceValue& v) {
+        if (v.kind == TraceKind::OBJECT) {
+            return this->interpreter.is_truthy(v.value);
+        }
+        bool result = this->interpreter.is_truthy(v.value);
+        this->emit(result ? TraceOp::GUARD_TRUE : TraceOp::GUARD_FALSE, v.kind, 0, v.reg);
+        return result;
+    }
+
+    std::optional<TraceValue> expression(const ExpressionNode& expr) {
+        switch (expr.get_type()) {
+            case ExpressionType::LITERAL:
+                return this->constant(*expr.get_literal_node()->value);
+            case ExpressionType::VARIABLE:
+            case ExpressionType::THIS:
+                return this->read(expr);
+            case ExpressionType::ASSIGNMENT: {
+                const AssignmentNode& assign = *expr.get_assignment_node();
+                auto value = this->expression(*assign.expr);
+                if (!value.has_value() || !this->write(expr, value.value())) return std::nullopt;
+                return value;
+            }
+            case ExpressionType::UNARYOP: {
+                const UnaryNode& unary = *expr.get_unary_node();
+                auto operand = this->expression(*unary.operand);
+                if (!operand.has_value()) return std::nullopt;
+                if (unary.oper.type == TokenType::MINUS) {
+                    if (operand->kind != TraceKind::NUMBER) return std::nullopt;
+                    TraceValue v = this->fresh(-operand->value.checked_number());
+                    this->emit(TraceOp::NEGATE, v.kind, v.reg, operand->reg);
+                    return v;
+                }
+                if (unary.oper.type != TokenType::BANG) return std::nullopt;
+                bool result = !this->interpreter.is_truthy(operand->value);
+                if (operand->kind == TraceKind::OBJECT) {
+                    return this->constant(result);
+                }
+                TraceValue v = this->fresh(result);
+                this->emit(TraceOp::NOT, v.kind, v.reg, operand->reg);
+                return v;
+            }
+            case ExpressionType::BINARYOP:
+                return this->binary(*expr.get_binary_node());
+            case ExpressionType::LOGICAL: {
+                const LogicalNode& logical = *expr.get_logical_node();
+                auto left = this->expression(*logical.left);
+                if (!left.has_value()) return std::nullopt;
+                bool truth = this->truthy(left.value());
+                if (logical.oper.type == TokenType::OR ? truth : !truth) {
+                    return left;
+                }
+                return this->expression(*logical.right);
+            }
+            case ExpressionType::GET: {
+                const GetNode& get = *expr.get_get_node();
+                auto object = this->expression(*get.object);
+                if (!object.has_value()) return std::nullopt;
+                if (!object->value.is_instance()) return std::nullopt;
+                LoxInstance* instance = object->value.as<LoxInstance>();
+                std::optional<Object> field;
+                for (auto f = this->fields.rbegin(); f != this->fields.rend(); ++f) {
+                    if (f->instance == instance && f->name == get.name.symbol) {
+                        field = f->value.value;
+                        break;
+                    }
+                }
+                if (!field.has_value()) {
+                    // Method lookups stay in the tree-walker
+                    auto found = instance->fields.find(get.name.symbol);
+                    if (found == instance->fields.end()) return std::nullopt;
+                    field = found->second;
+                }
+                TraceValue v = this->fresh(field.value());
+                this->emit(TraceOp::GET_FIELD, v.kind, v.reg, object->reg, this->name(get.name), static_cast<uint8_t>(v.value.type()));
+                return v;
+            }
+            case ExpressionType::SET: {
+                const SetNode& set = *expr.get_set_node();
+                auto object = this->expression(*set.object);
+                if (!object.has_value()) return std::nullopt;
+                if (!object->value.is_instance()) return std::nullopt;
+                LoxInstance* instance = object->value.as<LoxInstance>();
+                auto value = this->expression(*set.value);
+                if (!value.has_value()) return std::nullopt;
+                this->fields.push_back(RecordedField{instance, set.name.symbol, value.value()});
+                this->emit(TraceOp::SET_FIELD, value->kind, value->reg, object->reg, this->name(set.name));
+                return value;
+            }
+            case ExpressionType::CALL:
+                return std::nullopt;
+            case ExpressionType::LOCAL_LESS_CONST:
+            case ExpressionType::INCREMENT_LOCAL:
+            case ExpressionType::THIS_GET:
+            case ExpressionType::CALL_GLOBAL:
+                return this->expression(*expr.get_original());
+        }
+        return std::nullopt;
+    }
+
+    std::optional<TraceValue> binary(const BinaryNode& bin) {
+        auto left = this->expression(*bin.left);
+        if (!left.has_value()) return std::nullopt;
+        auto right = this->expression(*bin.right);
+        if (!right.has_value()) return std::nullopt;
+
+        if (bin.oper.type == TokenType::EQUAL_EQUAL || bin.oper.type == TokenType::BANG_EQUAL) {
+            bool equal = this->interpreter.is_equal(left->value, right->value);
+            bool result = bin.oper.type == TokenType::EQUAL_EQUAL ? equal : !equal;
+            if (left->kind != right->kind) {
+                return this->constant(result);
+            }
+            if (left->kind == TraceKind::OBJECT) {
+                if (left->value.is_nil() && right->value.is_nil()) {
+                    return this->constant(result);
+                }
+                return std::nullopt;
+            }
+            TraceValue v = this->fresh(result);
+            this->emit(bin.oper.type == TokenType::EQUAL_EQUAL ? TraceOp::EQUAL : TraceOp::NOT_EQUAL, v.kind, v.reg, left->reg, right->reg);
+            return v;
+        }
+
+        // Everything else needs two numbers, otherwise the tree-walker reports the error
+        if (left->kind != TraceKind::NUMBER || right->kind != TraceKind::NUMBER) {
+            return std::nullopt;
+        }
+        double l = left->value.as_number();
+        double r = right->value.as_number();
+        Object result;
+        TraceOp op;
+        switch (bin.oper.type) {
+            case TokenType::PLUS: op = TraceOp::ADD; result = l + r; break;
+            case TokenType::MINUS: op = TraceOp::SUBTRACT; result = l - r; break;
+            case TokenType::STAR: op = TraceOp::MULTIPLY; result = l * r; break;
+            case TokenType::SLASH: op = TraceOp::DIVIDE; result = l / r; break;
+            case TokenType::GREATER: op = TraceOp::GREATER; result = l > r; break;
+            case TokenType::GREATER_EQUAL: op = TraceOp::GREATER_EQUAL; result = l >= r; break;
+            case TokenType::LESS: op = TraceOp::LESS; result = l < r; break;
+            case TokenType::LESS_EQUAL: op = TraceOp::LESS_EQUAL; result = l <= r; break;
+            default: return std::nullopt;
+        }
+        TraceValue v = this->fresh(result);
+        this->emit(op, v.kind, v.reg, left->reg, right->reg);
+        return v;
+    }
+
+    Flow statement(const StatementNode& stmt) {
+        switch (stmt.get_type()) {
+            case StatementType::EXPRESSION:
+                return this->expression(*stmt.get_expression_statement_node()->expr).has_value() ? Flow::NEXT : Flow::ABORT;
+            case StatementType::PRINT: {
+                auto value = this->expression(*stmt.get_print_statement_node()->expr);
+                if (!value.has_value()) return Flow::ABORT;
+                this->emit(TraceOp::PRINT, value->kind, 0, value->reg);
+                return Flow::NEXT;
+            }
+            case StatementType::VARIABLE: {
+                const VariableDeclarationNode& var_dec = *stmt.get_variable_statement_node();
+                if (this->scopes.empty() || var_dec.variable.kind != VariableKind::SLOT) return Flow::ABORT;
+                auto value = var_dec.initializer ? this->expression(*var_dec.initializer) : this->constant(None());
+                if (!value.has_value()) return Flow::ABORT;
+                this->scopes.back().push_back(var_dec.variable.index);
+                this->locals.insert_or_assign(var_dec.variable.index, value.value());
+                return Flow::NEXT;
+            }
+            case StatementType::BLOCK: {
+                this->scopes.emplace_back();
+                Flow flow = Flow::NEXT;
+                for (const auto& s : stmt.get_block_statement_node()->stmts) {
+                    flow = this->statement(*s);
+                    if (flow != Flow::NEXT) break;
+                }
+                for (uint32_t slot : this->scopes.back()) {
+                    this->locals.erase(slot);
+                }
+                this->scopes.pop_back();
+                return flow;
+            }
+            case StatementType::IF: {
+                const IfStatementNode& if_stmt = *stmt.get_if_statement_node();
+                auto condition = this->expression(*if_stmt.condition);
+                if (!condition.has_value()) return Flow::ABORT;
+                if (this->truthy(condition.value())) {
+                    return this->statement(*if_stmt.then_branch);
+                }
+                return if_stmt.else_branch ? this->statement(*if_stmt.else_branch) : Flow::NEXT;
+            }
+            case StatementType::BREAK:
+                this->emit(TraceOp::BREAK, TraceKind::OBJECT, 0, 0, this->commit());
+                return Flow::BREAK;
+            case StatementType::WHILE:
+            case StatementType::RETURN:
+            case StatementType::FUNCTION:
+            case StatementType::CLASS:
+                return Flow::ABORT;
+        }
+        return Flow::ABORT;
+    }
+};
+
+
+Object to_object(TraceKind kind, uint32_t reg, const std::vector<double>& numbers, const std::vector<Object>& objects) {
+    switch (kind) {
+        case TraceKind::NUMBER: return numbers[reg];
+        case TraceKind::BOOL: return numbers[reg] != 0;
+        case TraceKind::OBJECT: return objects[reg];
+    }
+    return None();
+}
+
+struct PendingField {
+    LoxInstance* instance;
+    const Token* name;
+    Object value;
+};
+
+}
+
+
+Tracer::Tracer(Interpreter& interpreter): interpreter{interpreter} {}
+
+
+TraceResult Tracer::enter(const WhileStatementNode& stmt) {
+    TraceLoop& loop = this->loops[&stmt];
+    if (loop.blacklisted) {
+        return TraceResult::INTERPRET;
+    }
+    if (!loop.trace) {
+        if (++loop.iterations < this->hot_loop) {
+            return TraceResult::INTERPRET;
+        }
+        loop.iterations = 0;
+        loop.recordings++;
+        auto trace = this->record(stmt);
+        if (!trace.has_value()) {
+            this->stats.aborted++;
+            loop.blacklisted = loop.recordings >= this->max_recordings;
+            return TraceResult::INTERPRET;
+        }
+        this->stats.recorded++;
+        loop.side_exits = 0;
+        loop.trace = std::make_unique<Trace>(std::move(trace.value()));
+    }
+
+    TraceResult result = this->run(*loop.trace);
+    if (result == TraceResult::SIDE_EXIT && ++loop.side_exits > this->max_side_exits) {
+        // Keeps failing the same way: record a fresh path next time it gets hot
+        loop.trace.reset();
+        loop.blacklisted = loop.recordings >= this->max_recordings;
+    }
+    return result;
+}
+
+
+std::optional<Trace> Tracer::record(const WhileStatementNode& stmt) {
+    TraceRecorder recorder {this->interpreter};
+    auto condition = recorder.expression(*stmt.condition);
+    if (!condition.has_value() || !this->interpreter.is_truthy(condition->value)) {
+        return std::nullopt;
+    }
+    if (condition->kind != TraceKind::OBJECT) {
+        recorder.emit(TraceOp::EXIT_IF_FALSE, condition->kind, 0, condition->reg, recorder.commit());
+    }
+    if (recorder.statement(*stmt.body) == Flow::ABORT) {
+        return std::nullopt;
+    }
+    recorder.trace.iteration_commit = recorder.commit();
+    return std::move(recorder.trace);
+}
+
+
+TraceResult Tracer::run(const Trace& trace) {
+    auto start = std::chrono::steady_clock::now();
+    this->stats.entries++;
+
+    std::vector<Object*> variables;
+    variables.reserve(trace.variables.size());
+    for (const auto& variable : trace.variables) {
+        Object* slot = variable.kind == VariableKind::GLOBAL
+            ? this->interpreter.global_env->find(variable.index)
+            : &this->interpreter.frame.slots[variable.index];
+        if (!slot) {
+            this->stats.side_exits++;
+            return TraceResult::SIDE_EXIT;
+        }
+        variables.push_back(slot);
+    }
+
+    std::vector<double> numbers(trace.number_registers);
+    std::vector<Object> objects(trace.object_registers);
+    std::vector<PendingField> fields;
+    std::vector<Object> prints;
+
+    auto commit = [&](uint32_t index) {
+        for (const auto& store : trace.commits[index]) {
+            *variables[store.variable] = to_object(store.kind, store.reg, numbers, objects);
+        }
+        for (auto& field : fields) {
+            field.instance->set(*field.name, std::move(field.value));
+        }
+        for (const auto& value : prints) {
+            std::cout << stringify(value) << '\n';
+        }
+    };
+
+    std::optional<TraceResult> done;
+    while (!done.has_value()) {
+        fields.clear();
+        prints.clear();
+        for (size_t pc = 0; pc < trace.code.size() && !done.has_value(); pc++) {
+            const TraceInstruction& ins = trace.code[pc];
+            switch (ins.op) {
+                case TraceOp::LOAD: {
+                    const Object& value = *variables[ins.a];
+                    if (static_cast<uint8_t>(value.type()) != ins.type) {
+                        done = TraceResult::SIDE_EXIT;
+                    } else if (ins.kind == TraceKind::OBJECT) {
+                        objects[ins.dst] = value;
+                    } else {
+                        numbers[ins.dst] = ins.kind == TraceKind::NUMBER ? value.as_number() : double(value.as_bool());
+                    }
+                    break;
+                }
+                case TraceOp::CONSTANT:
+                    if (ins.kind == TraceKind::OBJECT) {
+                        objects[ins.dst] = trace.constants[ins.a];
+                    } else {
+                        numbers[ins.dst] = trace.numbers[ins.a];
+                    }
+                    break;
+                case TraceOp::ADD: numbers[ins.dst] = numbers[ins.a] + numbers[ins.b]; break;
+                case TraceOp::SUBTRACT: numbers[ins.dst] = numbers[ins.a] - numbers[ins.b]; break;
+                case TraceOp::MULTIPLY: numbers[ins.dst] = numbers[ins.a] * numbers[ins.b]; break;
+                case TraceOp::DIVIDE: numbers[ins.dst] = numbers[ins.a] / numbers[ins.b]; break;
+                case TraceOp::NEGATE: numbers[ins.dst] = -numbers[ins.a]; break;
+                case TraceOp::NOT: numbers[ins.dst] = numbers[ins.a] == 0; break;
+                case TraceOp::EQUAL: numbers[ins.dst] = numbers[ins.a] == numbers[ins.b]; break;
+                case TraceOp::NOT_EQUAL: numbers[ins.dst] = numbers[ins.a] != numbers[ins.b]; break;
+                case TraceOp::GREATER: numbers[ins.dst] = numbers[ins.a] > numbers[ins.b]; break;
+                case TraceOp::GREATER_EQUAL: numbers[ins.dst] = numbers[ins.a] >= numbers[ins.b]; break;
+                case TraceOp::LESS: numbers[ins.dst] = numbers[ins.a] < numbers[ins.b]; break;
+                case TraceOp::LESS_EQUAL: numbers[ins.dst] = numbers[ins.a] <= numbers[ins.b]; break;
+                case TraceOp::GET_FIELD: {
+                    LoxInstance* instance = objects[ins.a].as<LoxInstance>();
+                    Symbol name = trace.names[ins.b]->symbol;
+                    const Object* value = nullptr;
+                    for (auto f = fields.rbegin(); f != fields.rend(); ++f) {
+                        if (f->instance == instance && f->name->symbol == name) {
+                            value = &f->value;
+                            break;
+                        }
+                    }
+                    if (!value) {
+                        auto found = instance->fields.find(name);
+                        if (found != instance->fields.end()) value = &found->second;
+                    }
+                    if (!value || static_cast<uint8_t>(value->type()) != ins.type) {
+                        done = TraceResult::SIDE_EXIT;
+                    } else if (ins.kind == TraceKind::OBJECT) {
+                        objects[ins.dst] = *value;
+                    } else {
+                        numbers[ins.dst] = ins.kind == TraceKind::NUMBER ? value->as_number() : double(value->as_bool());
+                    }
+                    break;
+                }
+                case TraceOp::SET_FIELD: {
+                    LoxInstance* instance = objects[ins.a].as<LoxInstance>();
+                    fields.push_back(PendingField{instance, trace.names[ins.b], to_object(ins.kind, ins.dst, numbers, objects)});
+                    break;
+                }
+                case TraceOp::PRINT:
+                    prints.push_back(to_object(ins.kind, ins.a, numbers, objects));
+                    break;
+                case TraceOp::GUARD_TRUE:
+                    if (numbers[ins.a] == 0) done = TraceResult::SIDE_EXIT;
+                    break;
+                case TraceOp::GUARD_FALSE:
+                    if (numbers[ins.a] != 0) done = TraceResult::SIDE_EXIT;
+                    break;
+                case TraceOp::EXIT_IF_FALSE:
+                    if (numbers[ins.a] == 0) {
+                        commit(ins.b);
+                        done = TraceResult::LOOP_EXIT;
+                    }
+                    break;
+                case TraceOp::BREAK:
+                    commit(ins.b);
+                    this->stats.iterations++;
+                    done = TraceResult::LOOP_EXIT;
+                    break;
+            }
+        }
+        if (!done.has_value()) {
+            commit(trace.iteration_commit);
+            this->stats.iterations++;
+        }
+    }
+
+    if (done.value() == TraceResult::SIDE_EXIT) {
+        this->stats.side_exits++;
+    }
+    this->stats.time += std::chrono::steady_clock::now() - start;
+    return done.value();
+}
+
+
+void Tracer::print_stats() const {
+    std::cerr << "traces recorded:    " << this->stats.recorded << '\n'
+              << "recordings aborted: " << this->stats.aborted << '\n'
+              << "trace entries:      " << this->stats.entries << '\n'
+              << "trace iterations:   " << this->stats.iterations << '\n'
+              << "guard failures:     " << this->stats.side_exits << '\n'
+              << "time in traces:     " << std::chrono::duration<double, std::milli>(this->stats.time).count() << " ms\n";
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include "node.hpp"
+#include "interpreter.hpp"
+
+enum class TraceOp : uint8_t {
+    LOAD,
+    CONSTANT,
+    ADD,
+    SUBTRACT,
+    MULTIPLY,
+    DIVIDE,
+    NEGATE,
+    NOT,
+    EQUAL,
+    NOT_EQUAL,
+    GREATER,
+    GREATER_EQUAL,
+    LESS,
+    LESS_EQUAL,
+    GET_FIELD,
+    SET_FIELD,
+    PRINT,
+    GUARD_TRUE,
+    GUARD_FALSE,
+    EXIT_IF_FALSE,
+    BREAK,
+};
+
+// NUMBER and BOOL values live in the double register file, everything else
+// in the Object one.
+enum class TraceKind : uint8_t {
+    NUMBER,
+    BOOL,
+    OBJECT,
+};
+
+struct TraceInstruction {
+    TraceOp op;
+    TraceKind kind;
+    uint8_t type; // expected variant index for OBJECT loads
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+};
+
+struct TraceStore {
+    uint32_t variable;
+    TraceKind kind;
+    uint32_t reg;
+};
+
+// One recorded loop iteration: the condition followed by the path taken
+// through the body, with guards wherever a later iteration could differ.
+// Writes are buffered and only committed when an iteration completes, so a
+// failed guard can hand the whole iteration back to the tree-walker.
+struct Trace {
+    std::vector<TraceInstruction> code;
+    // Variables the loop body reads or writes outside of its own scopes:
+    // globals, or slots of the frame the loop runs in
+    std::vector<Resolution> variables;
+    std::vector<double> numbers;
+    std::vector<Object> constants;
+    std::vector<const Token*> names;
+    std::vector<std::vector<TraceStore>> commits;
+    uint32_t iteration_commit = 0;
+    uint32_t number_registers = 0;
+    uint32_t object_registers = 0;
+};
+
+struct TraceLoop {
+    uint32_t iterations = 0;
+    uint32_t recordings = 0;
+    uint32_t side_exits = 0;
+    bool blacklisted = false;
+    std::unique_ptr<Trace> trace;
+};
+
+struct TraceStats {
+    uint64_t recorded = 0;
+    uint64_t aborted = 0;
+    uint64_t entries = 0;
+    uint64_t iterations = 0;
+    uint64_t side_exits = 0;
+    std::chrono::nanoseconds time {0};
+};
+
+enum class TraceResult {
+    INTERPRET,  // run the next iteration in the tree-walker
+    SIDE_EXIT,  // a guard failed, run the next iteration in the tree-walker
+    LOOP_EXIT,  // the trace finished the loop
+};
+
+// Tracing JIT for while-loops run by the tree-walker. Once a loop has run
+// `hot_loop` iterations one iteration is recorded into a Trace, which then
+// runs the remaining iterations without walking the tree.
+struct Tracer {
+    Interpreter& interpreter;
+    uint32_t hot_loop = 50;
+    uint32_t max_recordings = 4;
+    uint32_t max_side_exits = 16;
+    std::unordered_map<const WhileStatementNode*, TraceLoop> loops;
+    TraceStats stats;
+
+    explicit Tracer(Interpreter&);
+
+    // Called before every iteration of `stmt`
+    [[nodiscard]] TraceResult enter(const WhileStatementNode&);
+
+    [[nodiscard]] std::optional<Trace> record(const WhileStatementNode&);
+    [[nodiscard]] TraceResult run(const Trace&);
+
+    void print_stats() const;
+};
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <bit>
+#include <compare>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "gc.hpp"
+
+
+struct None {
+    constexpr auto operator<=>(const None&) const = default;
+};
+
+using Number = double;
+
+
+// A string is either flat text or a rope: the concatenation of two other
+// strings, kept as a node so that building a string piece by piece doesn't
+// copy everything built so far. A rope is flattened in place the first time
+// its text is read, and concatenation keeps ropes height-balanced.
+struct LoxString: LoxObject {
+    // Strings shorter than this are concatenated by copying
+    static constexpr size_t SHORT = 64;
+
+    using Text = std::basic_string<char, std::char_traits<char>, PoolAllocator<char>>;
+
+    // Empty in a rope until it is flattened
+    mutable Text value;
+    mutable Ref<LoxString> left;
+    mutable Ref<LoxString> right;
+    size_t length;
+    // 0 when flat, otherwise one more than the taller child
+    mutable uint32_t height = 0;
+
+    explicit LoxString(Text value): value{std::move(value)}, length{this->value.size()} {}
+    LoxString(Ref<LoxString> left, Ref<LoxString> right);
+
+    std::string_view text() const {
+        if (this->height != 0) [[unlikely]] {
+            this->flatten();
+        }
+        return this->value;
+    }
+
+    void flatten() const;
+
+    void trace(GcVisitor& visitor) const override {
+        if (this->left) visitor.visit(this->left.get());
+        if (this->right) visitor.visit(this->right.get());
+    }
+
+    void clear() override {
+        this->left = nullptr;
+        this->right = nullptr;
+    }
+};
+
+inline size_t allocation_size(const LoxString& string) {
+    return sizeof(LoxString) + string.value.capacity();
+}
+
+class LoxCallable;
+struct LoxInstance;
+
+
+// Same order as the alternatives of the variant Value replaced
+enum class ValueType : uint8_t {
+    NIL,
+    NUMBER,
+    STRING,
+    BOOL,
+    CALLABLE,
+    INSTANCE,
+};
+
+
+// A Lox value in 8 bytes. Numbers are stored as plain doubles. nil, booleans
+// and heap pointers are stored in the payload of quiet NaNs that arithmetic
+// never produces. Pointers set the sign bit and keep their type in bits 48-49.
+class Value {
+    static constexpr uint64_t SIGN = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr uint64_t CANONICAL_NAN = 0x7ff8000000000000;
+    static constexpr uint64_t NIL_BITS = QNAN | 1;
+    static constexpr uint64_t FALSE_BITS = QNAN | 2;
+    static constexpr uint64_t TRUE_BITS = QNAN | 3;
+    static constexpr uint64_t UNDEFINED_BITS = QNAN | 4;
+    static constexpr uint64_t OBJECT = SIGN | QNAN;
+    static constexpr int KIND_SHIFT = 48;
+    static constexpr uint64_t KIND_MASK = uint64_t{3} << KIND_SHIFT;
+    static constexpr uint64_t POINTER_MASK = (uint64_t{1} << KIND_SHIFT) - 1;
+    static constexpr uint64_t STRING_KIND = uint64_t{0} << KIND_SHIFT;
+    static constexpr uint64_t CALLABLE_KIND = uint64_t{1} << KIND_SHIFT;
+    static constexpr uint64_t INSTANCE_KIND = uint64_t{2} << KIND_SHIFT;
+
+    uint64_t bits = NIL_BITS;
+
+    template<typename T>
+    static constexpr uint64_t kind_of() {
+        if constexpr (std::derived_from<T, LoxString>) {
+            return STRING_KIND;
+        } else if constexpr (std::derived_from<T, LoxCallable>) {
+            return CALLABLE_KIND;
+        } else {
+            static_assert(std::derived_from<T, LoxInstance>);
+            return INSTANCE_KIND;
+        }
+    }
+
+    bool is_kind(uint64_t kind) const {
+        return (this->bits & (OBJECT | KIND_MASK)) == (OBJECT | kind);
+    }
+
+    void retain() const {
+        if (this->is_object()) this->object()->retain();
+    }
+
+    void release() const {
+        if (this->is_object()) this->object()->release();
+    }
+
+public:
+    Value() = default;
+    Value(None) {}
+    Value(Number n): bits{std::bit_cast<uint64_t>(n)} {
+        // Keep a NaN with an unusual payload from being read as a tag
+        if ((this->bits & QNAN) == QNAN) {
+            this->bits = (this->bits & SIGN) | CANONICAL_NAN;
+        }
+    }
+    template<std::same_as<bool> B>
+    Value(B b): bits{b ? TRUE_BITS : FALSE_BITS} {}
+    template<typename T>
+    explicit Value(T* object): bits{OBJECT | kind_of<T>() | reinterpret_cast<uintptr_t>(static_cast<LoxObject*>(object))} {
+        this->retain();
+    }
+    template<typename T>
+    Value(const Ref<T>& ref): Value(ref.get()) {}
+    template<typename T>
+    Value(Ref<T>&& ref): bits{OBJECT | kind_of<T>() | reinterpret_cast<uintptr_t>(static_cast<LoxObject*>(ref.detach()))} {}
+
+    Value(const Value& other): bits{other.bits} {
+        this->retain();
+    }
+    Value(Value&& other) noexcept: bits{std::exchange(other.bits, NIL_BITS)} {}
+    Value& operator=(const Value& other) {
+        other.retain();
+        this->release();
+        this->bits = other.bits;
+        return *this;
+    }
+    Value& operator=(Value&& other) noexcept {
+        if (this != &other) {
+            this->release();
+            this->bits = std::exchange(other.bits, NIL_BITS);
+        }
+        return *this;
+    }
+    ~Value() {
+        this->release();
+    }
+
+    ValueType type() const {
+        if (this->is_number()) return ValueType::NUMBER;
+        if (this->is_object()) {
+            switch (this->bits & KIND_MASK) {
+                case STRING_KIND: return ValueType::STRING;
+                case CALLABLE_KIND: return ValueType::CALLABLE;
+                default: return ValueType::INSTANCE;
+            }
+        }
+        return this->bits == NIL_BITS ? ValueType::NIL : ValueType::BOOL;
+    }
+
+    // Fills a global slot until its declaration runs; never reaches Lox code
+    static Value undefined() {
+        Value value;
+        value.bits = UNDEFINED_BITS;
+        return value;
+    }
+
+    bool is_nil() const { return this->bits == NIL_BITS; }
+    bool is_undefined() const { return this->bits == UNDEFINED_BITS; }
+    bool is_number() const { return (this->bits & QNAN) != QNAN; }
+    bool is_bool() const { return (this->bits | 1) == TRUE_BITS; }
+    bool is_object() const { return (this->bits & OBJECT) == OBJECT; }
+    bool is_string() const { return this->is_kind(STRING_KIND); }
+    bool is_callable() const { return this->is_kind(CALLABLE_KIND); }
+    bool is_instance() const { return this->is_kind(INSTANCE_KIND); }
+
+    Number as_number() const { return std::bit_cast<Number>(this->bits); }
+    bool as_bool() const { return this->bits == TRUE_BITS; }
+    LoxObject* object() const { return reinterpret_cast<LoxObject*>(this->bits & POINTER_MASK); }
+    template<typename T>
+    T* as() const { return static_cast<T*>(this->object()); }
+    std::string_view as_string() const { return this->as<LoxString>()->text(); }
+
+    // Reads a number that was never type checked. Like std::get on the old
+    // variant, a mismatch throws instead of reinterpreting the bits.
+    Number checked_number() const {
+        if (!this->is_number()) throw std::bad_variant_access();
+        return this->as_number();
+    }
+
+    // Numbers compare by value, everything else by identity
+    bool equals(const Value& other) const {
+        if (this->is_number() && other.is_number()) {
+            return this->as_number() == other.as_number();
+        }
+        return this->bits == other.bits;
+    }
+};
+
+static_assert(sizeof(Value) == 8);
+static_assert(sizeof(void*) == 8, "Value keeps heap pointers in 48 bits");
+
+
+inline void trace(GcVisitor& visitor, const Value& value) {
+    if (value.is_object()) visitor.visit(value.object());
+}
+
+// Call before `holder` stores `value` in one of its fields
+inline void write_barrier(LoxObject& holder, const Value& value) {
+    if (value.is_object()) heap.write_barrier(&holder, value.object());
+}
+
+
+inline Value make_string(LoxString::Text text) {
+    return make_ref<LoxString>(std::move(text));
+}
+
+// `a + b` on two strings
+Value concat_strings(const Value& a, const Value& b);
+
+// The arguments of a call, in a buffer from the heap's size classes
+using Arguments = std::vector<Value, PoolAllocator<Value>>;
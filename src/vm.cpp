@@ -0,0 +1,343 @@
+#include <format>
+#include <iostream>
+#include "vm.hpp"
+#include "compiler.hpp"
+#include "lox_callable.hpp"
+#include "lox_class.hpp"
+#include "lox_instance.hpp"
+#include "lox.hpp"
+
+
+VM::VM(Interpreter& interpreter): interpreter{interpreter} {}
+
+
+void VM::interpret(const std::span<StatementNode*>& stmts) {
+    Compiler compiler {this->functions};
+    for (const auto& stmt : stmts) {
+        Chunk script = compiler.compile_script(*stmt, this->interpreter.repl_mode);
+        if (auto res = this->run(script); !res.has_value()) {
+            Lox::runtime_error(res.error());
+        }
+    }
+}
+
+
+std::expected<Object, InterpreterError> VM::run(const Chunk& chunk) {
+    const size_t base = this->stack.size();
+    const uint8_t* ip = chunk.code.data();
+
+    auto fail = [&](InterpreterError err) -> std::expected<Object, InterpreterError> {
+        this->stack.resize(base);
+        return std::unexpected(std::move(err));
+    };
+    auto numbers = [&]() {
+        return this->peek(0).is_number() && this->peek(1).is_number();
+    };
+    auto must_be_numbers = [&](uint16_t tk) {
+        return fail(InterpreterError(InterpreterErrorType::MustBeNumbers, *chunk.tokens[tk]));
+    };
+
+    while (true) {
+        OpCode op = static_cast<OpCode>(*ip++);
+        switch (op) {
+            case OpCode::CONSTANT: {
+                this->push(chunk.constants[read_u16(ip)]);
+                ip += 2;
+                break;
+            }
+            case OpCode::NIL: this->push(None()); break;
+            case OpCode::TRUE: this->push(true); break;
+            case OpCode::FALSE: this->push(false); break;
+            case OpCode::POP: this->stack.pop_back(); break;
+
+            case OpCode::GET_LOCAL: {
+                this->push(this->interpreter.frame.slots[read_u16(ip)]);
+                ip += 2;
+                break;
+            }
+            case OpCode::SET_LOCAL: {
+                this->interpreter.frame.slots[read_u16(ip)] = this->peek();
+                ip += 2;
+                break;
+            }
+            case OpCode::GET_CELL: {
+                this->push(this->interpreter.frame.cells[read_u16(ip)]->value);
+                ip += 2;
+                break;
+            }
+            case OpCode::SET_CELL: {
+                this->interpreter.frame.cells[read_u16(ip)]->set(this->peek());
+                ip += 2;
+                break;
+            }
+            case OpCode::GET_UPVALUE: {
+                this->push(this->interpreter.frame.upvalues[read_u16(ip)]->value);
+                ip += 2;
+                break;
+            }
+            case OpCode::SET_UPVALUE: {
+                this->interpreter.frame.upvalues[read_u16(ip)]->set(this->peek());
+                ip += 2;
+                break;
+            }
+            case OpCode::GET_GLOBAL: {
+                auto res = this->interpreter.global_env->get(read_u16(ip), *chunk.tokens[read_u16(ip + 2)]);
+                ip += 4;
+                if (!res.has_value()) {
+                    return fail(res.error());
+                }
+                this->push(std::move(res.value()));
+                break;
+            }
+            case OpCode::SET_GLOBAL: {
+                if (auto err = this->interpreter.global_env->assign(read_u16(ip), *chunk.tokens[read_u16(ip + 2)], this->peek()); err.has_value()) {
+                    return fail(err.value());
+                }
+                ip += 4;
+                break;
+            }
+            case OpCode::DEFINE: {
+                this->interpreter.global_env->define(read_u16(ip), this->pop());
+                ip += 2;
+                break;
+            }
+            case OpCode::DEFINE_LOCAL: {
+                this->interpreter.frame.slots[read_u16(ip)] = this->pop();
+                ip += 2;
+                break;
+            }
+            case OpCode::DEFINE_CELL: {
+                this->interpreter.frame.cells[read_u16(ip)] = make_ref<Upvalue>(this->pop());
+                ip += 2;
+                break;
+            }
+
+            case OpCode::EQUAL: {
+                bool v = this->interpreter.is_equal(this->peek(1), this->peek(0));
+                this->stack.pop_back();
+                this->peek() = v;
+                break;
+            }
+            case OpCode::NOT_EQUAL: {
+                bool v = !this->interpreter.is_equal(this->peek(1), this->peek(0));
+                this->stack.pop_back();
+                this->peek() = v;
+                break;
+            }
+            case OpCode::GREATER: {
+                if (!numbers()) return must_be_numbers(read_u16(ip));
+                bool v = this->peek(1).as_number() > this->peek(0).as_number();
+                this->stack.pop_back();
+                this->peek() = v;
+                ip += 2;
+                break;
+            }
+            case OpCode::GREATER_EQUAL: {
+                if (!numbers()) return must_be_numbers(read_u16(ip));
+                bool v = this->peek(1).as_number() >= this->peek(0).as_number();
+                this->stack.pop_back();
+                this->peek() = v;
+                ip += 2;
+                break;
+            }
+            case OpCode::LESS: {
+                if (!numbers()) return must_be_numbers(read_u16(ip));
+                bool v = this->peek(1).as_number() < this->peek(0).as_number();
+                this->stack.pop_back();
+                this->peek() = v;
+                ip += 2;
+                break;
+            }
+            case OpCode::LESS_EQUAL: {
+                if (!numbers()) return must_be_numbers(read_u16(ip));
+                bool v = this->peek(1).as_number() <= this->peek(0).as_number();
+                this->stack.pop_back();
+                this->peek() = v;
+                ip += 2;
+                break;
+            }
+            case OpCode::ADD: {
+                if (numbers()) {
+                    Number v = this->peek(1).as_number() + this->peek(0).as_number();
+                    this->stack.pop_back();
+                    this->peek() = v;
+                } else if (this->peek(0).is_string() && this->peek(1).is_string()) {
+                    Object v = concat_strings(this->peek(1), this->peek(0));
+                    this->stack.pop_back();
+                    this->peek() = std::move(v);
+                    if (heap.out_of_memory()) [[unlikely]] {
+                        return fail(InterpreterError(InterpreterErrorType::OutOfMemory, *chunk.tokens[read_u16(ip)]));
+                    }
+                } else {
+                    return fail(InterpreterError(InterpreterErrorType::BinOpValuesNotCompatible, *chunk.tokens[read_u16(ip)]));
+                }
+                ip += 2;
+                break;
+            }
+            case OpCode::SUBTRACT: {
+                if (!numbers()) return must_be_numbers(read_u16(ip));
+                Number v = this->peek(1).as_number() - this->peek(0).as_number();
+                this->stack.pop_back();
+                this->peek() = v;
+                ip += 2;
+                break;
+            }
+            case OpCode::MULTIPLY: {
+                if (!numbers()) return must_be_numbers(read_u16(ip));
+                Number v = this->peek(1).as_number() * this->peek(0).as_number();
+                this->stack.pop_back();
+                this->peek() = v;
+                ip += 2;
+                break;
+            }
+            case OpCode::DIVIDE: {
+                if (!numbers()) return must_be_numbers(read_u16(ip));
+                Number v = this->peek(1).as_number() / this->peek(0).as_number();
+                this->stack.pop_back();
+                this->peek() = v;
+                ip += 2;
+                break;
+            }
+            case OpCode::NOT: this->peek() = !this->interpreter.is_truthy(this->peek()); break;
+            case OpCode::NEGATE: this->peek() = -this->peek().checked_number(); break;
+
+            case OpCode::PRINT: {
+                std::cout << stringify(this->peek()) << '\n';
+                this->stack.pop_back();
+                break;
+            }
+            case OpCode::JUMP: {
+                ip += 2 + read_u16(ip);
+                break;
+            }
+            case OpCode::JUMP_IF_FALSE: {
+                if (!this->interpreter.is_truthy(this->peek())) {
+                    ip += read_u16(ip);
+                }
+                ip += 2;
+                break;
+            }
+            case OpCode::LOOP: {
+                if (heap.out_of_memory()) [[unlikely]] {
+                    return fail(InterpreterError(InterpreterErrorType::OutOfMemory, *chunk.tokens[read_u16(ip + 2)]));
+                }
+                ip -= read_u16(ip) - 4;
+                break;
+            }
+
+            case OpCode::CALL: {
+                uint16_t argc = read_u16(ip);
+                auto res = this->call_value(argc, *chunk.tokens[read_u16(ip + 2)]);
+                ip += 4;
+                if (!res.has_value()) {
+                    return fail(res.error());
+                }
+                this->stack.resize(this->stack.size() - argc);
+                this->peek() = std::move(res.value());
+                break;
+            }
+            case OpCode::CHECK_INSTANCE: {
+                if (!this->peek().is_instance()) {
+                    return fail(InterpreterError(InterpreterErrorType::NotInstanceSet, *chunk.tokens[read_u16(ip)]));
+                }
+                ip += 2;
+                break;
+            }
+            case OpCode::GET_PROPERTY: {
+                const Token& name = *chunk.tokens[read_u16(ip)];
+                ip += 2;
+                if (!this->peek().is_instance()) {
+                    return fail(InterpreterError(InterpreterErrorType::NotInstance, name));
+                }
+                auto res = this->peek().as<LoxInstance>()->get(name);
+                if (!res.has_value()) {
+                    return fail(res.error());
+                }
+                this->peek() = std::move(res.value());
+                break;
+            }
+            case OpCode::SET_PROPERTY: {
+                const Token& name = *chunk.tokens[read_u16(ip)];
+                ip += 2;
+                Object value = this->pop();
+                this->peek().as<LoxInstance>()->set(name, value);
+                this->peek() = std::move(value);
+                break;
+            }
+
+            case OpCode::FUNCTION: {
+                const FunctionDeclarationNode& func = *chunk.functions[read_u16(ip)];
+                ip += 2;
+                this->push(this->interpreter.make_function(func, false));
+                break;
+            }
+            case OpCode::CLASS: {
+                const ClassDeclarationNode& class_ = *chunk.classes[read_u16(ip)];
+                ip += 2;
+                MethodTable methods;
+                for (auto& method : class_.methods) {
+                    methods[method->name.symbol] = this->interpreter.make_function(*method, method->name.symbol == names::INIT);
+                }
+                this->push(make_ref<LoxClass>(symbols.name(class_.name.symbol), std::move(methods)));
+                break;
+            }
+            case OpCode::RETURN: {
+                Object v = this->pop();
+                this->stack.resize(base);
+                return v;
+            }
+        }
+    }
+}
+
+
+std::expected<Object, InterpreterError> VM::call_value(size_t argc, const Token& paren) {
+    const size_t args_begin = this->stack.size() - argc;
+    if (!this->stack[args_begin - 1].is_callable()) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::NotCallable, paren));
+    }
+    Ref<LoxCallable> callable {this->stack[args_begin - 1].as<LoxCallable>()};
+    if (argc != callable->arity()) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::Arity, paren, callable->arity(), argc));
+    }
+    if (heap.out_of_memory()) [[unlikely]] {
+        return std::unexpected(InterpreterError(InterpreterErrorType::OutOfMemory, paren));
+    }
+
+    if (auto lox_function = dynamic_cast<LoxFunction*>(callable.get())) {
+        return this->call_function(*lox_function, args_begin);
+    }
+    if (auto lox_class = dynamic_cast<LoxClass*>(callable.get())) {
+        auto inst = make_ref<LoxInstance>(lox_class);
+        if (auto init = lox_class->find_method(names::INIT)) {
+            return this->call_function(*init->bind(inst), args_begin);
+        }
+        return inst;
+    }
+
+    Arguments arguments(this->stack.begin() + args_begin, this->stack.end());
+    if (callable->call(this->interpreter, arguments) == Status::ERROR) {
+        return std::unexpected(this->interpreter.take_error());
+    }
+    return std::move(this->interpreter.result);
+}
+
+
+std::expected<Object, InterpreterError> VM::call_function(const LoxFunction& function, size_t args_begin) {
+    auto chunk = this->functions.find(function.declaration);
+    if (chunk == this->functions.end()) {
+        return std::unexpected(InterpreterError(InterpreterErrorType::NotCompiled, function.declaration->name));
+    }
+
+    auto caller = this->interpreter.push_frame(function, std::span(this->stack).subspan(args_begin));
+    if (!caller.has_value()) {
+        return std::unexpected(std::move(caller.error()));
+    }
+    auto res = this->run(chunk->second);
+    this->interpreter.pop_frame(caller.value());
+
+    if (res.has_value() && function.is_initializer) {
+        return function.receiver;
+    }
+    return res;
+}
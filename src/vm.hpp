@@ -0,0 +1,35 @@
+#pragma once
+
+#include <expected>
+#include <span>
+#include <vector>
+#include <unordered_map>
+#include "chunk.hpp"
+#include "interpreter.hpp"
+
+class LoxFunction;
+
+// Stack machine executing Compiler output. Shares the globals, the frames
+// holding locals and the runtime object model with the tree-walking
+// Interpreter; its own stack only holds temporaries.
+struct VM {
+    Interpreter& interpreter;
+    std::vector<Object> stack;
+    std::unordered_map<const FunctionDeclarationNode*, Chunk> functions;
+
+    explicit VM(Interpreter&);
+
+    void interpret(const std::span<StatementNode*>&);
+
+    [[nodiscard]] std::expected<Object, InterpreterError> run(const Chunk&);
+    [[nodiscard]] std::expected<Object, InterpreterError> call_value(size_t, const Token&);
+    [[nodiscard]] std::expected<Object, InterpreterError> call_function(const LoxFunction&, size_t);
+
+    void push(Object v) { this->stack.push_back(std::move(v)); }
+    Object pop() {
+        Object v = std::move(this->stack.back());
+        this->stack.pop_back();
+        return v;
+    }
+    Object& peek(size_t distance = 0) { return this->stack[this->stack.size() - 1 - distance]; }
+};
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Translates every .lox script in the given directories (default: bench/) with
+# --emit-cpp, compiles it against src/aot and reports any difference in output
+# or exit status from the interpreter.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+CXX=${CXX:-c++}
+WORK=${WORK:-/tmp/aot_diff}
+[ $# -eq 0 ] && set -- "$ROOT/bench"
+mkdir -p "$WORK"
+
+status=0
+for dir in "$@"; do
+    for script in "$dir"/*.lox; do
+        expected=$("$LOX" "$script" 2>&1; echo "exit $?")
+        if ! "$LOX" --emit-cpp "$WORK/out.cpp" "$script" > "$WORK/emit.log"; then
+            echo "SKIPPED  $script"
+            sed 's/^/         /' "$WORK/emit.log"
+            continue
+        fi
+        if ! $CXX -std=c++23 -O2 -I "$ROOT/src/aot" "$WORK/out.cpp" -o "$WORK/app"; then
+            echo "FAILED   $script"
+            status=1
+            continue
+        fi
+        actual=$("$WORK/app" 2>&1; echo "exit $?")
+        if [ "$expected" != "$actual" ]; then
+            echo "MISMATCH $script"
+            printf '%s\n' "$expected" > "$WORK/expected"
+            printf '%s\n' "$actual" > "$WORK/actual"
+            diff "$WORK/expected" "$WORK/actual"
+            status=1
+        else
+            echo "ok       $script"
+        fi
+    done
+done
+exit $status
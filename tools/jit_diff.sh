@@ -0,0 +1,25 @@
+#!/bin/sh
+# Runs every .lox script in the given directories (default: bench/) with and
+# without --jit and reports any difference in output or exit status.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+THRESHOLD=${THRESHOLD:-1}
+[ $# -eq 0 ] && set -- "$ROOT/bench"
+
+status=0
+for dir in "$@"; do
+    for script in "$dir"/*.lox; do
+        expected=$("$LOX" "$script" 2>&1; echo "exit $?")
+        actual=$("$LOX" --jit --jit-threshold="$THRESHOLD" "$script" 2>&1; echo "exit $?")
+        if [ "$expected" != "$actual" ]; then
+            echo "MISMATCH $script"
+            printf '%s\n' "$expected" > /tmp/jit_diff_expected
+            printf '%s\n' "$actual" > /tmp/jit_diff_actual
+            diff /tmp/jit_diff_expected /tmp/jit_diff_actual
+            status=1
+        else
+            echo "ok       $script"
+        fi
+    done
+done
+exit $status
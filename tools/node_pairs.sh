@@ -0,0 +1,9 @@
+#!/bin/sh
+# Counts parent/child node pairs over every .lox script under the given
+# directories (default: bench/), most frequent first. Use it to pick the
+# next shapes worth fusing into a single node.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+[ $# -eq 0 ] && set -- "$ROOT/bench"
+
+find "$@" -name '*.lox' | sort | xargs "$LOX" --node-pairs
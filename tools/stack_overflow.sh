@@ -0,0 +1,50 @@
+#!/bin/sh
+# Recurses 50000 calls deep through a function, an expression, an initializer
+# and a method on every engine, and checks that each run stops with a
+# "Stack overflow." runtime error instead of crashing. A recursion that stays
+# under the limit has to finish normally.
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+LOX=${LOX:-$ROOT/build/lox}
+WORK=${WORK:-/tmp/stack_overflow}
+mkdir -p "$WORK"
+
+cat > "$WORK/function.lox" <<'EOF'
+fun deep(n) { if (n > 0) deep(n - 1); }
+deep(50000);
+EOF
+cat > "$WORK/expression.lox" <<'EOF'
+fun deep(n) { if (n > 0) return 1 + deep(n - 1); return 0; }
+print deep(50000);
+EOF
+cat > "$WORK/initializer.lox" <<'EOF'
+class Deep { init(n) { if (n > 0) Deep(n - 1); } }
+Deep(50000);
+EOF
+cat > "$WORK/method.lox" <<'EOF'
+class Deep { go(n) { if (n > 0) this.go(n - 1); } }
+Deep().go(50000);
+EOF
+cat > "$WORK/shallow.lox" <<'EOF'
+fun deep(n) { if (n > 0) return 1 + deep(n - 1); return 0; }
+print deep(2000) == 2000;
+EOF
+
+status=0
+for engine in tree vm closure; do
+    for script in function expression initializer method shallow; do
+        if [ "$script" = shallow ]; then
+            expected=$(printf 'true\nexit 0')
+        else
+            expected=$(printf 'Stack overflow.\n[line 1]\nexit 70')
+        fi
+        actual=$("$LOX" --engine=$engine "$WORK/$script.lox" 2>&1; echo "exit $?")
+        if [ "$expected" != "$actual" ]; then
+            echo "FAILED   $engine $script"
+            printf '%s\n' "$actual" | sed 's/^/         /'
+            status=1
+        else
+            echo "ok       $engine $script"
+        fi
+    done
+done
+exit $status